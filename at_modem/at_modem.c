@@ -0,0 +1,288 @@
+/*! @file
+  @brief
+  AT command engine for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/03/02 11:05:48
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+
+/***** System headers *******************************************************/
+#include <project.h>
+
+/***** Local headers ********************************************************/
+#include "at_modem.h"
+
+/***** Constant values ******************************************************/
+//! built-in patterns. (index of pattern[])
+#define PAT_OK      0
+#define PAT_ERROR   1
+#define PAT_CME     2
+#define PAT_CMS     3
+#define PAT_ECHO    4
+#define N_BUILTIN   5
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/***** Function prototypes **************************************************/
+/***** Global variables *****************************************************/
+/***** Local variables ******************************************************/
+
+//! built-in patterns. The first match wins, so the order matters.
+static const char * const builtin_pattern[N_BUILTIN] = {
+  "OK", "ERROR", "+CME ERROR:", "+CMS ERROR:", "AT",
+};
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! start a new line.
+
+  @param  am            Pointer of AT_MODEM.
+*/
+static void line_start(AT_MODEM *am)
+{
+  am->col  = 0;
+  am->cand = (1UL << am->n_pattern) - 1;
+}
+
+
+//================================================================
+/*! finish the current command.
+
+  @param  am            Pointer of AT_MODEM.
+  @param  result        AT_RESULT_*
+  @param  len           Length of the line.
+  @note
+    The queue is advanced before the callback, so the callback
+    can queue the next command by at_send().
+*/
+static void command_finish(AT_MODEM *am, int result, int len)
+{
+  AT_COMMAND c = am->q[am->q_rd];
+
+  am->busy = 0;
+  am->q_rd = (am->q_rd + 1) % AT_SIZE_QUEUE;
+  am->n_queue--;
+
+  if( c.callback ) c.callback(am, result, am->line, len, c.arg);
+}
+
+
+//================================================================
+/*! end of the received line. dispatch it by the matched pattern.
+
+  @param  am            Pointer of AT_MODEM.
+  @return int           1 if the command was finished, otherwise 0.
+*/
+static int line_end(AT_MODEM *am)
+{
+  int len = (am->col < AT_SIZE_LINE) ? am->col : AT_SIZE_LINE - 1;
+  am->line[len] = '\0';
+
+  // the first pattern, which matched whole (exact) or as a prefix.
+  uint32_t cand = am->cand;
+  int i;
+  for( i = 0; i < am->n_pattern; i++ ) {
+    if( !(cand & (1UL << i)) ) continue;
+    if( am->pattern_len[i] > am->col ) continue;
+    if( (am->exact & (1UL << i)) && am->pattern_len[i] != am->col ) continue;
+    break;
+  }
+
+  switch( i ) {
+  case PAT_ECHO:
+    return 0;
+
+  case PAT_OK:
+  case PAT_ERROR:
+  case PAT_CME:
+  case PAT_CMS:
+    if( !am->busy ) break;
+    command_finish(am, (i == PAT_OK) ? AT_RESULT_OK : AT_RESULT_ERROR, len);
+    return 1;
+
+  default:
+    if( i < am->n_pattern ) {
+      am->n_urc_received++;
+      am->urc[i - N_BUILTIN].handler(am, am->line, len);
+      return 0;
+    }
+    if( !am->busy ) break;
+
+    // intermediate response.
+    const AT_COMMAND *c = &am->q[am->q_rd];
+    if( c->callback ) c->callback(am, AT_RESULT_LINE, am->line, len, c->arg);
+    return 0;
+  }
+
+  am->n_unknown++;
+  return 0;
+}
+
+
+//================================================================
+/*! process a received char.
+
+  @param  am            Pointer of AT_MODEM.
+  @param  ch            received char.
+  @return int           1 if the command was finished, otherwise 0.
+*/
+static int rx_char(AT_MODEM *am, uint8_t ch)
+{
+  int ret = 0;
+
+  if( ch == '\r' || ch == '\n' ) {
+    if( am->col != 0 ) ret = line_end(am);
+    line_start(am);
+    return ret;
+  }
+
+  // drop the patterns which differ at this column.
+  uint16_t col  = am->col;
+  uint32_t cand = am->cand;
+  int i;
+  for( i = 0; (cand >> i) != 0; i++ ) {
+    if( !(cand & (1UL << i)) ) continue;
+    if( col < am->pattern_len[i] && am->pattern[i][col] != ch ) {
+      am->cand &= ~(1UL << i);
+    }
+  }
+
+  if( col < AT_SIZE_LINE - 1 ) am->line[col] = ch;
+  if( col != 0xffff ) am->col = col + 1;
+
+  return 0;
+}
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! initialize
+
+  @memberof AT_MODEM
+  @param  am            Pointer of AT_MODEM.
+  @param  uh            Pointer of UART_HANDLE.
+*/
+void at_init(AT_MODEM *am, UART_HANDLE *uh)
+{
+  *am = (AT_MODEM){
+    .uh    = uh,
+    .exact = (1UL << PAT_OK) | (1UL << PAT_ERROR),
+  };
+
+  for( int i = 0; i < N_BUILTIN; i++ ) {
+    am->pattern[i] = builtin_pattern[i];
+    am->pattern_len[i] = strlen(builtin_pattern[i]);
+  }
+  at_set_urc(am, 0, 0);
+}
+
+
+//================================================================
+/*! set URC handlers.
+
+  @memberof AT_MODEM
+  @param  am            Pointer of AT_MODEM.
+  @param  urc           Array of AT_URC. (kept by the caller)
+  @param  num           Num of AT_URC. (max AT_MAX_URC)
+  @note
+    A line starts with the prefix is passed to the handler, even while
+    a command is waiting. (e.g. "+CREG:" of both AT+CREG? and URC)
+*/
+void at_set_urc(AT_MODEM *am, const AT_URC *urc, int num)
+{
+  if( num > AT_MAX_URC ) num = AT_MAX_URC;
+
+  for( int i = 0; i < num; i++ ) {
+    am->pattern[N_BUILTIN + i] = urc[i].prefix;
+    am->pattern_len[N_BUILTIN + i] = strlen(urc[i].prefix);
+  }
+  am->urc = urc;
+  am->n_pattern = N_BUILTIN + num;
+  line_start(am);
+}
+
+
+//================================================================
+/*! queue a command.
+
+  @memberof AT_MODEM
+  @param  am            Pointer of AT_MODEM.
+  @param  cmd           Command without CR. e.g. "AT+CSQ" (kept by the caller)
+  @param  timeout       Timeout in ms, or UART_TIMEOUT_FOREVER.
+  @param  callback      Callback function, or NULL.
+  @param  arg           Argument of the callback.
+  @return int           0 or -1 if the queue is full.
+  @note
+    The command is sent by at_poll(). The callback is called with
+    AT_RESULT_LINE for each intermediate line, and then once with
+    the final result.
+*/
+int at_send(AT_MODEM *am, const char *cmd, uint32_t timeout, AT_CALLBACK callback, void *arg)
+{
+  if( am->n_queue == AT_SIZE_QUEUE ) return -1;
+
+  am->q[(am->q_rd + am->n_queue) % AT_SIZE_QUEUE] = (AT_COMMAND){
+    .cmd      = cmd,
+    .timeout  = timeout,
+    .callback = callback,
+    .arg      = arg,
+  };
+  am->n_queue++;
+
+  return 0;
+}
+
+
+//================================================================
+/*! process received data, timeout and the next command.
+
+  @memberof AT_MODEM
+  @param  am            Pointer of AT_MODEM.
+  @return int           Num of finished commands.
+  @note
+    Call this from the main loop, e.g. woken by UART_EVENT_RX_DELIMITER.
+    The received data is matched against all patterns in rxfifo as
+    bytes arrive, and copied only once into the line buffer.
+    Timeout needs uart_tick().
+*/
+int at_poll(AT_MODEM *am)
+{
+  const uint8_t *p;
+  int n;
+  int ret = 0;
+
+  while( (n = uart_rx_peek(am->uh, &p)) > 0 ) {
+    for( int i = 0; i < n; i++ ) ret += rx_char(am, p[i]);
+    uart_rx_consume(am->uh, n);
+  }
+
+  if( am->busy && am->q[am->q_rd].timeout != UART_TIMEOUT_FOREVER &&
+      (int32_t)(uart_tick_count - am->deadline) >= 0 ) {
+    am->n_timeout++;
+    am->line[0] = '\0';
+    command_finish(am, AT_RESULT_TIMEOUT, 0);
+    ret++;
+  }
+
+  if( !am->busy && am->n_queue != 0 ) {
+    const AT_COMMAND *c = &am->q[am->q_rd];
+    am->busy = 1;
+    am->deadline = uart_tick_count + c->timeout;
+    uart_puts(am->uh, c->cmd);
+    uart_putc(am->uh, '\r');
+  }
+
+  return ret;
+}
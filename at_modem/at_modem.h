@@ -0,0 +1,142 @@
+/*! @file
+  @brief
+  AT command engine for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/03/02 11:05:48
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+#ifndef PSOC5_AT_MODEM_H_
+#define PSOC5_AT_MODEM_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***** System headers *******************************************************/
+#include <stdint.h>
+
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+
+
+/***** Constant values ******************************************************/
+//! result of the command. (callback)
+#define AT_RESULT_LINE    0     //!< intermediate response line.
+#define AT_RESULT_OK      1     //!< "OK"
+#define AT_RESULT_ERROR   2     //!< "ERROR", "+CME ERROR:" or "+CMS ERROR:"
+#define AT_RESULT_TIMEOUT 3     //!< no final result in time.
+
+//! num of queued commands.
+#ifndef AT_SIZE_QUEUE
+# define AT_SIZE_QUEUE 4
+#endif
+
+//! size of line buffer. (longer lines are truncated)
+#ifndef AT_SIZE_LINE
+# define AT_SIZE_LINE 128
+#endif
+
+//! maximum num of URC prefixes.
+#define AT_MAX_URC 24
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+
+struct AT_MODEM;
+
+//! callback of the command. line is NUL terminated.
+typedef void (*AT_CALLBACK)(struct AT_MODEM *am, int result, const char *line, int len, void *arg);
+
+
+//================================================
+/*!@brief
+  Unsolicited result code handler
+*/
+typedef struct AT_URC {
+  const char *prefix;           //!< prefix of the line. e.g. "+CMTI:"
+  void (*handler)(struct AT_MODEM *am, const char *line, int len);
+} AT_URC;
+
+
+//================================================
+/*!@brief
+  Queued command
+*/
+typedef struct AT_COMMAND {
+  const char  *cmd;             // command without CR. (kept by the caller)
+  uint32_t     timeout;         // timeout in ms, or UART_TIMEOUT_FOREVER.
+  AT_CALLBACK  callback;
+  void        *arg;
+} AT_COMMAND;
+
+
+//================================================
+/*!@brief
+  AT command engine
+*/
+typedef struct AT_MODEM {
+  //! @privatesection
+  UART_HANDLE *uh;                      // UART connected to the modem.
+
+  // command queue. (main context only)
+  AT_COMMAND   q[AT_SIZE_QUEUE];
+  uint8_t      q_rd;                    // index of the first command.
+  uint8_t      n_queue;                 // num of commands in the queue.
+  uint8_t      busy;                    // q[q_rd] was sent, waiting for the result.
+  uint32_t     deadline;                // deadline in uart_tick_count.
+
+  // response matcher.
+  const AT_URC *urc;                    // URC table.
+  uint8_t      n_pattern;               // num of patterns. (built-in + URC)
+  uint32_t     exact;                   // patterns to match whole line.
+  uint32_t     cand;                    // candidate patterns of the line.
+  const char  *pattern[32];             // patterns. (bit of cand)
+  uint8_t      pattern_len[32];
+
+  // received line.
+  uint16_t     col;                     // num of chars in the line.
+  char         line[AT_SIZE_LINE];
+
+  //! @public statistics.
+  uint16_t     n_timeout;               //!< num of command timeouts.
+  uint16_t     n_urc_received;          //!< num of URCs dispatched.
+  uint16_t     n_unknown;               //!< num of lines without command.
+} AT_MODEM;
+
+
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+void at_init(AT_MODEM *am, UART_HANDLE *uh);
+void at_set_urc(AT_MODEM *am, const AT_URC *urc, int num);
+int at_send(AT_MODEM *am, const char *cmd, uint32_t timeout, AT_CALLBACK callback, void *arg);
+int at_poll(AT_MODEM *am);
+
+
+/***** Inline functions *****************************************************/
+
+//================================================================
+/*! check no command is waiting.
+
+  @memberof AT_MODEM
+  @param  am            Pointer of AT_MODEM.
+  @return int           result (bool)
+*/
+static inline int at_is_idle(const AT_MODEM *am)
+{
+  return am->n_queue == 0;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
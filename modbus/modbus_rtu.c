@@ -0,0 +1,324 @@
+/*! @file
+  @brief
+  Modbus RTU slave for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/02/15 10:12:40
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+
+/***** System headers *******************************************************/
+#include <project.h>
+
+/***** Local headers ********************************************************/
+#include "modbus_rtu.h"
+
+/***** Constant values ******************************************************/
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+
+//================================================
+/*!@brief
+  Response writer. (calculates CRC on the fly)
+*/
+typedef struct MODBUS_TX {
+  UART_HANDLE *uh;              // NULL if no response. (broadcast)
+  uint16_t     crc;
+  uint8_t      n;
+  uint8_t      buf[32];
+} MODBUS_TX;
+
+
+/***** Function prototypes **************************************************/
+/***** Global variables *****************************************************/
+/***** Local variables ******************************************************/
+
+//! CRC16 table. (polynomial 0xA001, reflected)
+static const uint16_t crc16_table[256] = {
+  0x0000, 0xc0c1, 0xc181, 0x0140, 0xc301, 0x03c0, 0x0280, 0xc241,
+  0xc601, 0x06c0, 0x0780, 0xc741, 0x0500, 0xc5c1, 0xc481, 0x0440,
+  0xcc01, 0x0cc0, 0x0d80, 0xcd41, 0x0f00, 0xcfc1, 0xce81, 0x0e40,
+  0x0a00, 0xcac1, 0xcb81, 0x0b40, 0xc901, 0x09c0, 0x0880, 0xc841,
+  0xd801, 0x18c0, 0x1980, 0xd941, 0x1b00, 0xdbc1, 0xda81, 0x1a40,
+  0x1e00, 0xdec1, 0xdf81, 0x1f40, 0xdd01, 0x1dc0, 0x1c80, 0xdc41,
+  0x1400, 0xd4c1, 0xd581, 0x1540, 0xd701, 0x17c0, 0x1680, 0xd641,
+  0xd201, 0x12c0, 0x1380, 0xd341, 0x1100, 0xd1c1, 0xd081, 0x1040,
+  0xf001, 0x30c0, 0x3180, 0xf141, 0x3300, 0xf3c1, 0xf281, 0x3240,
+  0x3600, 0xf6c1, 0xf781, 0x3740, 0xf501, 0x35c0, 0x3480, 0xf441,
+  0x3c00, 0xfcc1, 0xfd81, 0x3d40, 0xff01, 0x3fc0, 0x3e80, 0xfe41,
+  0xfa01, 0x3ac0, 0x3b80, 0xfb41, 0x3900, 0xf9c1, 0xf881, 0x3840,
+  0x2800, 0xe8c1, 0xe981, 0x2940, 0xeb01, 0x2bc0, 0x2a80, 0xea41,
+  0xee01, 0x2ec0, 0x2f80, 0xef41, 0x2d00, 0xedc1, 0xec81, 0x2c40,
+  0xe401, 0x24c0, 0x2580, 0xe541, 0x2700, 0xe7c1, 0xe681, 0x2640,
+  0x2200, 0xe2c1, 0xe381, 0x2340, 0xe101, 0x21c0, 0x2080, 0xe041,
+  0xa001, 0x60c0, 0x6180, 0xa141, 0x6300, 0xa3c1, 0xa281, 0x6240,
+  0x6600, 0xa6c1, 0xa781, 0x6740, 0xa501, 0x65c0, 0x6480, 0xa441,
+  0x6c00, 0xacc1, 0xad81, 0x6d40, 0xaf01, 0x6fc0, 0x6e80, 0xae41,
+  0xaa01, 0x6ac0, 0x6b80, 0xab41, 0x6900, 0xa9c1, 0xa881, 0x6840,
+  0x7800, 0xb8c1, 0xb981, 0x7940, 0xbb01, 0x7bc0, 0x7a80, 0xba41,
+  0xbe01, 0x7ec0, 0x7f80, 0xbf41, 0x7d00, 0xbdc1, 0xbc81, 0x7c40,
+  0xb401, 0x74c0, 0x7580, 0xb541, 0x7700, 0xb7c1, 0xb681, 0x7640,
+  0x7200, 0xb2c1, 0xb381, 0x7340, 0xb101, 0x71c0, 0x7080, 0xb041,
+  0x5000, 0x90c1, 0x9181, 0x5140, 0x9301, 0x53c0, 0x5280, 0x9241,
+  0x9601, 0x56c0, 0x5780, 0x9741, 0x5500, 0x95c1, 0x9481, 0x5440,
+  0x9c01, 0x5cc0, 0x5d80, 0x9d41, 0x5f00, 0x9fc1, 0x9e81, 0x5e40,
+  0x5a00, 0x9ac1, 0x9b81, 0x5b40, 0x9901, 0x59c0, 0x5880, 0x9841,
+  0x8801, 0x48c0, 0x4980, 0x8941, 0x4b00, 0x8bc1, 0x8a81, 0x4a40,
+  0x4e00, 0x8ec1, 0x8f81, 0x4f40, 0x8d01, 0x4dc0, 0x4c80, 0x8c41,
+  0x4400, 0x84c1, 0x8581, 0x4540, 0x8701, 0x47c0, 0x4680, 0x8641,
+  0x8201, 0x42c0, 0x4380, 0x8341, 0x4100, 0x81c1, 0x8081, 0x4040
+};
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! update CRC16 by a byte.
+
+  @param  crc           CRC value.
+  @param  data          data.
+  @return uint16_t      CRC value.
+*/
+static inline uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+  return (crc >> 8) ^ crc16_table[(crc ^ data) & 0xff];
+}
+
+
+//================================================================
+/*! get a word (big endian) of the frame.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  f             Frame descriptor.
+  @param  i             Offset in the frame.
+  @return uint16_t      data.
+*/
+static uint16_t frame_word(const UART_HANDLE *uh, const UART_FRAME *f, uint16_t i)
+{
+  return (uart_frame_byte(uh, f, i) << 8) | uart_frame_byte(uh, f, i + 1);
+}
+
+
+//================================================================
+/*! flush the response to txfifo.
+
+  @param  tx            Pointer of MODBUS_TX.
+*/
+static void tx_flush(MODBUS_TX *tx)
+{
+  if( tx->uh && tx->n ) uart_write(tx->uh, tx->buf, tx->n);
+  tx->n = 0;
+}
+
+
+//================================================================
+/*! put a byte to the response.
+
+  @param  tx            Pointer of MODBUS_TX.
+  @param  data          data.
+*/
+static void tx_put(MODBUS_TX *tx, uint8_t data)
+{
+  tx->crc = crc16_update(tx->crc, data);
+  tx->buf[tx->n++] = data;
+
+  // flush early, so transmission starts while making the rest.
+  if( tx->n == sizeof(tx->buf) ) tx_flush(tx);
+}
+
+
+//================================================================
+/*! put a word (big endian) to the response.
+
+  @param  tx            Pointer of MODBUS_TX.
+  @param  data          data.
+*/
+static void tx_put_word(MODBUS_TX *tx, uint16_t data)
+{
+  tx_put(tx, data >> 8);
+  tx_put(tx, data);
+}
+
+
+//================================================================
+/*! put CRC and send the response.
+
+  @param  tx            Pointer of MODBUS_TX.
+*/
+static void tx_end(MODBUS_TX *tx)
+{
+  uint16_t crc = tx->crc;
+
+  tx_put(tx, crc);
+  tx_put(tx, crc >> 8);
+  tx_flush(tx);
+}
+
+
+//================================================================
+/*! process a request frame.
+
+  @param  ms            Pointer of MODBUS_SLAVE.
+  @param  f             Frame descriptor.
+*/
+static void modbus_request(MODBUS_SLAVE *ms, const UART_FRAME *f)
+{
+  UART_HANDLE *uh = ms->uh;
+  uint16_t len = f->length;
+
+  if( len < 4 ) return;
+
+  uint8_t addr = uart_frame_byte(uh, f, 0);
+  if( addr != ms->address && addr != 0 ) return;
+
+  // check CRC, directly in rxfifo.
+  uint16_t crc = 0xffff;
+  for( int i = 0; i < len - 2; i++ ) {
+    crc = crc16_update(crc, uart_frame_byte(uh, f, i));
+  }
+  if( crc != (uart_frame_byte(uh, f, len-2) | (uart_frame_byte(uh, f, len-1) << 8)) ) {
+    ms->n_crc_error++;
+    return;
+  }
+  ms->n_request++;
+
+  MODBUS_TX tx = { .uh = (addr == 0) ? 0 : uh, .crc = 0xffff, .n = 0 };
+  uint8_t  fc = uart_frame_byte(uh, f, 1);
+  uint8_t  ex = 0;
+  uint16_t start, num;
+
+  switch( fc ) {
+  case MODBUS_READ_HOLDING_REGISTERS:
+  case MODBUS_READ_INPUT_REGISTERS: {
+    const uint16_t *regs = (fc == MODBUS_READ_HOLDING_REGISTERS) ? ms->holding_regs : ms->input_regs;
+    uint16_t n_regs = (fc == MODBUS_READ_HOLDING_REGISTERS) ? ms->n_holding_regs : ms->n_input_regs;
+
+    if( addr == 0 ) return;
+    if( len != 8 ) { ex = MODBUS_ILLEGAL_DATA_VALUE; break; }
+    start = frame_word(uh, f, 2);
+    num   = frame_word(uh, f, 4);
+    if( num < 1 || num > 125 ) { ex = MODBUS_ILLEGAL_DATA_VALUE; break; }
+    if( (uint32_t)start + num > n_regs ) { ex = MODBUS_ILLEGAL_DATA_ADDRESS; break; }
+
+    tx_put(&tx, addr);
+    tx_put(&tx, fc);
+    tx_put(&tx, num * 2);
+    for( int i = 0; i < num; i++ ) tx_put_word(&tx, regs[start + i]);
+    break;
+  }
+
+  case MODBUS_WRITE_SINGLE_REGISTER:
+    if( len != 8 ) { ex = MODBUS_ILLEGAL_DATA_VALUE; break; }
+    start = frame_word(uh, f, 2);
+    if( start >= ms->n_holding_regs ) { ex = MODBUS_ILLEGAL_DATA_ADDRESS; break; }
+
+    ms->holding_regs[start] = frame_word(uh, f, 4);
+    if( ms->on_write ) ms->on_write(ms, start, 1);
+
+    // response is an echo of the request.
+    for( int i = 0; i < 6; i++ ) tx_put(&tx, uart_frame_byte(uh, f, i));
+    break;
+
+  case MODBUS_WRITE_MULTIPLE_REGISTERS:
+    if( len < 9 ) { ex = MODBUS_ILLEGAL_DATA_VALUE; break; }
+    start = frame_word(uh, f, 2);
+    num   = frame_word(uh, f, 4);
+    if( num < 1 || num > 123 || uart_frame_byte(uh, f, 6) != num * 2 ||
+        len != 9 + num * 2 ) { ex = MODBUS_ILLEGAL_DATA_VALUE; break; }
+    if( (uint32_t)start + num > ms->n_holding_regs ) { ex = MODBUS_ILLEGAL_DATA_ADDRESS; break; }
+
+    for( int i = 0; i < num; i++ ) {
+      ms->holding_regs[start + i] = frame_word(uh, f, 7 + i * 2);
+    }
+    if( ms->on_write ) ms->on_write(ms, start, num);
+
+    tx_put(&tx, addr);
+    tx_put(&tx, fc);
+    tx_put_word(&tx, start);
+    tx_put_word(&tx, num);
+    break;
+
+  default:
+    ex = MODBUS_ILLEGAL_FUNCTION;
+    break;
+  }
+
+  // no response to broadcast.
+  if( addr == 0 ) return;
+
+  if( ex ) {
+    ms->n_exception++;
+    tx.n = 0;
+    tx.crc = 0xffff;
+    tx_put(&tx, addr);
+    tx_put(&tx, fc | 0x80);
+    tx_put(&tx, ex);
+  }
+  tx_end(&tx);
+}
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! calculate CRC16 for Modbus.
+
+  @param  crc           Initial value. (0xffff)
+  @param  data          Pointer of data.
+  @param  size          Size of data.
+  @return uint16_t      CRC value. (send lower byte first)
+*/
+uint16_t modbus_crc16(uint16_t crc, const void *data, size_t size)
+{
+  const uint8_t *p = data;
+
+  while( size-- > 0 ) crc = crc16_update(crc, *p++);
+  return crc;
+}
+
+
+//================================================================
+/*! initialize
+
+  @memberof MODBUS_SLAVE
+  @param  ms            Pointer of MODBUS_SLAVE.
+  @param  uh            Pointer of UART_HANDLE. (idle gap framing enabled)
+  @param  address       Slave address. (1..247)
+*/
+void modbus_init(MODBUS_SLAVE *ms, UART_HANDLE *uh, uint8_t address)
+{
+  *ms = (MODBUS_SLAVE){
+    .uh      = uh,
+    .address = address,
+  };
+}
+
+
+//================================================================
+/*! process a received request.
+
+  @memberof MODBUS_SLAVE
+  @param  ms            Pointer of MODBUS_SLAVE.
+  @return int           1 if a frame was processed, 0 if no frame.
+  @note
+    Call this from the main loop, e.g. woken by UART_EVENT_RX_FRAME.
+    The request is parsed in rxfifo without copy, and the response
+    is transmitted by Tx ISR while the rest is being made.
+*/
+int modbus_poll(MODBUS_SLAVE *ms)
+{
+  const UART_FRAME *f = uart_frame_peek(ms->uh);
+  if( !f ) return 0;
+
+  modbus_request(ms, f);
+  uart_frame_discard(ms->uh);
+
+  return 1;
+}
@@ -0,0 +1,118 @@
+/*! @file
+  @brief
+  Modbus RTU slave for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/02/15 10:12:40
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+#ifndef PSOC5_MODBUS_RTU_H_
+#define PSOC5_MODBUS_RTU_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***** System headers *******************************************************/
+#include <stdint.h>
+
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+
+
+/***** Constant values ******************************************************/
+//! function codes.
+#define MODBUS_READ_HOLDING_REGISTERS   3
+#define MODBUS_READ_INPUT_REGISTERS     4
+#define MODBUS_WRITE_SINGLE_REGISTER    6
+#define MODBUS_WRITE_MULTIPLE_REGISTERS 16
+
+//! exception codes.
+#define MODBUS_ILLEGAL_FUNCTION     1
+#define MODBUS_ILLEGAL_DATA_ADDRESS 2
+#define MODBUS_ILLEGAL_DATA_VALUE   3
+
+
+/***** Macros ***************************************************************/
+
+//! frame gap of 3.5 characters in us. (fixed 1750us over 19200bps)
+#define MODBUS_FRAME_GAP_US(baud) \
+  ((baud) > 19200 ? 1750 : (uint16_t)(38500000UL / (baud)))
+
+
+/***** Typedefs *************************************************************/
+
+//================================================
+/*!@brief
+  Modbus RTU slave
+*/
+typedef struct MODBUS_SLAVE {
+  //! @privatesection
+  UART_HANDLE *uh;                      // UART for Modbus.
+  uint8_t      address;                 // slave address.
+
+  uint16_t    *holding_regs;            // holding registers. (FC 3, 6, 16)
+  uint16_t     n_holding_regs;
+  uint16_t    *input_regs;              // input registers. (FC 4)
+  uint16_t     n_input_regs;
+
+  //! @public called after registers were written by the master.
+  void (*on_write)(struct MODBUS_SLAVE *ms, uint16_t addr, uint16_t num);
+
+  //! @public statistics.
+  uint16_t     n_request;               //!< num of requests to this slave.
+  uint16_t     n_crc_error;             //!< num of frames with CRC error.
+  uint16_t     n_exception;             //!< num of exception responses.
+} MODBUS_SLAVE;
+
+
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+uint16_t modbus_crc16(uint16_t crc, const void *data, size_t size);
+void modbus_init(MODBUS_SLAVE *ms, UART_HANDLE *uh, uint8_t address);
+int modbus_poll(MODBUS_SLAVE *ms);
+
+
+/***** Inline functions *****************************************************/
+
+//================================================================
+/*! set holding registers. (FC 3, 6, 16)
+
+  @memberof MODBUS_SLAVE
+  @param  ms            Pointer of MODBUS_SLAVE.
+  @param  regs          Array of registers. (address 0 .. num-1)
+  @param  num           Num of registers.
+*/
+static inline void modbus_set_holding_registers(MODBUS_SLAVE *ms, uint16_t *regs, uint16_t num)
+{
+  ms->holding_regs = regs;
+  ms->n_holding_regs = num;
+}
+
+
+//================================================================
+/*! set input registers. (FC 4)
+
+  @memberof MODBUS_SLAVE
+  @param  ms            Pointer of MODBUS_SLAVE.
+  @param  regs          Array of registers. (address 0 .. num-1)
+  @param  num           Num of registers.
+*/
+static inline void modbus_set_input_registers(MODBUS_SLAVE *ms, uint16_t *regs, uint16_t num)
+{
+  ms->input_regs = regs;
+  ms->n_input_regs = num;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,395 @@
+/*! @file
+  @brief
+  Incremental NMEA 0183 parser for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/02/24 14:20:05
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+
+/***** System headers *******************************************************/
+#include <project.h>
+
+/***** Local headers ********************************************************/
+#include "nmea.h"
+
+/***** Constant values ******************************************************/
+//! parser state.
+#define ST_IDLE   0             // waiting for '$'.
+#define ST_DATA   1             // in the fields.
+#define ST_CKSUM1 2             // waiting for the 1st hex digit of checksum.
+#define ST_CKSUM2 3             // waiting for the 2nd hex digit of checksum.
+
+
+/***** Macros ***************************************************************/
+//! sentence formatter. (the last 3 chars of the address field)
+#define NMEA_ID(a,b,c) (((uint32_t)(a) << 16) | ((b) << 8) | (c))
+
+
+/***** Typedefs *************************************************************/
+/***** Function prototypes **************************************************/
+/***** Global variables *****************************************************/
+/***** Local variables ******************************************************/
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! value of a hex digit.
+
+  @param  ch            character.
+  @return int           value, or -1 if not a hex digit.
+*/
+static int hex_value(uint8_t ch)
+{
+  if( ch >= '0' && ch <= '9' ) return ch - '0';
+  if( ch >= 'A' && ch <= 'F' ) return ch - 'A' + 10;
+  if( ch >= 'a' && ch <= 'f' ) return ch - 'a' + 10;
+  return -1;
+}
+
+
+//================================================================
+/*! get the field value in fixed point.
+
+  @param  np            Pointer of NMEA_PARSER.
+  @param  places        Num of decimal places of the result.
+  @return uint32_t      value x 10^places. (saturated)
+*/
+static uint32_t field_fixed(const NMEA_PARSER *np, int places)
+{
+  uint32_t v = np->num;
+  int      f = (np->frac < 0) ? 0 : np->frac;
+
+  for( ; f < places; f++ ) v = (v > UINT32_MAX / 10) ? UINT32_MAX : v * 10;
+  for( ; f > places; f-- ) v /= 10;
+  return v;
+}
+
+
+//================================================================
+/*! get the field value in 16bit fixed point.
+
+  @param  np            Pointer of NMEA_PARSER.
+  @param  places        Num of decimal places of the result.
+  @return uint16_t      value x 10^places. (saturated)
+*/
+static uint16_t field_fixed16(const NMEA_PARSER *np, int places)
+{
+  uint32_t v = field_fixed(np, places);
+  return (v > UINT16_MAX) ? UINT16_MAX : v;
+}
+
+
+//================================================================
+/*! get the field value in signed fixed point.
+
+  @param  np            Pointer of NMEA_PARSER.
+  @param  places        Num of decimal places of the result.
+  @return int32_t       value x 10^places. (saturated)
+*/
+static int32_t field_signed(const NMEA_PARSER *np, int places)
+{
+  uint32_t v = field_fixed(np, places);
+
+  if( v > INT32_MAX ) v = INT32_MAX;
+  return np->neg ? -(int32_t)v : (int32_t)v;
+}
+
+
+//================================================================
+/*! get the time field. (hhmmss.sss)
+
+  @param  np            Pointer of NMEA_PARSER.
+  @return uint32_t      time of day in ms.
+*/
+static uint32_t field_time(const NMEA_PARSER *np)
+{
+  uint32_t v = field_fixed(np, 3);
+
+  return (v / 10000000) * 3600000 + (v / 100000 % 100) * 60000 + v % 100000;
+}
+
+
+//================================================================
+/*! get the latitude or longitude field. ((d)ddmm.mmmmm)
+
+  @param  np            Pointer of NMEA_PARSER.
+  @return int32_t       degree x 1e7.
+*/
+static int32_t field_degree(const NMEA_PARSER *np)
+{
+  uint32_t v   = field_fixed(np, 5);
+  uint32_t deg = v / 10000000;
+  uint32_t min = v % 10000000;          // minute x 1e5
+
+  return deg * 10000000 + min * 100 / 60;
+}
+
+
+//================================================================
+/*! start a new field.
+
+  @param  np            Pointer of NMEA_PARSER.
+*/
+static void field_start(NMEA_PARSER *np)
+{
+  np->num   = 0;
+  np->frac  = -1;
+  np->neg   = 0;
+  np->empty = 1;
+  np->ch    = 0;
+}
+
+
+//================================================================
+/*! accumulate a char of the field.
+
+  @param  np            Pointer of NMEA_PARSER.
+  @param  ch            character.
+*/
+static void field_char(NMEA_PARSER *np, uint8_t ch)
+{
+  if( np->field == 0 ) {
+    np->id = (np->id << 8) | ch;
+    return;
+  }
+
+  if( np->empty ) {
+    np->ch = ch;
+    np->empty = 0;
+  }
+
+  if( ch >= '0' && ch <= '9' ) {
+    // 32bit is full. drop the decimal places, or saturate the integer.
+    if( np->num > (UINT32_MAX - 9) / 10 ) {
+      if( np->frac < 0 ) np->num = UINT32_MAX;
+    } else if( np->frac < 0 ) {
+      np->num = np->num * 10 + (ch - '0');
+    } else if( np->frac < NMEA_FRAC_MAX ) {
+      np->num = np->num * 10 + (ch - '0');
+      np->frac++;
+    }
+  } else if( ch == '.' ) {
+    if( np->frac < 0 ) np->frac = 0;
+  } else if( ch == '-' ) {
+    np->neg = 1;
+  }
+}
+
+
+//================================================================
+/*! end of the field. decode it into the work.
+
+  @param  np            Pointer of NMEA_PARSER.
+*/
+static void field_end(NMEA_PARSER *np)
+{
+  if( np->field == 0 ) {
+    switch( np->id & 0xffffff ) {
+    case NMEA_ID('G','G','A'):  np->type = NMEA_TYPE_GGA;   break;
+    case NMEA_ID('R','M','C'):  np->type = NMEA_TYPE_RMC;   break;
+    default:                    np->type = NMEA_TYPE_OTHER; break;
+    }
+    return;
+  }
+  if( np->empty ) return;
+
+  if( np->type == NMEA_TYPE_GGA ) {
+    NMEA_GGA *gga = &np->work.gga;
+
+    switch( np->field ) {
+    case 1:  gga->time  = field_time(np);      break;
+    case 2:  gga->lat   = field_degree(np);    break;
+    case 3:  if( np->ch == 'S' ) gga->lat = -gga->lat; break;
+    case 4:  gga->lon   = field_degree(np);    break;
+    case 5:  if( np->ch == 'W' ) gga->lon = -gga->lon; break;
+    case 6:  gga->fix   = np->num;             break;
+    case 7:  gga->sats  = np->num;             break;
+    case 8:  gga->hdop  = field_fixed16(np, 2); break;
+    case 9:  gga->alt   = field_signed(np, 2); break;
+    case 11: gga->geoid = field_signed(np, 2); break;
+    }
+
+  } else if( np->type == NMEA_TYPE_RMC ) {
+    NMEA_RMC *rmc = &np->work.rmc;
+
+    switch( np->field ) {
+    case 1:  rmc->time   = field_time(np);     break;
+    case 2:  rmc->valid  = (np->ch == 'A');    break;
+    case 3:  rmc->lat    = field_degree(np);   break;
+    case 4:  if( np->ch == 'S' ) rmc->lat = -rmc->lat; break;
+    case 5:  rmc->lon    = field_degree(np);   break;
+    case 6:  if( np->ch == 'W' ) rmc->lon = -rmc->lon; break;
+    case 7:  rmc->speed  = field_fixed16(np, 2); break;
+    case 8:  rmc->course = field_fixed16(np, 2); break;
+    case 9:
+      rmc->day   = np->num / 10000;
+      rmc->month = np->num / 100 % 100;
+      rmc->year  = np->num % 100 + 2000;
+      break;
+    }
+  }
+}
+
+
+//================================================================
+/*! the checksum was verified. publish the work.
+
+  @param  np            Pointer of NMEA_PARSER.
+  @return int           type of the sentence.
+*/
+static int sentence_commit(NMEA_PARSER *np)
+{
+  switch( np->type ) {
+  case NMEA_TYPE_GGA:  np->gga = np->work.gga;  break;
+  case NMEA_TYPE_RMC:  np->rmc = np->work.rmc;  break;
+  }
+
+  np->n_sentence++;
+  if( np->on_sentence ) np->on_sentence(np, np->type);
+
+  return np->type;
+}
+
+
+//================================================================
+/*! parse a byte.
+
+  @param  np            Pointer of NMEA_PARSER.
+  @param  ch            received byte.
+  @return int           type of the sentence if verified, otherwise 0.
+*/
+static int nmea_parse_byte(NMEA_PARSER *np, uint8_t ch)
+{
+  int h;
+
+  // '$' always starts a new sentence, to resync after noise.
+  if( ch == '$' ) {
+    if( np->state != ST_IDLE ) np->n_format_error++;
+    np->state = ST_DATA;
+    np->len   = 1;
+    np->field = 0;
+    np->type  = 0;
+    np->cksum = 0;
+    np->id    = 0;
+    memset( &np->work, 0, sizeof(np->work) );
+    field_start(np);
+    return 0;
+  }
+
+  switch( np->state ) {
+  case ST_DATA:
+    if( ++np->len > NMEA_MAX_LENGTH || ch < 0x20 || ch > 0x7e ) break;
+
+    if( ch == '*' ) {
+      field_end(np);
+      np->state = ST_CKSUM1;
+      return 0;
+    }
+
+    np->cksum ^= ch;
+    if( ch == ',' ) {
+      field_end(np);
+      np->field++;
+      field_start(np);
+    } else {
+      field_char(np, ch);
+    }
+    return 0;
+
+  case ST_CKSUM1:
+    if( (h = hex_value(ch)) < 0 ) break;
+    np->cksum_rx = h << 4;
+    np->state = ST_CKSUM2;
+    return 0;
+
+  case ST_CKSUM2:
+    if( (h = hex_value(ch)) < 0 ) break;
+    np->state = ST_IDLE;
+    if( (np->cksum_rx | h) != np->cksum ) {
+      np->n_cksum_error++;
+      return 0;
+    }
+    return sentence_commit(np);
+
+  default:              // ST_IDLE. (CR LF and noise between sentences)
+    return 0;
+  }
+
+  // broken sentence.
+  np->n_format_error++;
+  np->state = ST_IDLE;
+  return 0;
+}
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! initialize
+
+  @memberof NMEA_PARSER
+  @param  np            Pointer of NMEA_PARSER.
+  @param  uh            Pointer of UART_HANDLE, or NULL if use nmea_parse() only.
+*/
+void nmea_init(NMEA_PARSER *np, UART_HANDLE *uh)
+{
+  *np = (NMEA_PARSER){
+    .uh    = uh,
+    .state = ST_IDLE,
+  };
+}
+
+
+//================================================================
+/*! parse data.
+
+  @memberof NMEA_PARSER
+  @param  np            Pointer of NMEA_PARSER.
+  @param  data          Pointer of received data.
+  @param  size          Size of data.
+  @return int           Types of verified sentences. (NMEA_TYPE_*, OR-ed)
+  @note
+    Sentences may be split at any point. The state is kept in np.
+*/
+int nmea_parse(NMEA_PARSER *np, const void *data, size_t size)
+{
+  const uint8_t *p = data;
+  int ret = 0;
+
+  while( size-- > 0 ) ret |= nmea_parse_byte(np, *p++);
+  return ret;
+}
+
+
+//================================================================
+/*! parse received data in rxfifo.
+
+  @memberof NMEA_PARSER
+  @param  np            Pointer of NMEA_PARSER.
+  @return int           Types of verified sentences. (NMEA_TYPE_*, OR-ed)
+  @note
+    Call this from the main loop. The data is parsed in rxfifo without
+    copy, and consumed. Fields are decoded as bytes arrive, and the
+    result is published to np->gga or np->rmc when the checksum is
+    verified.
+*/
+int nmea_poll(NMEA_PARSER *np)
+{
+  const uint8_t *p;
+  int n;
+  int ret = 0;
+
+  while( (n = uart_rx_peek(np->uh, &p)) > 0 ) {
+    ret |= nmea_parse(np, p, n);
+    uart_rx_consume(np->uh, n);
+  }
+
+  return ret;
+}
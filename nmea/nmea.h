@@ -0,0 +1,131 @@
+/*! @file
+  @brief
+  Incremental NMEA 0183 parser for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/02/24 14:20:05
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+#ifndef PSOC5_NMEA_H_
+#define PSOC5_NMEA_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***** System headers *******************************************************/
+#include <stdint.h>
+
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+
+
+/***** Constant values ******************************************************/
+//! sentence types. (return value of nmea_poll)
+#define NMEA_TYPE_GGA   0x01
+#define NMEA_TYPE_RMC   0x02
+#define NMEA_TYPE_OTHER 0x80
+
+//! maximum length of a sentence. ('$' to '\\n')
+#define NMEA_MAX_LENGTH 82
+
+//! maximum num of decimal places to parse.
+#define NMEA_FRAC_MAX   5
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+
+//================================================
+/*!@brief
+  GGA: fix data
+*/
+typedef struct NMEA_GGA {
+  uint32_t time;                //!< UTC time of day in ms.
+  int32_t  lat;                 //!< latitude in 1e-7 degree. (north is positive)
+  int32_t  lon;                 //!< longitude in 1e-7 degree. (east is positive)
+  uint8_t  fix;                 //!< fix quality. (0: invalid)
+  uint8_t  sats;                //!< num of satellites in use.
+  uint16_t hdop;                //!< HDOP x100.
+  int32_t  alt;                 //!< altitude above mean sea level in cm.
+  int32_t  geoid;               //!< geoid separation in cm.
+} NMEA_GGA;
+
+
+//================================================
+/*!@brief
+  RMC: recommended minimum data
+*/
+typedef struct NMEA_RMC {
+  uint32_t time;                //!< UTC time of day in ms.
+  int32_t  lat;                 //!< latitude in 1e-7 degree. (north is positive)
+  int32_t  lon;                 //!< longitude in 1e-7 degree. (east is positive)
+  uint16_t speed;               //!< speed over ground in knots x100.
+  uint16_t course;              //!< course over ground in degree x100.
+  uint16_t year;                //!< UTC date.
+  uint8_t  month;
+  uint8_t  day;
+  uint8_t  valid;               //!< status 'A'. (bool)
+} NMEA_RMC;
+
+
+//================================================
+/*!@brief
+  NMEA parser
+*/
+typedef struct NMEA_PARSER {
+  //! @privatesection
+  UART_HANDLE *uh;                      // UART connected to the receiver.
+
+  uint8_t      state;                   // parser state.
+  uint8_t      len;                     // length of the sentence.
+  uint8_t      field;                   // index of the field.
+  uint8_t      type;                    // type of the sentence. (NMEA_TYPE_*)
+  uint8_t      cksum;                   // XOR of the sentence.
+  uint8_t      cksum_rx;                // received checksum.
+  uint32_t     id;                      // last 3 chars of the address field.
+
+  // value of the field. (accumulated as bytes arrive)
+  uint32_t     num;                     // digits without the decimal point.
+  int8_t       frac;                    // num of decimal places, or -1.
+  uint8_t      neg;                     // '-' found.
+  uint8_t      empty;                   // no char in the field.
+  char         ch;                      // the first char of the field.
+
+  union {
+    NMEA_GGA   gga;
+    NMEA_RMC   rmc;
+  } work;                               // the sentence being parsed.
+
+  //! @public latest data. (updated when the checksum is verified)
+  NMEA_GGA     gga;
+  NMEA_RMC     rmc;
+
+  //! @public called when a sentence was verified.
+  void (*on_sentence)(struct NMEA_PARSER *np, int type);
+
+  //! @public statistics.
+  uint16_t     n_sentence;              //!< num of verified sentences.
+  uint16_t     n_cksum_error;           //!< num of checksum errors.
+  uint16_t     n_format_error;          //!< num of broken sentences.
+} NMEA_PARSER;
+
+
+/***** Global variables *****************************************************/
+/***** Function prototypes **************************************************/
+void nmea_init(NMEA_PARSER *np, UART_HANDLE *uh);
+int nmea_parse(NMEA_PARSER *np, const void *data, size_t size);
+int nmea_poll(NMEA_PARSER *np);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,135 @@
+/*! @file
+  @brief
+  Host stand-in of project.h generated by PSoC Creator. (for tests)
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  Components:
+    UART_1, UART_2    UART (v2.50) with isr_NAME_Tx, isr_NAME_Rx,
+                      isr_NAME_RxIdle, isr_NAME_TxDma, DMA_NAME_Tx
+                      and DMA_NAME_Rx.
+  Pins are defined by each test.
+*/
+
+#ifndef PSOC5_TEST_PROJECT_H_
+#define PSOC5_TEST_PROJECT_H_
+
+/***** System headers *******************************************************/
+#include <stdint.h>
+#include <stddef.h>
+
+
+/***** Local headers ********************************************************/
+#include "psoc_sim.h"
+
+
+/***** Typedefs *************************************************************/
+typedef uint8_t   uint8;
+typedef uint16_t  uint16;
+typedef uintptr_t uint32;       // wide enough for host addresses. (DMA)
+typedef int8_t    int8;
+typedef int16_t   int16;
+typedef int32_t   int32;
+typedef volatile uint8_t reg8;
+typedef uint8     cystatus;
+typedef void    (*cyisraddress)(void);
+
+
+/***** Macros ***************************************************************/
+#define CY_ISR(name)        void name(void)
+#define CY_ISR_PROTO(name)  void name(void)
+
+#define CYDEV_SRAM_BASE     0x1fff8000u
+#define CYDEV_PERIPH_BASE   0x40004000u
+#define HI16(x)             ((uint16)((uint32)(x) >> 16))
+#define LO16(x)             ((uint32)(x))       // keeps the host address.
+
+#define CYASSERT(x)         { if(!(x)) { CyHalt((uint8) 0u); } }
+
+#define PM_ALT_ACT_TIME_NONE  0
+#define PM_ALT_ACT_SRC_PICU   0
+
+#define CY_DMA_DISABLE_TD       0xfe
+#define CY_DMA_TD_INC_SRC_ADR   0x01
+#define CY_DMA_TD_INC_DST_ADR   0x02
+#define CY_DMA_TD_TERMOUT0_EN   0x04
+#define CY_DMA_TD_TERMOUT1_EN   0x08
+
+
+/***** Function prototypes **************************************************/
+uint8 CyEnterCriticalSection(void);
+void CyExitCriticalSection(uint8 savedIntrStatus);
+void CyPmAltAct(uint16 wakeupTime, uint16 wakeupSource);
+void CyHalt(uint8 reason);
+
+uint8 CyDmaTdAllocate(void);
+cystatus CyDmaTdSetConfiguration(uint8 tdHandle, uint16 transferCount, uint8 nextTd, uint8 configuration);
+cystatus CyDmaTdGetConfiguration(uint8 tdHandle, uint16 *transferCount, uint8 *nextTd, uint8 *configuration);
+cystatus CyDmaTdSetAddress(uint8 tdHandle, uint32 source, uint32 destination);
+cystatus CyDmaChSetInitialTd(uint8 chHandle, uint8 startTd);
+cystatus CyDmaChEnable(uint8 chHandle, uint8 preserveTds);
+cystatus CyDmaChDisable(uint8 chHandle);
+
+
+//! API of UART component and its isr / DMA components.
+#define SIM_UART_COMPONENT(NAME)                                        \
+  void  NAME ## _Start(void);                                           \
+  void  NAME ## _Stop(void);                                            \
+  void  NAME ## _ClearTxBuffer(void);                                   \
+  void  NAME ## _ClearRxBuffer(void);                                   \
+  uint8 NAME ## _ReadTxStatus(void);                                    \
+  uint8 NAME ## _ReadRxStatus(void);                                    \
+  void  NAME ## _WriteTxData(uint8 txDataByte);                         \
+  uint8 NAME ## _ReadRxData(void);                                      \
+  void  NAME ## _SetTxInterruptMode(uint8 intSrc);                      \
+  void  isr_ ## NAME ## _Tx_StartEx(cyisraddress address);              \
+  void  isr_ ## NAME ## _Tx_Enable(void);                               \
+  void  isr_ ## NAME ## _Tx_Disable(void);                              \
+  void  isr_ ## NAME ## _Rx_StartEx(cyisraddress address);              \
+  void  isr_ ## NAME ## _RxIdle_StartEx(cyisraddress address);          \
+  void  isr_ ## NAME ## _TxDma_StartEx(cyisraddress address);           \
+  uint8 DMA_ ## NAME ## _Tx_DmaInitialize(uint8 burstCount, uint8 requestPerBurst, uint16 upperSrcAddress, uint16 upperDestAddress); \
+  uint8 DMA_ ## NAME ## _Rx_DmaInitialize(uint8 burstCount, uint8 requestPerBurst, uint16 upperSrcAddress, uint16 upperDestAddress);
+
+SIM_UART_COMPONENT(UART_1)
+SIM_UART_COMPONENT(UART_2)
+
+
+/***** Constant values ******************************************************/
+#define UART_1_TX_BUFFER_SIZE         SIM_FIFO_SIZE
+#define UART_1_TXDATA_PTR             (&sim_uart[0].tx_data_reg)
+#define UART_1_RXDATA_PTR             (&sim_uart[0].rx_data_reg)
+#define UART_1_TX_STS_COMPLETE        SIM_TX_STS_COMPLETE
+#define UART_1_TX_STS_FIFO_EMPTY      SIM_TX_STS_FIFO_EMPTY
+#define UART_1_TX_STS_FIFO_FULL       SIM_TX_STS_FIFO_FULL
+#define UART_1_TX_STS_FIFO_NOT_FULL   SIM_TX_STS_FIFO_NOT_FULL
+#define UART_1_RX_STS_MRKSPC          SIM_RX_STS_MRKSPC
+#define UART_1_RX_STS_BREAK           SIM_RX_STS_BREAK
+#define UART_1_RX_STS_PAR_ERROR       SIM_RX_STS_PAR_ERROR
+#define UART_1_RX_STS_STOP_ERROR      SIM_RX_STS_STOP_ERROR
+#define UART_1_RX_STS_OVERRUN         SIM_RX_STS_OVERRUN
+#define UART_1_RX_STS_FIFO_NOTEMPTY   SIM_RX_STS_FIFO_NOTEMPTY
+#define DMA_UART_1_Tx__TD_TERMOUT_EN  CY_DMA_TD_TERMOUT0_EN
+
+#define UART_2_TX_BUFFER_SIZE         SIM_FIFO_SIZE
+#define UART_2_TXDATA_PTR             (&sim_uart[1].tx_data_reg)
+#define UART_2_RXDATA_PTR             (&sim_uart[1].rx_data_reg)
+#define UART_2_TX_STS_COMPLETE        SIM_TX_STS_COMPLETE
+#define UART_2_TX_STS_FIFO_EMPTY      SIM_TX_STS_FIFO_EMPTY
+#define UART_2_TX_STS_FIFO_FULL       SIM_TX_STS_FIFO_FULL
+#define UART_2_TX_STS_FIFO_NOT_FULL   SIM_TX_STS_FIFO_NOT_FULL
+#define UART_2_RX_STS_MRKSPC          SIM_RX_STS_MRKSPC
+#define UART_2_RX_STS_BREAK           SIM_RX_STS_BREAK
+#define UART_2_RX_STS_PAR_ERROR       SIM_RX_STS_PAR_ERROR
+#define UART_2_RX_STS_STOP_ERROR      SIM_RX_STS_STOP_ERROR
+#define UART_2_RX_STS_OVERRUN         SIM_RX_STS_OVERRUN
+#define UART_2_RX_STS_FIFO_NOTEMPTY   SIM_RX_STS_FIFO_NOTEMPTY
+#define DMA_UART_2_Tx__TD_TERMOUT_EN  CY_DMA_TD_TERMOUT0_EN
+
+
+#endif
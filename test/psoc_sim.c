@@ -0,0 +1,624 @@
+/*! @file
+  @brief
+  Host model of PSoC5LP UART, ISR and DMA components. (for tests)
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+/***** System headers *******************************************************/
+#include <signal.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "project.h"
+
+/***** Constant values ******************************************************/
+#define SIM_NUM_DMA_CH  8       // TD 0..7 are working TDs of the channels.
+#define SIM_NUM_TD      128
+#define SIM_MAX_HOOK    8
+
+#define SIM_TX_STS_DEFAULT_MASK  SIM_TX_STS_FIFO_EMPTY
+#define SIM_RX_STS_DEFAULT_MASK  (SIM_RX_STS_FIFO_NOTEMPTY | SIM_RX_STS_OVERRUN | \
+                                  SIM_RX_STS_STOP_ERROR | SIM_RX_STS_PAR_ERROR | \
+                                  SIM_RX_STS_BREAK)
+
+
+/***** Typedefs *************************************************************/
+typedef struct SIM_TD {
+  uint16_t  count;
+  uint8_t   next;
+  uint8_t   config;
+  uintptr_t src;
+  uintptr_t dst;
+} SIM_TD;
+
+typedef struct SIM_DMA_CH {
+  int     used;
+  int     uart;                 // index of sim_uart.
+  int     is_tx;                // request: Tx interrupt (a byte per edge), or RX FIFO not empty.
+  int     enabled;
+  int     preserve;
+  uint8_t initial_td;
+  uint8_t cur_td;               // TD in progress.
+} SIM_DMA_CH;
+
+
+/***** Global variables *****************************************************/
+SIM_UART sim_uart[SIM_NUM_UART];
+uint32_t sim_time;
+uint32_t sim_n_halt;
+
+
+/***** Local variables ******************************************************/
+static SIM_TD     sim_td[SIM_NUM_TD];
+static int        sim_n_td;
+static SIM_DMA_CH sim_ch[SIM_NUM_DMA_CH];
+static void     (*sim_hook[SIM_MAX_HOOK])(void);
+static int        sim_n_hook;
+static volatile int sim_cs_depth;       // nesting of critical sections.
+static volatile int sim_in_isr;         // an ISR is running.
+static volatile int sim_idle_pending[SIM_NUM_UART];
+static int        sim_signals;
+static sigset_t   sim_sigset;
+static sigset_t   sim_cs_saved;         // signal mask before the critical section.
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! block the signals standing in for interrupts. (sim_use_signals)
+*/
+static void sim_lock(sigset_t *old)
+{
+  if( sim_signals ) sigprocmask(SIG_BLOCK, &sim_sigset, old);
+}
+
+static void sim_unlock(sigset_t *old)
+{
+  if( sim_signals ) sigprocmask(SIG_SETMASK, old, 0);
+}
+
+
+//================================================================
+/*! update interrupt lines, and request the ISR on the rising edge.
+*/
+static void sim_tx_update(SIM_UART *u)
+{
+  uint8_t live = (u->tx_n == 0) ? SIM_TX_STS_FIFO_EMPTY : 0;
+  live |= (u->tx_n == SIM_FIFO_SIZE) ? SIM_TX_STS_FIFO_FULL : SIM_TX_STS_FIFO_NOT_FULL;
+
+  uint8_t line = ((live | u->tx_sticky) & u->tx_mask) != 0;
+  if( line && !u->tx_line ) {
+    u->tx_pending = 1;
+    u->tx_drq = 1;
+  }
+  u->tx_line = line;
+}
+
+static uint8_t sim_rx_status(SIM_UART *u)
+{
+  uint8_t sts = u->rx_sticky;
+
+  if( u->rx_n != 0 ) {
+    sts |= SIM_RX_STS_FIFO_NOTEMPTY | (u->rx_flags[0] & SIM_RX_STS_MRKSPC);
+  }
+  return sts;
+}
+
+static void sim_rx_update(SIM_UART *u)
+{
+  uint8_t line = (sim_rx_status(u) & u->rx_mask) != 0;
+  if( line && !u->rx_line ) u->rx_pending = 1;
+  u->rx_line = line;
+}
+
+
+//================================================================
+/*! register access. (without lock)
+*/
+static void sim_tx_push(SIM_UART *u, uint8_t ch)
+{
+  if( u->tx_n == SIM_FIFO_SIZE ) {
+    u->tx_lost++;
+    return;
+  }
+  u->tx_fifo[u->tx_n++] = ch;
+  sim_tx_update(u);
+}
+
+static uint8_t sim_rx_pop(SIM_UART *u)
+{
+  if( u->rx_n == 0 ) return 0;
+
+  uint8_t ch = u->rx_fifo[0];
+  u->rx_n--;
+  memmove(u->rx_fifo, u->rx_fifo + 1, u->rx_n);
+  memmove(u->rx_flags, u->rx_flags + 1, u->rx_n);
+  sim_rx_update(u);
+  return ch;
+}
+
+
+//================================================================
+/*! DMA transfer of a byte. The data registers of UARTs are FIFOs.
+*/
+static uint8_t sim_dma_read(uintptr_t addr)
+{
+  for( int i = 0; i < SIM_NUM_UART; i++ ) {
+    if( addr == (uintptr_t)&sim_uart[i].rx_data_reg ) return sim_rx_pop(&sim_uart[i]);
+  }
+  return *(uint8_t *)addr;
+}
+
+static void sim_dma_write(uintptr_t addr, uint8_t ch)
+{
+  for( int i = 0; i < SIM_NUM_UART; i++ ) {
+    if( addr == (uintptr_t)&sim_uart[i].tx_data_reg ) {
+      sim_tx_push(&sim_uart[i], ch);
+      return;
+    }
+  }
+  *(uint8_t *)addr = ch;
+}
+
+static void sim_dma_service(int c)
+{
+  SIM_DMA_CH *ch = &sim_ch[c];
+  SIM_UART   *u  = &sim_uart[ch->uart];
+
+  while( ch->enabled && (ch->is_tx ? u->tx_drq : u->rx_n > 0) ) {
+    SIM_TD *td = &sim_td[ch->cur_td];
+
+    if( ch->is_tx ) u->tx_drq = 0;
+
+    sim_dma_write(td->dst, sim_dma_read(td->src));
+    if( td->config & CY_DMA_TD_INC_SRC_ADR ) td->src++;
+    if( td->config & CY_DMA_TD_INC_DST_ADR ) td->dst++;
+    if( --td->count != 0 ) continue;
+
+    // end of the TD.
+    if( td->config & (CY_DMA_TD_TERMOUT0_EN | CY_DMA_TD_TERMOUT1_EN) ) u->dma_pending = 1;
+    if( td->next == CY_DMA_DISABLE_TD ) {
+      ch->enabled = 0;
+    } else if( ch->preserve ) {
+      *td = sim_td[td->next];
+    } else {
+      ch->cur_td = td->next;
+    }
+  }
+}
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! reset all components.
+*/
+void sim_reset(void)
+{
+  memset(sim_uart, 0, sizeof(sim_uart));
+  memset(sim_td, 0, sizeof(sim_td));
+  memset(sim_ch, 0, sizeof(sim_ch));
+  memset((void *)sim_idle_pending, 0, sizeof(sim_idle_pending));
+  sim_n_td = SIM_NUM_DMA_CH;
+  sim_n_hook = 0;
+  sim_time = 0;
+  sim_cs_depth = 0;
+  sim_in_isr = 0;
+
+  for( int i = 0; i < SIM_NUM_UART; i++ ) {
+    sim_uart[i].tx_mask = SIM_TX_STS_DEFAULT_MASK;
+    sim_uart[i].rx_mask = SIM_RX_STS_DEFAULT_MASK;
+  }
+}
+
+
+//================================================================
+/*! advance one bit time, and run requested ISRs.
+*/
+void sim_step(void)
+{
+  sigset_t old;
+  sim_lock(&old);
+
+  sim_time++;
+  for( int i = 0; i < SIM_NUM_UART; i++ ) {
+    SIM_UART *u = &sim_uart[i];
+
+    if( u->tx_shift > 0 && --u->tx_shift == 0 ) {
+      u->tx_count++;
+      u->tx_sticky |= SIM_TX_STS_COMPLETE;
+      if( u->sink ) u->sink(u->sink_arg, u->tx_byte);
+      sim_tx_update(u);
+    }
+    if( u->tx_shift == 0 && u->tx_n > 0 ) {
+      u->tx_byte = u->tx_fifo[0];
+      u->tx_n--;
+      memmove(u->tx_fifo, u->tx_fifo + 1, u->tx_n);
+      u->tx_shift = SIM_CHAR_TIME;
+      sim_tx_update(u);
+    }
+    if( u->idle_period && (sim_time % u->idle_period) == 0 ) sim_idle_pending[i] = 1;
+  }
+  for( int c = 0; c < SIM_NUM_DMA_CH; c++ ) {
+    if( sim_ch[c].enabled ) sim_dma_service(c);
+  }
+
+  sim_unlock(&old);
+
+  for( int i = 0; i < sim_n_hook; i++ ) sim_hook[i]();
+  sim_dispatch();
+}
+
+
+//================================================================
+/*! advance bit times.
+*/
+void sim_run(uint32_t bits)
+{
+  while( bits-- > 0 ) sim_step();
+}
+
+
+//================================================================
+/*! advance until the condition becomes true.
+
+  @return int   0 or -1 if max_bits passed.
+*/
+int sim_run_until(int (*cond)(void *), void *arg, uint32_t max_bits)
+{
+  while( !cond(arg) ) {
+    if( max_bits-- == 0 ) return -1;
+    sim_step();
+  }
+  return 0;
+}
+
+
+//================================================================
+/*! add a function called every step. (peer devices, timers)
+*/
+void sim_add_hook(void (*hook)(void))
+{
+  sim_hook[sim_n_hook++] = hook;
+}
+
+
+//================================================================
+/*! run requested ISRs, unless in an ISR or a critical section.
+*/
+void sim_dispatch(void)
+{
+  sigset_t old;
+
+  sim_lock(&old);
+  if( sim_in_isr || sim_cs_depth ) {
+    sim_unlock(&old);
+    return;
+  }
+  sim_in_isr = 1;
+  sim_unlock(&old);
+
+  while( 1 ) {
+    SIM_ISR isr = 0;
+
+    sim_lock(&old);
+    for( int i = 0; i < SIM_NUM_UART && !isr; i++ ) {
+      SIM_UART *u = &sim_uart[i];
+      if( u->rx_pending && u->rx_isr ) {
+        u->rx_pending = 0;
+        isr = u->rx_isr;
+      } else if( u->tx_pending && u->tx_isr && u->tx_isr_enabled ) {
+        u->tx_pending = 0;
+        isr = u->tx_isr;
+      } else if( u->dma_pending && u->dma_isr ) {
+        u->dma_pending = 0;
+        isr = u->dma_isr;
+      } else if( sim_idle_pending[i] && u->idle_isr ) {
+        sim_idle_pending[i] = 0;
+        isr = u->idle_isr;
+      }
+    }
+    // a request made after here is dispatched by the requester.
+    if( !isr ) sim_in_isr = 0;
+    sim_unlock(&old);
+
+    if( !isr ) break;
+    isr();
+  }
+}
+
+
+//================================================================
+/*! use signals as interrupts. Critical sections block them.
+
+  @param  enable        SIGALRM, SIGVTALRM, SIGPROF, SIGUSR1 and SIGUSR2 handlers are ISRs.
+*/
+void sim_use_signals(int enable)
+{
+  sigemptyset(&sim_sigset);
+  sigaddset(&sim_sigset, SIGALRM);
+  sigaddset(&sim_sigset, SIGVTALRM);
+  sigaddset(&sim_sigset, SIGPROF);
+  sigaddset(&sim_sigset, SIGUSR1);
+  sigaddset(&sim_sigset, SIGUSR2);
+  sim_signals = enable;
+}
+
+
+//================================================================
+/*! a byte arrives at the receiver.
+
+  @param  n             index of sim_uart.
+  @param  ch            data.
+  @param  flags         SIM_RX_STS_MRKSPC and error bits of the byte.
+*/
+void sim_uart_rx(int n, uint8_t ch, uint8_t flags)
+{
+  SIM_UART *u = &sim_uart[n];
+  sigset_t old;
+
+  sim_lock(&old);
+  u->rx_sticky |= flags & ~SIM_RX_STS_MRKSPC;
+  if( u->rx_n == SIM_FIFO_SIZE ) {
+    u->rx_sticky |= SIM_RX_STS_OVERRUN;
+    u->rx_overrun++;
+  } else {
+    u->rx_flags[u->rx_n] = flags;
+    u->rx_fifo[u->rx_n++] = ch;
+  }
+  sim_rx_update(u);
+  sim_unlock(&old);
+}
+
+
+//================================================================
+/*! connect TX of a UART to RX of the other. (or itself)
+*/
+static void sim_uart_wire(void *arg, uint8_t ch)
+{
+  sim_uart_rx((int)(intptr_t)arg, ch, 0);
+}
+
+void sim_uart_connect(int from, int to)
+{
+  sim_uart[from].sink = sim_uart_wire;
+  sim_uart[from].sink_arg = (void *)(intptr_t)to;
+}
+
+
+//================================================================
+/*! check the transmitter is idle. (FIFO empty and the last stop bit sent)
+*/
+int sim_uart_tx_idle(int n)
+{
+  return sim_uart[n].tx_n == 0 && sim_uart[n].tx_shift == 0;
+}
+
+
+//================================================================
+/*! UART component API.
+*/
+void sim_uart_start(int n)
+{
+  sim_tx_update(&sim_uart[n]);
+  sim_rx_update(&sim_uart[n]);
+}
+
+void sim_uart_stop(int n)
+{
+}
+
+void sim_uart_clear_tx(int n)
+{
+  sim_uart[n].tx_n = 0;
+  sim_tx_update(&sim_uart[n]);
+}
+
+void sim_uart_clear_rx(int n)
+{
+  sim_uart[n].rx_n = 0;
+  sim_rx_update(&sim_uart[n]);
+}
+
+uint8_t sim_uart_read_tx_status(int n)
+{
+  SIM_UART *u = &sim_uart[n];
+  sigset_t old;
+
+  sim_lock(&old);
+  uint8_t sts = u->tx_sticky | ((u->tx_n == 0) ? SIM_TX_STS_FIFO_EMPTY : 0);
+  sts |= (u->tx_n == SIM_FIFO_SIZE) ? SIM_TX_STS_FIFO_FULL : SIM_TX_STS_FIFO_NOT_FULL;
+  u->tx_sticky = 0;
+  sim_tx_update(u);
+  sim_unlock(&old);
+
+  return sts;
+}
+
+uint8_t sim_uart_read_rx_status(int n)
+{
+  SIM_UART *u = &sim_uart[n];
+  sigset_t old;
+
+  sim_lock(&old);
+  uint8_t sts = sim_rx_status(u);
+  u->rx_sticky = 0;
+  sim_rx_update(u);
+  sim_unlock(&old);
+
+  return sts;
+}
+
+void sim_uart_write_tx_data(int n, uint8_t ch)
+{
+  sigset_t old;
+
+  sim_lock(&old);
+  sim_tx_push(&sim_uart[n], ch);
+  sim_unlock(&old);
+}
+
+uint8_t sim_uart_read_rx_data(int n)
+{
+  sigset_t old;
+
+  sim_lock(&old);
+  uint8_t ch = sim_rx_pop(&sim_uart[n]);
+  sim_unlock(&old);
+
+  return ch;
+}
+
+void sim_uart_set_tx_mask(int n, uint8_t mask)
+{
+  sigset_t old;
+
+  sim_lock(&old);
+  sim_uart[n].tx_mask = mask;
+  sim_tx_update(&sim_uart[n]);
+  sim_unlock(&old);
+}
+
+uint8_t sim_dma_init(int n, int is_tx)
+{
+  for( int c = 0; c < SIM_NUM_DMA_CH; c++ ) {
+    if( sim_ch[c].used ) continue;
+    sim_ch[c] = (SIM_DMA_CH){ .used = 1, .uart = n, .is_tx = is_tx };
+    return c;
+  }
+  return 0xff;
+}
+
+
+//================================================================
+/*! PSoC API.
+*/
+uint8 CyEnterCriticalSection(void)
+{
+  // block first, so that the saved mask is never overwritten by a signal.
+  sigset_t old;
+  if( sim_signals ) sigprocmask(SIG_BLOCK, &sim_sigset, &old);
+  if( sim_cs_depth++ == 0 && sim_signals ) sim_cs_saved = old;
+  return 0;
+}
+
+void CyExitCriticalSection(uint8 savedIntrStatus)
+{
+  if( --sim_cs_depth != 0 ) return;
+
+  // restore, not unblock. A signal handler never preempts itself.
+  if( sim_signals ) sigprocmask(SIG_SETMASK, &sim_cs_saved, 0);
+  sim_dispatch();
+}
+
+void CyPmAltAct(uint16 wakeupTime, uint16 wakeupSource)
+{
+  sim_step();
+}
+
+//! stops at the debugger on the target. counted, and continues.
+void CyHalt(uint8 reason)
+{
+  sim_n_halt++;
+}
+
+uint8 CyDmaTdAllocate(void)
+{
+  return (sim_n_td < SIM_NUM_TD) ? sim_n_td++ : CY_DMA_DISABLE_TD;
+}
+
+cystatus CyDmaTdSetConfiguration(uint8 tdHandle, uint16 transferCount, uint8 nextTd, uint8 configuration)
+{
+  sim_td[tdHandle].count  = transferCount;
+  sim_td[tdHandle].next   = nextTd;
+  sim_td[tdHandle].config = configuration;
+  return 0;
+}
+
+cystatus CyDmaTdGetConfiguration(uint8 tdHandle, uint16 *transferCount, uint8 *nextTd, uint8 *configuration)
+{
+  sigset_t old;
+
+  sim_lock(&old);
+  *transferCount = sim_td[tdHandle].count;
+  *nextTd        = sim_td[tdHandle].next;
+  *configuration = sim_td[tdHandle].config;
+  sim_unlock(&old);
+  return 0;
+}
+
+cystatus CyDmaTdSetAddress(uint8 tdHandle, uint32 source, uint32 destination)
+{
+  sim_td[tdHandle].src = source;
+  sim_td[tdHandle].dst = destination;
+  return 0;
+}
+
+cystatus CyDmaChSetInitialTd(uint8 chHandle, uint8 startTd)
+{
+  sim_ch[chHandle].initial_td = startTd;
+  return 0;
+}
+
+cystatus CyDmaChEnable(uint8 chHandle, uint8 preserveTds)
+{
+  SIM_DMA_CH *ch = &sim_ch[chHandle];
+  sigset_t old;
+
+  sim_lock(&old);
+  ch->preserve = preserveTds;
+  if( preserveTds ) {
+    sim_td[chHandle] = sim_td[ch->initial_td];
+    ch->cur_td = chHandle;
+  } else {
+    ch->cur_td = ch->initial_td;
+  }
+  ch->enabled = 1;
+  if( ch->is_tx ) sim_uart[ch->uart].tx_drq = 0;    // not kept while disabled.
+  sim_dma_service(chHandle);
+  sim_unlock(&old);
+  return 0;
+}
+
+cystatus CyDmaChDisable(uint8 chHandle)
+{
+  sim_ch[chHandle].enabled = 0;
+  return 0;
+}
+
+
+//================================================================
+/*! component functions of UART_1 and UART_2.
+*/
+#define SIM_UART_DEFINE(NAME, N)                                        \
+  void  NAME ## _Start(void)           { sim_uart_start(N); }           \
+  void  NAME ## _Stop(void)            { sim_uart_stop(N); }            \
+  void  NAME ## _ClearTxBuffer(void)   { sim_uart_clear_tx(N); }        \
+  void  NAME ## _ClearRxBuffer(void)   { sim_uart_clear_rx(N); }        \
+  uint8 NAME ## _ReadTxStatus(void)    { return sim_uart_read_tx_status(N); } \
+  uint8 NAME ## _ReadRxStatus(void)    { return sim_uart_read_rx_status(N); } \
+  void  NAME ## _WriteTxData(uint8 ch) { sim_uart_write_tx_data(N, ch); } \
+  uint8 NAME ## _ReadRxData(void)      { return sim_uart_read_rx_data(N); } \
+  void  NAME ## _SetTxInterruptMode(uint8 intSrc) { sim_uart_set_tx_mask(N, intSrc); } \
+  void  isr_ ## NAME ## _Tx_StartEx(cyisraddress address) {             \
+    sim_uart[N].tx_isr = address;                                       \
+    sim_uart[N].tx_isr_enabled = 1;                                     \
+  }                                                                     \
+  void  isr_ ## NAME ## _Tx_Enable(void)  { sim_uart[N].tx_isr_enabled = 1; } \
+  void  isr_ ## NAME ## _Tx_Disable(void) { sim_uart[N].tx_isr_enabled = 0; } \
+  void  isr_ ## NAME ## _Rx_StartEx(cyisraddress address) { sim_uart[N].rx_isr = address; } \
+  void  isr_ ## NAME ## _RxIdle_StartEx(cyisraddress address) { sim_uart[N].idle_isr = address; } \
+  void  isr_ ## NAME ## _TxDma_StartEx(cyisraddress address) { sim_uart[N].dma_isr = address; } \
+  uint8 DMA_ ## NAME ## _Tx_DmaInitialize(uint8 burstCount, uint8 requestPerBurst, uint16 upperSrcAddress, uint16 upperDestAddress) \
+  { return sim_dma_init(N, 1); }                                        \
+  uint8 DMA_ ## NAME ## _Rx_DmaInitialize(uint8 burstCount, uint8 requestPerBurst, uint16 upperSrcAddress, uint16 upperDestAddress) \
+  { return sim_dma_init(N, 0); }
+
+SIM_UART_DEFINE(UART_1, 0)
+SIM_UART_DEFINE(UART_2, 1)
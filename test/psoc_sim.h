@@ -0,0 +1,136 @@
+/*! @file
+  @brief
+  Host model of PSoC5LP UART, ISR and DMA components. (for tests)
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  Time advances by sim_step() in bit times. A byte takes
+  SIM_CHAR_TIME bit times on the wire.
+
+  UART:
+   - 4 bytes TX FIFO and a shift register. The shift register loads
+     the next byte at the top of a step, and TX_STS_COMPLETE is set
+     after the stop bit of every byte.
+   - 4 bytes RX FIFO. A byte arriving at the full FIFO sets OVERRUN.
+   - TX_STS_COMPLETE and RX error bits are sticky, cleared on read.
+   - An interrupt line is the OR of the masked status bits, and the
+     ISR is requested on its rising edge. (as the status register
+     and "Derived" isr components)
+
+  ISRs run without nesting, when no critical section is entered.
+  (at the end of sim_step(), and at CyExitCriticalSection())
+*/
+
+#ifndef PSOC5_TEST_PSOC_SIM_H_
+#define PSOC5_TEST_PSOC_SIM_H_
+
+/***** System headers *******************************************************/
+#include <stdint.h>
+
+
+/***** Constant values ******************************************************/
+#define SIM_NUM_UART    2
+#define SIM_CHAR_TIME   10      //!< bit times of a character. (8N1)
+#define SIM_FIFO_SIZE   4       //!< hardware FIFO size of PSoC5LP UART.
+
+//! status bits. (same as UART component v2.50)
+#define SIM_TX_STS_COMPLETE       0x01
+#define SIM_TX_STS_FIFO_EMPTY     0x02
+#define SIM_TX_STS_FIFO_FULL      0x04
+#define SIM_TX_STS_FIFO_NOT_FULL  0x08
+
+#define SIM_RX_STS_MRKSPC         0x01
+#define SIM_RX_STS_BREAK          0x02
+#define SIM_RX_STS_PAR_ERROR      0x04
+#define SIM_RX_STS_STOP_ERROR     0x08
+#define SIM_RX_STS_OVERRUN        0x10
+#define SIM_RX_STS_FIFO_NOTEMPTY  0x20
+
+
+/***** Typedefs *************************************************************/
+typedef void (*SIM_ISR)(void);
+
+//================================================
+/*!@brief
+  UART component model
+*/
+typedef struct SIM_UART {
+  // transmitter
+  uint8_t  tx_fifo[SIM_FIFO_SIZE];
+  int      tx_n;                // num of bytes in tx_fifo.
+  int      tx_shift;            // bit times left of the byte shifting. (0: idle)
+  uint8_t  tx_byte;             // the byte shifting.
+  uint8_t  tx_sticky;           // sticky status bits.
+  uint8_t  tx_mask;             // interrupt mask.
+  uint8_t  tx_line;             // interrupt line.
+  volatile int tx_pending;      // ISR requested.
+  SIM_ISR  tx_isr;
+  int      tx_isr_enabled;
+  uint32_t tx_lost;             // num of bytes written to the full FIFO.
+  uint32_t tx_count;            // num of bytes sent out.
+
+  // receiver
+  uint8_t  rx_fifo[SIM_FIFO_SIZE];
+  uint8_t  rx_flags[SIM_FIFO_SIZE];
+  int      rx_n;
+  uint8_t  rx_sticky;
+  uint8_t  rx_mask;
+  uint8_t  rx_line;
+  volatile int rx_pending;
+  SIM_ISR  rx_isr;
+  uint32_t rx_overrun;          // num of bytes lost by overrun.
+
+  // periodic (idle) ISR and DMA completion ISR.
+  SIM_ISR  idle_isr;
+  int      idle_period;         // bit times. (0: disabled)
+  SIM_ISR  dma_isr;
+  volatile int dma_pending;
+  int      tx_drq;              // DMA request, by the rising edge of Tx interrupt.
+
+  // wire: called when a byte was sent out.
+  void   (*sink)(void *arg, uint8_t ch);
+  void    *sink_arg;
+
+  // data registers, as the address of DMA.
+  volatile uint8_t tx_data_reg;
+  volatile uint8_t rx_data_reg;
+} SIM_UART;
+
+
+/***** Global variables *****************************************************/
+extern SIM_UART sim_uart[SIM_NUM_UART];
+extern uint32_t sim_time;               //!< bit times from sim_reset().
+extern uint32_t sim_n_halt;             //!< num of CyHalt(), as CYASSERT failures.
+
+
+/***** Function prototypes **************************************************/
+void sim_reset(void);
+void sim_step(void);
+void sim_run(uint32_t bits);
+int sim_run_until(int (*cond)(void *), void *arg, uint32_t max_bits);
+void sim_add_hook(void (*hook)(void));
+void sim_dispatch(void);
+void sim_use_signals(int enable);
+
+void sim_uart_rx(int n, uint8_t ch, uint8_t flags);
+void sim_uart_connect(int from, int to);
+int sim_uart_tx_idle(int n);
+
+void sim_uart_start(int n);
+void sim_uart_stop(int n);
+void sim_uart_clear_tx(int n);
+void sim_uart_clear_rx(int n);
+uint8_t sim_uart_read_tx_status(int n);
+uint8_t sim_uart_read_rx_status(int n);
+void sim_uart_write_tx_data(int n, uint8_t ch);
+uint8_t sim_uart_read_rx_data(int n);
+void sim_uart_set_tx_mask(int n, uint8_t mask);
+uint8_t sim_dma_init(int n, int is_tx);
+
+
+#endif
@@ -0,0 +1,171 @@
+/*! @file
+  @brief
+  Host model of the peer device on the other end of a UART. (for tests)
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+/***** System headers *******************************************************/
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "project.h"
+#include "sim_peer.h"
+
+/***** Constant values ******************************************************/
+#define PEER_XON  0x11
+#define PEER_XOFF 0x13
+
+
+/***** Local variables ******************************************************/
+static SIM_PEER *sim_peer[SIM_NUM_UART];
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! a byte sent out by the UART arrives at the peer.
+*/
+static void sim_peer_sink(void *arg, uint8_t ch)
+{
+  SIM_PEER *p = arg;
+
+  if( p->on_receive ) {
+    p->on_receive(p, ch);
+    return;
+  }
+  if( ch == PEER_XOFF ) {
+    p->n_xoff++;
+    p->xoff = 1;
+    p->xoff_at = p->sent;
+    return;
+  }
+  if( ch == PEER_XON ) {
+    p->n_xon++;
+    p->xoff = 0;
+    return;
+  }
+
+  if( ch != sim_peer_data(p->received) ) p->rx_error++;
+  p->received++;
+}
+
+
+//================================================================
+/*! send a byte to the UART at every character time.
+*/
+static void sim_peer_step(SIM_PEER *p)
+{
+  if( sim_time % SIM_CHAR_TIME != 0 ) return;
+
+  if( p->ctrl ) {
+    sim_uart_rx(p->uart, p->ctrl, 0);
+    p->ctrl = 0;
+    return;
+  }
+  if( p->script_rd != p->script_wr ) {
+    sim_uart_rx(p->uart, p->script[p->script_rd], 0);
+    p->script_rd = (p->script_rd + 1) % SIM_PEER_SIZE_SCRIPT;
+    return;
+  }
+  if( p->to_send == 0 ) return;
+
+  if( sim_peer_is_stopped(p) ) {
+    if( p->lag_left == 0 ) return;
+    p->lag_left--;
+  } else {
+    p->lag_left = p->lag;
+  }
+
+  sim_uart_rx(p->uart, sim_peer_data(p->sent++), 0);
+  p->to_send--;
+}
+
+static void sim_peer_hook0(void) { if( sim_peer[0] ) sim_peer_step(sim_peer[0]); }
+static void sim_peer_hook1(void) { if( sim_peer[1] ) sim_peer_step(sim_peer[1]); }
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! attach a peer to the UART. (call after sim_reset)
+*/
+void sim_peer_init(SIM_PEER *p, int uart)
+{
+  memset(p, 0, sizeof(*p));
+  p->uart = uart;
+  p->obey = 1;
+
+  sim_peer[uart] = p;
+  sim_uart[uart].sink = sim_peer_sink;
+  sim_uart[uart].sink_arg = p;
+  sim_add_hook((uart == 0) ? sim_peer_hook0 : sim_peer_hook1);
+}
+
+
+//================================================================
+/*! send XON/XOFF to the UART, ahead of the data.
+*/
+void sim_peer_send_ctrl(SIM_PEER *p, uint8_t ch)
+{
+  p->ctrl = ch;
+}
+
+
+//================================================================
+/*! queue bytes to send to the UART, ahead of the sequence.
+
+  @return int   num of bytes queued.
+*/
+int sim_peer_send(SIM_PEER *p, const void *data, int len)
+{
+  const uint8_t *d = data;
+  int i;
+
+  for( i = 0; i < len; i++ ) {
+    int wr = (p->script_wr + 1) % SIM_PEER_SIZE_SCRIPT;
+    if( wr == p->script_rd ) break;
+    p->script[p->script_wr] = d[i];
+    p->script_wr = wr;
+  }
+  return i;
+}
+
+
+//================================================================
+/*! check the peer is requested to stop. (XOFF or RTS)
+*/
+int sim_peer_is_stopped(const SIM_PEER *p)
+{
+  return p->obey && (p->xoff || (p->rts && *p->rts));
+}
+
+
+//================================================================
+/*! the i-th data byte of the sequence. (printable, never XON/XOFF)
+*/
+uint8_t sim_peer_data(uint32_t i)
+{
+  return 0x20 + i % 95;
+}
+
+
+//================================================================
+/*! check the data is the sequence from the i-th byte.
+
+  @return int   num of bytes out of the sequence.
+*/
+int sim_peer_check(const uint8_t *buf, int size, uint32_t i)
+{
+  int err = 0;
+
+  for( int j = 0; j < size; j++ ) {
+    if( buf[j] != sim_peer_data(i + j) ) err++;
+  }
+  return err;
+}
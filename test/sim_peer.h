@@ -0,0 +1,84 @@
+/*! @file
+  @brief
+  Host model of the peer device on the other end of a UART. (for tests)
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The peer sends a sequence of printable characters to the UART at
+  full rate, and checks the sequence it receives from the UART.
+  Flow control toward the peer:
+   - XOFF/XON received from the UART, or the RTS level (active low).
+   - The peer sends `lag` more bytes after it was requested to stop,
+     as a real device does with its FIFO. If `obey` is 0, the peer
+     ignores the request.
+  Flow control toward the UART:
+   - sim_peer_send_ctrl() sends XON/XOFF ahead of the data.
+   - `cts` is the level for the CTS pin of the UART. (active low)
+  Scripted peer:
+   - sim_peer_send() queues bytes, sent ahead of the sequence.
+   - If `on_receive` is set, it gets the bytes from the UART instead
+     of the sequence check. (e.g. a modem answering commands)
+*/
+
+#ifndef PSOC5_TEST_SIM_PEER_H_
+#define PSOC5_TEST_SIM_PEER_H_
+
+/***** System headers *******************************************************/
+#include <stdint.h>
+
+
+/***** Constant values ******************************************************/
+#define SIM_PEER_SIZE_SCRIPT  1024      //!< size of the queue of sim_peer_send().
+
+
+/***** Typedefs *************************************************************/
+
+//================================================
+/*!@brief
+  Peer device model
+*/
+typedef struct SIM_PEER {
+  int      uart;                //!< index of sim_uart.
+
+  // sender
+  uint32_t to_send;             //!< num of data bytes left to send.
+  uint32_t sent;                //!< num of data bytes sent.
+  int      obey;                //!< stop by XOFF or RTS. (bool)
+  int      lag;                 //!< bytes sent after the stop request.
+  int      lag_left;
+  int      xoff;                //!< XOFF received.
+  uint8_t  ctrl;                //!< XON/XOFF to send next.
+  const volatile uint8_t *rts;  //!< RTS level of the UART, or NULL.
+
+  // receiver
+  uint32_t received;            //!< num of data bytes received.
+  uint32_t rx_error;            //!< num of bytes out of the sequence.
+  uint32_t n_xoff;              //!< num of XOFF received.
+  uint32_t n_xon;               //!< num of XON received.
+  uint32_t xoff_at;             //!< sent at the last XOFF received.
+
+  volatile uint8_t cts;         //!< level for CTS pin of the UART.
+
+  // script
+  uint8_t  script[SIM_PEER_SIZE_SCRIPT];
+  int      script_rd;
+  int      script_wr;
+  void   (*on_receive)(struct SIM_PEER *p, uint8_t ch);
+} SIM_PEER;
+
+
+/***** Function prototypes **************************************************/
+void sim_peer_init(SIM_PEER *p, int uart);
+void sim_peer_send_ctrl(SIM_PEER *p, uint8_t ch);
+int sim_peer_send(SIM_PEER *p, const void *data, int len);
+int sim_peer_is_stopped(const SIM_PEER *p);
+uint8_t sim_peer_data(uint32_t i);
+int sim_peer_check(const uint8_t *buf, int size, uint32_t i);
+
+
+#endif
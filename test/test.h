@@ -0,0 +1,75 @@
+/*! @file
+  @brief
+  Minimal check and benchmark helpers for host tests.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+#ifndef PSOC5_TEST_TEST_H_
+#define PSOC5_TEST_TEST_H_
+
+/***** System headers *******************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+
+/***** Macros ***************************************************************/
+extern int test_failed;
+
+//! check a condition, and continue.
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if( !(cond) ) {                                                     \
+      printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);   \
+      test_failed++;                                                    \
+    }                                                                   \
+  } while( 0 )
+
+//! check two integers are equal.
+#define CHECK_EQ(a, b)                                                  \
+  do {                                                                  \
+    long long a_ = (long long)(a), b_ = (long long)(b);                 \
+    if( a_ != b_ ) {                                                    \
+      printf("%s:%d: CHECK failed: %s == %s (%lld != %lld)\n",          \
+             __FILE__, __LINE__, #a, #b, a_, b_);                       \
+      test_failed++;                                                    \
+    }                                                                   \
+  } while( 0 )
+
+//! define test_failed, and return the result from main.
+#define TEST_MAIN_RESULT()                                              \
+  (printf("%s: %s\n", __FILE__, test_failed ? "FAILED" : "ok"), test_failed != 0)
+
+#define TEST_DEFINE_GLOBALS() int test_failed
+
+
+/***** Inline functions *****************************************************/
+
+//================================================================
+/*! cycle counter for benchmarks. (TSC, or ns if not x86)
+*/
+static inline uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+//! keep the compiler from removing the benchmark.
+#define BENCH_KEEP(p) __asm volatile ("" : : "g"(p) : "memory")
+
+
+#endif
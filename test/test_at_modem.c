@@ -0,0 +1,323 @@
+/*! @file
+  @brief
+  Host test of the AT command engine, with a modem on the peer.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The peer of UART_1 answers each command line by the script, as a
+  modem does, and sends URCs at any time. The results passed to the
+  callbacks and URC handlers are logged as text, and compared with the
+  expected log. uart_tick() is called every TICK_BITS bit times, as
+  1ms at 115200bps.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "at_modem.h"
+#include "sim_peer.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define TICK_BITS       115     //!< bit times of 1ms at 115200bps.
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static uint8_t rxbuf[64];               // shorter than a long line, to wrap.
+static uint8_t txbuf[64];
+
+UART_ISR( &uh, UART_1 );
+
+static SIM_PEER peer;
+static AT_MODEM am;
+
+//! the answers of the modem.
+static const struct {
+  const char *cmd;
+  const char *answer;                   // NULL: no answer.
+} script[] = {
+  { "ATE0",     "\r\nOK\r\n" },
+  { "AT+CSQ",   "\r\n+CSQ: 20,99\r\n\r\nOK\r\n" },
+  { "AT+CGMI",  "\r\nOKAY Inc.\r\n\r\nOK\r\n" },
+  { "AT+CREG?", "\r\n+CREG: 0,1\r\n\r\nOK\r\n" },
+  { "AT+CLCC",  "\r\n+CLCC: 1,0,4\r\n\r\nRING\r\n\r\nOK\r\n" },
+  { "AT+ERR",   "\r\nERROR\r\n" },
+  { "AT+CPIN?", "\r\n+CME ERROR: 10\r\n" },
+  { "AT+CMGR",  "\r\n+CMS ERROR: 321\r\n" },
+  { "AT+NONE",  0 },
+};
+
+static char cmd[32];                    // command line received by the modem.
+static int  cmd_len;
+static int  echo;                       // the modem echoes commands.
+
+static char log_buf[1024];              // results and URCs.
+static int  log_len;
+static uint32_t tick_at_timeout;
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! the modem receives a byte of the command line.
+*/
+static void modem_receive(SIM_PEER *p, uint8_t ch)
+{
+  if( ch != '\r' ) {
+    if( cmd_len < sizeof(cmd) - 1 ) cmd[cmd_len++] = ch;
+    return;
+  }
+  cmd[cmd_len] = '\0';
+
+  if( echo ) {
+    sim_peer_send(p, cmd, cmd_len);
+    sim_peer_send(p, "\r", 1);
+  }
+  if( strcmp(cmd, "ATE0") == 0 ) echo = 0;
+
+  for( int i = 0; i < sizeof(script) / sizeof(script[0]); i++ ) {
+    if( strcmp(cmd, script[i].cmd) != 0 ) continue;
+    if( script[i].answer ) sim_peer_send(p, script[i].answer, strlen(script[i].answer));
+    break;
+  }
+  cmd_len = 0;
+}
+
+//! the modem sends a line. (URC)
+static void modem_send(const char *s)
+{
+  sim_peer_send(&peer, s, strlen(s));
+}
+
+//! SysTick.
+static void tick(void)
+{
+  if( sim_time % TICK_BITS == 0 ) uart_tick();
+}
+
+
+//================================================================
+/*! log the results.
+*/
+static void log_add(const char *s1, int result, const char *line)
+{
+  int n = snprintf(log_buf + log_len, sizeof(log_buf) - log_len, "%s %d %s\n", s1, result, line);
+  if( n > 0 && log_len + n < sizeof(log_buf) ) log_len += n;
+}
+
+static void on_result(AT_MODEM *am, int result, const char *line, int len, void *arg)
+{
+  CHECK_EQ(strlen(line), len);
+  log_add(arg, result, line);
+  if( result == AT_RESULT_TIMEOUT ) tick_at_timeout = uart_tick_count;
+}
+
+//! queue the next command from the callback.
+static void on_result_next(AT_MODEM *am, int result, const char *line, int len, void *arg)
+{
+  on_result(am, result, line, len, arg);
+  if( result != AT_RESULT_LINE ) CHECK_EQ(at_send(am, "AT+CMGR", 1000, on_result, "AT+CMGR"), 0);
+}
+
+static void on_urc(AT_MODEM *am, const char *line, int len)
+{
+  CHECK_EQ(strlen(line), len);
+  log_add("URC", 0, line);
+}
+
+static const AT_URC urc[] = {
+  { "+CMTI:", on_urc },
+  { "RING",   on_urc },
+  { "+CREG:", on_urc },
+};
+
+
+//================================================================
+/*! setup UART_1 and the modem.
+*/
+static void setup(void)
+{
+  sim_reset();
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  sim_peer_init(&peer, 0);
+  peer.on_receive = modem_receive;
+  sim_add_hook(tick);
+  uart_tick_count = 0;
+
+  at_init(&am, &uh);
+  at_set_urc(&am, urc, sizeof(urc) / sizeof(urc[0]));
+
+  cmd_len = 0;
+  echo = 1;
+  log_len = 0;
+  log_buf[0] = '\0';
+}
+
+//! poll at every character time, until all commands are finished.
+static int run_until_idle(uint32_t max_ms)
+{
+  uint32_t deadline = uart_tick_count + max_ms;
+
+  while( (int32_t)(uart_tick_count - deadline) < 0 ) {
+    sim_run(SIM_CHAR_TIME);
+    at_poll(&am);
+    if( at_is_idle(&am) && peer.script_rd == peer.script_wr &&
+        uart_bytes_available(&uh) == 0 ) return 0;
+  }
+  return -1;
+}
+
+static void check_log(const char *expected)
+{
+  if( strcmp(log_buf, expected) != 0 ) {
+    printf("  log:\n%s  expected:\n%s", log_buf, expected);
+  }
+  CHECK(strcmp(log_buf, expected) == 0);
+  log_len = 0;
+  log_buf[0] = '\0';
+}
+
+
+//================================================================
+/*! commands in the queue, and the final results.
+*/
+static void test_commands(void)
+{
+  setup();
+  CHECK_EQ(at_send(&am, "ATE0", 1000, on_result_next, "ATE0"), 0);
+  CHECK_EQ(at_send(&am, "AT+CSQ", 1000, on_result, "AT+CSQ"), 0);
+  CHECK_EQ(at_send(&am, "AT+CGMI", 1000, on_result, "AT+CGMI"), 0);
+  CHECK_EQ(at_send(&am, "AT+ERR", 1000, on_result, "AT+ERR"), 0);
+  CHECK_EQ(at_send(&am, "AT+CPIN?", 1000, on_result, "AT+CPIN?"), -1);
+  CHECK_EQ(at_is_idle(&am), 0);
+
+  CHECK_EQ(run_until_idle(100), 0);
+  check_log("ATE0 1 OK\n"               // the echo is discarded.
+            "AT+CSQ 0 +CSQ: 20,99\n"
+            "AT+CSQ 1 OK\n"
+            "AT+CGMI 0 OKAY Inc.\n"     // "OK" matches the whole line only.
+            "AT+CGMI 1 OK\n"
+            "AT+ERR 2 ERROR\n"
+            "AT+CMGR 2 +CMS ERROR: 321\n");
+
+  CHECK_EQ(at_send(&am, "AT+CPIN?", 1000, on_result, "AT+CPIN?"), 0);
+  CHECK_EQ(run_until_idle(100), 0);
+  check_log("AT+CPIN? 2 +CME ERROR: 10\n");
+
+  CHECK_EQ(am.n_timeout, 0);
+  CHECK_EQ(am.n_urc_received, 0);
+  CHECK_EQ(am.n_unknown, 0);
+  CHECK_EQ(peer.rx_error, 0);
+}
+
+
+//================================================================
+/*! URCs while idle, and in the response of a command.
+*/
+static void test_urc(void)
+{
+  setup();
+  modem_send("\r\nRING\r\n\r\n+CMTI: \"SM\",3\r\n");
+  CHECK_EQ(run_until_idle(100), 0);
+  check_log("URC 0 RING\n"
+            "URC 0 +CMTI: \"SM\",3\n");
+
+  // "+CREG:" of the command goes to the URC handler too.
+  CHECK_EQ(at_send(&am, "AT+CREG?", 1000, on_result, "AT+CREG?"), 0);
+  CHECK_EQ(at_send(&am, "AT+CLCC", 1000, on_result, "AT+CLCC"), 0);
+  CHECK_EQ(run_until_idle(100), 0);
+  check_log("URC 0 +CREG: 0,1\n"
+            "AT+CREG? 1 OK\n"
+            "AT+CLCC 0 +CLCC: 1,0,4\n"
+            "URC 0 RING\n"
+            "AT+CLCC 1 OK\n");
+
+  // lines without a command.
+  modem_send("\r\nOK\r\n\r\nNO CARRIER\r\n");
+  CHECK_EQ(run_until_idle(100), 0);
+  check_log("");
+  CHECK_EQ(am.n_urc_received, 4);
+  CHECK_EQ(am.n_unknown, 2);
+}
+
+
+//================================================================
+/*! no answer, and timeout.
+*/
+static void test_timeout(void)
+{
+  setup();
+  CHECK_EQ(at_send(&am, "AT+NONE", 50, on_result, "AT+NONE"), 0);
+  CHECK_EQ(at_send(&am, "AT+CSQ", 1000, on_result, "AT+CSQ"), 0);
+
+  uint32_t t0 = uart_tick_count;
+  CHECK_EQ(run_until_idle(1000), 0);
+  check_log("AT+NONE 3 \n"
+            "AT+CSQ 0 +CSQ: 20,99\n"
+            "AT+CSQ 1 OK\n");
+  CHECK_EQ(am.n_timeout, 1);
+
+  // in time, and the next command is sent after that.
+  CHECK(tick_at_timeout - t0 >= 50);
+  CHECK(tick_at_timeout - t0 <= 51);
+
+  // forever, finished by a late answer.
+  CHECK_EQ(at_send(&am, "AT+NONE", UART_TIMEOUT_FOREVER, on_result, "AT+NONE"), 0);
+  CHECK_EQ(run_until_idle(2000), -1);
+  check_log("");
+  modem_send("\r\nOK\r\n");
+  CHECK_EQ(run_until_idle(100), 0);
+  check_log("AT+NONE 1 OK\n");
+  CHECK_EQ(am.n_timeout, 1);
+}
+
+
+//================================================================
+/*! a line longer than the line buffer is truncated.
+*/
+static void test_long_line(void)
+{
+  char line[AT_SIZE_LINE * 2];
+  char expected[AT_SIZE_LINE + 32];
+
+  setup();
+  memset(line, 'x', sizeof(line));
+  memcpy(line, "+CMTI:", 6);
+  line[sizeof(line) - 1] = '\0';
+
+  modem_send("\r\n");
+  modem_send(line);
+  modem_send("\r\n");
+  CHECK_EQ(run_until_idle(100), 0);
+
+  snprintf(expected, sizeof(expected), "URC 0 %.*s\n", AT_SIZE_LINE - 1, line);
+  check_log(expected);
+  CHECK_EQ(am.n_urc_received, 1);
+  CHECK_EQ(uh.stat.rx_overflow, 0);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_commands();
+  test_urc();
+  test_timeout();
+  test_long_line();
+
+  return TEST_MAIN_RESULT();
+}
@@ -0,0 +1,368 @@
+/*! @file
+  @brief
+  Host test of Modbus RTU slave with a simulated master.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The master sends a request byte by byte on UART_1, and collects
+  the response sent out by the slave. Time for the frame gap is
+  sim_time in bit times.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "modbus_rtu.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define SLAVE_ADDRESS   17
+#define FRAME_GAP       (SIM_CHAR_TIME * 35 / 10)
+#define N_HOLDING       130
+#define N_INPUT         8
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static UART_FRAMEQ uh_frame;
+static UART_FRAME uh_fq[4];
+static MODBUS_SLAVE ms;
+static uint16_t holding[N_HOLDING];
+static uint16_t input[N_INPUT];
+
+static uint8_t resp[300];       // response received by the master.
+static int resp_len;
+static uint16_t write_addr, write_num;
+static int n_write;
+
+UART_ISR( &uh, UART_1 );
+
+
+/***** Local functions ******************************************************/
+
+static uint16_t get_time(void)
+{
+  return sim_time;
+}
+
+static void master_sink(void *arg, uint8_t ch)
+{
+  if( resp_len < sizeof(resp) ) resp[resp_len++] = ch;
+}
+
+static void on_write(MODBUS_SLAVE *ms, uint16_t addr, uint16_t num)
+{
+  write_addr = addr;
+  write_num = num;
+  n_write++;
+}
+
+static void setup(void)
+{
+  static char rxbuf[256], txbuf[256];
+
+  sim_reset();
+  sim_uart[0].sink = master_sink;
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  uart_init_frame(&uh, &uh_frame, uh_fq, 4);
+  uart_set_frame_gap(&uh, get_time, FRAME_GAP);
+
+  modbus_init(&ms, &uh, SLAVE_ADDRESS);
+  modbus_set_holding_registers(&ms, holding, N_HOLDING);
+  modbus_set_input_registers(&ms, input, N_INPUT);
+  ms.on_write = on_write;
+
+  for( int i = 0; i < N_HOLDING; i++ ) holding[i] = 0x1000 + i;
+  for( int i = 0; i < N_INPUT; i++ ) input[i] = 0x2000 + i;
+  n_write = 0;
+}
+
+
+//================================================================
+/*! the master sends bytes at full rate. (CRC is not added)
+*/
+static void master_send_raw(const uint8_t *req, int n)
+{
+  for( int i = 0; i < n; i++ ) {
+    sim_uart_rx(0, req[i], 0);
+    sim_run(SIM_CHAR_TIME);
+  }
+}
+
+
+//================================================================
+/*! the master sends a request with CRC, and waits for the response.
+
+  @return int   length of the response, 0 if no response.
+*/
+static int transact(const uint8_t *req, int n)
+{
+  uint8_t frame[260];
+  uint16_t crc = modbus_crc16(0xffff, req, n);
+
+  memcpy(frame, req, n);
+  frame[n] = crc;
+  frame[n + 1] = crc >> 8;
+
+  resp_len = 0;
+  master_send_raw(frame, n + 2);
+  sim_run(FRAME_GAP);
+  CHECK_EQ(modbus_poll(&ms), 1);
+  CHECK_EQ(modbus_poll(&ms), 0);
+
+  // wait for the last byte on the wire.
+  for( int i = 0; i < 300 && !(uart_is_write_finished(&uh) && sim_uart_tx_idle(0)); i++ ) {
+    sim_run(SIM_CHAR_TIME);
+  }
+  sim_run(SIM_CHAR_TIME);
+
+  // a response must have the correct CRC.
+  if( resp_len >= 2 ) {
+    CHECK_EQ(modbus_crc16(0xffff, resp, resp_len), 0);
+  }
+  return resp_len;
+}
+
+
+//================================================================
+/*! CRC table against the bitwise definition, and a known frame.
+*/
+static void test_crc(void)
+{
+  for( int i = 0; i < 256; i++ ) {
+    uint8_t b = i;
+    uint16_t crc = 0xffff ^ b;
+    for( int j = 0; j < 8; j++ ) crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    CHECK_EQ(modbus_crc16(0xffff, &b, 1), crc);
+  }
+
+  // 01 03 00 00 00 0a -> CRC c5 cd (lower byte first)
+  static const uint8_t frame[] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x0a, 0xc5, 0xcd };
+  CHECK_EQ(modbus_crc16(0xffff, frame, 6), 0xcdc5);
+  CHECK_EQ(modbus_crc16(0xffff, frame, 8), 0);
+}
+
+
+//================================================================
+/*! FC 3 and FC 4.
+*/
+static void test_read(void)
+{
+  setup();
+
+  static const uint8_t req3[] = { SLAVE_ADDRESS, 3, 0x00, 0x05, 0x00, 0x02 };
+  CHECK_EQ(transact(req3, sizeof(req3)), 9);
+  static const uint8_t exp3[] = { SLAVE_ADDRESS, 3, 4, 0x10, 0x05, 0x10, 0x06 };
+  CHECK(memcmp(resp, exp3, sizeof(exp3)) == 0);
+
+  static const uint8_t req4[] = { SLAVE_ADDRESS, 4, 0x00, 0x07, 0x00, 0x01 };
+  CHECK_EQ(transact(req4, sizeof(req4)), 7);
+  static const uint8_t exp4[] = { SLAVE_ADDRESS, 4, 2, 0x20, 0x07 };
+  CHECK(memcmp(resp, exp4, sizeof(exp4)) == 0);
+
+  // maximum 125 registers. (the response is longer than the chunk)
+  static const uint8_t req_max[] = { SLAVE_ADDRESS, 3, 0x00, 0x00, 0x00, 125 };
+  CHECK_EQ(transact(req_max, sizeof(req_max)), 3 + 250 + 2);
+  CHECK_EQ(resp[2], 250);
+  int err = 0;
+  for( int i = 0; i < 125; i++ ) {
+    if( ((resp[3 + i*2] << 8) | resp[4 + i*2]) != 0x1000 + i ) err++;
+  }
+  CHECK_EQ(err, 0);
+
+  CHECK_EQ(ms.n_request, 3);
+  CHECK_EQ(ms.n_exception, 0);
+  CHECK_EQ(n_write, 0);
+}
+
+
+//================================================================
+/*! FC 6 and FC 16.
+*/
+static void test_write(void)
+{
+  setup();
+
+  static const uint8_t req6[] = { SLAVE_ADDRESS, 6, 0x00, 0x03, 0xab, 0xcd };
+  CHECK_EQ(transact(req6, sizeof(req6)), 8);
+  CHECK(memcmp(resp, req6, sizeof(req6)) == 0);         // echo
+  CHECK_EQ(holding[3], 0xabcd);
+  CHECK_EQ(n_write, 1);
+  CHECK_EQ(write_addr, 3);
+  CHECK_EQ(write_num, 1);
+
+  static const uint8_t req16[] = { SLAVE_ADDRESS, 16, 0x00, 0x0a, 0x00, 0x03, 6,
+                                   0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+  CHECK_EQ(transact(req16, sizeof(req16)), 8);
+  static const uint8_t exp16[] = { SLAVE_ADDRESS, 16, 0x00, 0x0a, 0x00, 0x03 };
+  CHECK(memcmp(resp, exp16, sizeof(exp16)) == 0);
+  CHECK_EQ(holding[9], 0x1009);
+  CHECK_EQ(holding[10], 0x1122);
+  CHECK_EQ(holding[11], 0x3344);
+  CHECK_EQ(holding[12], 0x5566);
+  CHECK_EQ(holding[13], 0x100d);
+  CHECK_EQ(n_write, 2);
+  CHECK_EQ(write_addr, 10);
+  CHECK_EQ(write_num, 3);
+}
+
+
+//================================================================
+/*! exception responses.
+*/
+static void check_exception(const uint8_t *req, int n, uint8_t ex)
+{
+  CHECK_EQ(transact(req, n), 5);
+  CHECK_EQ(resp[0], SLAVE_ADDRESS);
+  CHECK_EQ(resp[1], req[1] | 0x80);
+  CHECK_EQ(resp[2], ex);
+}
+
+static void test_exception(void)
+{
+  setup();
+
+  static const uint8_t bad_fc[]    = { SLAVE_ADDRESS, 5, 0x00, 0x00, 0xff, 0x00 };
+  static const uint8_t bad_addr3[] = { SLAVE_ADDRESS, 3, 0x00, N_HOLDING - 1, 0x00, 0x02 };
+  static const uint8_t bad_addr4[] = { SLAVE_ADDRESS, 4, 0x00, N_INPUT, 0x00, 0x01 };
+  static const uint8_t bad_num0[]  = { SLAVE_ADDRESS, 3, 0x00, 0x00, 0x00, 0x00 };
+  static const uint8_t bad_num[]   = { SLAVE_ADDRESS, 3, 0x00, 0x00, 0x00, 126 };
+  static const uint8_t bad_addr6[] = { SLAVE_ADDRESS, 6, 0x00, N_HOLDING, 0x00, 0x01 };
+  static const uint8_t bad_len6[]  = { SLAVE_ADDRESS, 6, 0x00, 0x00, 0x00 };
+  static const uint8_t bad_count[] = { SLAVE_ADDRESS, 16, 0x00, 0x00, 0x00, 0x02, 3,
+                                       0x11, 0x22, 0x33, 0x44 };
+  static const uint8_t bad_addr16[] = { SLAVE_ADDRESS, 16, 0x00, N_HOLDING - 1, 0x00, 0x02, 4,
+                                        0x11, 0x22, 0x33, 0x44 };
+
+  check_exception(bad_fc, sizeof(bad_fc), MODBUS_ILLEGAL_FUNCTION);
+  check_exception(bad_addr3, sizeof(bad_addr3), MODBUS_ILLEGAL_DATA_ADDRESS);
+  check_exception(bad_addr4, sizeof(bad_addr4), MODBUS_ILLEGAL_DATA_ADDRESS);
+  check_exception(bad_num0, sizeof(bad_num0), MODBUS_ILLEGAL_DATA_VALUE);
+  check_exception(bad_num, sizeof(bad_num), MODBUS_ILLEGAL_DATA_VALUE);
+  check_exception(bad_addr6, sizeof(bad_addr6), MODBUS_ILLEGAL_DATA_ADDRESS);
+  check_exception(bad_len6, sizeof(bad_len6), MODBUS_ILLEGAL_DATA_VALUE);
+  check_exception(bad_count, sizeof(bad_count), MODBUS_ILLEGAL_DATA_VALUE);
+  check_exception(bad_addr16, sizeof(bad_addr16), MODBUS_ILLEGAL_DATA_ADDRESS);
+
+  CHECK_EQ(ms.n_exception, 9);
+  CHECK_EQ(ms.n_request, 9);
+  CHECK_EQ(n_write, 0);
+  CHECK_EQ(holding[N_HOLDING - 1], 0x1000 + N_HOLDING - 1);
+}
+
+
+//================================================================
+/*! CRC error, the other slave, and broadcast get no response.
+*/
+static void test_no_response(void)
+{
+  setup();
+
+  // CRC error: a bit flipped on the wire.
+  uint8_t req[8] = { SLAVE_ADDRESS, 6, 0x00, 0x01, 0x12, 0x34 };
+  uint16_t crc = modbus_crc16(0xffff, req, 6);
+  req[6] = crc;
+  req[7] = crc >> 8;
+  req[4] ^= 0x04;
+  resp_len = 0;
+  master_send_raw(req, sizeof(req));
+  sim_run(FRAME_GAP);
+  CHECK_EQ(modbus_poll(&ms), 1);
+  sim_run(SIM_CHAR_TIME * 20);
+  CHECK_EQ(resp_len, 0);
+  CHECK_EQ(ms.n_crc_error, 1);
+  CHECK_EQ(ms.n_request, 0);
+  CHECK_EQ(holding[1], 0x1001);
+
+  // addressed to the other slave.
+  static const uint8_t other[] = { SLAVE_ADDRESS + 1, 6, 0x00, 0x01, 0x12, 0x34 };
+  CHECK_EQ(transact(other, sizeof(other)), 0);
+  CHECK_EQ(ms.n_request, 0);
+  CHECK_EQ(holding[1], 0x1001);
+
+  // broadcast write is done, broadcast read is ignored.
+  static const uint8_t bc6[] = { 0, 6, 0x00, 0x01, 0x12, 0x34 };
+  CHECK_EQ(transact(bc6, sizeof(bc6)), 0);
+  CHECK_EQ(holding[1], 0x1234);
+  CHECK_EQ(n_write, 1);
+  static const uint8_t bc3[] = { 0, 3, 0x00, 0x00, 0x00, 0x01 };
+  CHECK_EQ(transact(bc3, sizeof(bc3)), 0);
+  static const uint8_t bc_bad[] = { 0, 5, 0x00, 0x00, 0x00, 0x01 };
+  CHECK_EQ(transact(bc_bad, sizeof(bc_bad)), 0);
+  CHECK_EQ(ms.n_request, 3);
+}
+
+
+//================================================================
+/*! frames are separated by the idle gap, not by a shorter pause.
+*/
+static void test_frame_gap(void)
+{
+  uint8_t req[8] = { SLAVE_ADDRESS, 3, 0x00, 0x00, 0x00, 0x01 };
+  uint16_t crc = modbus_crc16(0xffff, req, 6);
+  req[6] = crc;
+  req[7] = crc >> 8;
+
+  setup();
+
+  // a pause of 2 characters in the frame.
+  resp_len = 0;
+  master_send_raw(req, 4);
+  sim_run(SIM_CHAR_TIME * 2);
+  master_send_raw(req + 4, 4);
+  sim_run(FRAME_GAP);
+  CHECK_EQ(modbus_poll(&ms), 1);
+  CHECK_EQ(ms.n_request, 1);
+
+  // a pause of 4 characters splits the frame. both are dropped.
+  sim_run(SIM_CHAR_TIME * 20);
+  master_send_raw(req, 4);
+  sim_run(SIM_CHAR_TIME * 4);
+  master_send_raw(req + 4, 4);
+  sim_run(FRAME_GAP);
+  CHECK_EQ(modbus_poll(&ms), 1);
+  CHECK_EQ(modbus_poll(&ms), 1);
+  CHECK_EQ(modbus_poll(&ms), 0);
+  CHECK_EQ(ms.n_request, 1);
+  CHECK_EQ(ms.n_crc_error, 2);          // "11 03 00 00" and "00 01 crc".
+
+  // two requests queued before polling.
+  sim_run(SIM_CHAR_TIME * 20);
+  resp_len = 0;
+  master_send_raw(req, 8);
+  sim_run(FRAME_GAP + SIM_CHAR_TIME);
+  master_send_raw(req, 8);
+  sim_run(FRAME_GAP);
+  CHECK_EQ(modbus_poll(&ms), 1);
+  CHECK_EQ(modbus_poll(&ms), 1);
+  CHECK_EQ(modbus_poll(&ms), 0);
+  sim_run(SIM_CHAR_TIME * 20);
+  CHECK_EQ(ms.n_request, 3);
+  CHECK_EQ(resp_len, 2 * 7);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_crc();
+  test_read();
+  test_write();
+  test_exception();
+  test_no_response();
+  test_frame_gap();
+
+  return TEST_MAIN_RESULT();
+}
@@ -0,0 +1,339 @@
+/*! @file
+  @brief
+  Host test of the NMEA parser by replaying a log, and throughput benchmark.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The log is replayed by nmea_parse() split at every position, and
+  through UART_1 in loopback and nmea_poll(), so sentences cross the
+  end of rxfifo. The benchmark compares with the former way, a line
+  by uart_gets() and tokenizing it.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+#include <stdlib.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "nmea.h"
+#include "test.h"
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static uint8_t rxbuf[61];               // smaller than a sentence, to wrap.
+static uint8_t txbuf[256];
+
+UART_ISR( &uh, UART_1 );
+
+//! recorded log, and sentences at the limits of the fixed-point fields.
+static const char nmea_log[] =
+  "$GPGGA,123519.00,4807.03812,N,01131.00000,E,1,08,0.94,545.4,M,46.9,M,,*5E\r\n"
+  "$GPRMC,123519.00,A,4807.03812,N,01131.00000,E,022.4,084.4,230321,003.1,W,A*24\r\n"
+  "$GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00*74\r\n"
+  "$GNGGA,235959.999,3354.12345,S,15112.54321,W,2,12,1.2,-12.34,M,-25.6,M,1.0,0000*6B\r\n"
+  "$GNRMC,235959.999,A,3354.12345,S,15112.54321,W,0.05,359.99,311221,,,A*78\r\n"
+  "$GPGGA,000000.00,,,,,0,00,99.99,,,,,,*66\r\n"
+  "$GPRMC,000000.00,V,,,,,,,010100,,,N*7d\r\n"
+  "$GPGGA,235959.99999,8959.9999999,N,17959.9999999,E,1,99,99.999,,,,,*7F\r\n"
+  "$GPRMC,235959.99999,A,0000.00001,S,00000.00001,W,999.99,359.999999,311299,,,A*6E\r\n"
+  "$GPGGA,1,2,N,3,E,4,5,6,99999.99999,M,-9999999.9,M,,*77\r\n"
+  "$GPGGA,1,2,N,3,E,4,5,6,99999999999,M,-99999999999,M,,*77\r\n";
+
+#define N_LOG_SENTENCES 11
+
+//! expected result of each sentence.
+static const struct {
+  int      type;
+  NMEA_GGA gga;
+  NMEA_RMC rmc;
+} expected[N_LOG_SENTENCES] = {
+  { NMEA_TYPE_GGA, .gga = { 45319000, 481173020, 115166666, 1, 8, 94, 54540, 4690 } },
+  { NMEA_TYPE_RMC, .rmc = { 45319000, 481173020, 115166666, 2240, 8440, 2021, 3, 23, 1 } },
+  { NMEA_TYPE_OTHER },
+  { NMEA_TYPE_GGA, .gga = { 86399999, -339020575, -1512090535, 2, 12, 120, -1234, -2560 } },
+  { NMEA_TYPE_RMC, .rmc = { 86399999, -339020575, -1512090535, 5, 35999, 2021, 12, 31, 1 } },
+  // empty fields are zero, not the values of the sentence before.
+  { NMEA_TYPE_GGA, .gga = { 0, 0, 0, 0, 0, 9999, 0, 0 } },
+  { NMEA_TYPE_RMC, .rmc = { 0, 0, 0, 0, 0, 2000, 1, 1, 0 } },
+  // decimal places beyond 32bit are dropped, not wrapped.
+  { NMEA_TYPE_GGA, .gga = { 86399999, 899999998, 1799999998, 1, 99, 9999, 0, 0 } },
+  { NMEA_TYPE_RMC, .rmc = { 86399999, -1, -1, 65535, 35999, 2099, 12, 31, 1 } },
+  { NMEA_TYPE_GGA, .gga = { 1000, 333333, 500000, 4, 5, 600, 9999999, -999999990 } },
+  // too large values are saturated.
+  { NMEA_TYPE_GGA, .gga = { 1000, 333333, 500000, 4, 5, 600, INT32_MAX, -INT32_MAX } },
+};
+
+static int n_checked;
+static int n_mismatch;
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! callback at each verified sentence. compare with the expected.
+*/
+static void on_sentence(NMEA_PARSER *np, int type)
+{
+  int i = n_checked++ % N_LOG_SENTENCES;
+
+  if( type != expected[i].type ) {
+    n_mismatch++;
+  } else if( type == NMEA_TYPE_GGA ) {
+    if( memcmp(&np->gga, &expected[i].gga, sizeof(NMEA_GGA)) != 0 ) n_mismatch++;
+  } else if( type == NMEA_TYPE_RMC ) {
+    if( memcmp(&np->rmc, &expected[i].rmc, sizeof(NMEA_RMC)) != 0 ) n_mismatch++;
+  }
+  if( n_mismatch ) {
+    printf("  sentence %d: unexpected result\n", i);
+    n_mismatch = 0;
+    test_failed = 1;
+  }
+}
+
+static void setup(NMEA_PARSER *np, UART_HANDLE *uh)
+{
+  nmea_init(np, uh);
+  np->on_sentence = on_sentence;
+  n_checked = 0;
+}
+
+
+//================================================================
+/*! the log split at every position.
+*/
+static void test_split(void)
+{
+  static NMEA_PARSER np;
+  size_t len = sizeof(nmea_log) - 1;
+
+  for( size_t split = 0; split <= len; split++ ) {
+    setup(&np, 0);
+    nmea_parse(&np, nmea_log, split);
+    nmea_parse(&np, nmea_log + split, len - split);
+    CHECK_EQ(n_checked, N_LOG_SENTENCES);
+    CHECK_EQ(np.n_sentence, N_LOG_SENTENCES);
+    CHECK_EQ(np.n_cksum_error, 0);
+    CHECK_EQ(np.n_format_error, 0);
+  }
+}
+
+
+//================================================================
+/*! checksum errors and broken sentences are not published.
+*/
+static void test_errors(void)
+{
+  static NMEA_PARSER np;
+  static const char *gga1 =
+    "$GPGGA,123519.00,4807.03812,N,01131.00000,E,1,08,0.94,545.4,M,46.9,M,,*5E\r\n";
+
+  setup(&np, 0);
+  CHECK_EQ(nmea_parse(&np, gga1, strlen(gga1)), NMEA_TYPE_GGA);
+
+  // a bit error in a field, and in the checksum.
+  const char *bad[] = {
+    "$GPGGA,123519.00,4807.03812,N,01131.00000,E,1,08,0.94,545.5,M,46.9,M,,*5E\r\n",
+    "$GPGGA,000000.00,,,,,0,00,99.99,,,,,,*67\r\n",
+  };
+  for( int i = 0; i < 2; i++ ) {
+    CHECK_EQ(nmea_parse(&np, bad[i], strlen(bad[i])), 0);
+  }
+  CHECK_EQ(np.n_cksum_error, 2);
+  CHECK_EQ(np.gga.alt, 54540);
+
+  // no checksum, not a hex digit, cut by '$', and too long.
+  const char *broken[] = {
+    "$GPGGA,000000.00,,,,,0,00,99.99,,,,,,\r\n",
+    "$GPGGA,000000.00,,,,,0,00,99.99,,,,,,*6G\r\n",
+    "$GPGGA,000000.00,,,,,0,00",
+    "$GPGGA,000000.00,,,,,0,00,99.99,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,*66\r\n",
+  };
+  for( int i = 0; i < 4; i++ ) {
+    CHECK_EQ(nmea_parse(&np, broken[i], strlen(broken[i])), 0);
+  }
+  CHECK_EQ(np.n_format_error, 4);
+  CHECK_EQ(np.gga.alt, 54540);
+  CHECK_EQ(np.n_sentence, 1);
+
+  // resync at the next '$'.
+  n_checked = 0;
+  CHECK_EQ(nmea_parse(&np, gga1, strlen(gga1)), NMEA_TYPE_GGA);
+  CHECK_EQ(np.n_sentence, 2);
+}
+
+
+//================================================================
+/*! replay through UART_1 in loopback, and parse in rxfifo.
+*/
+static int log_received(void *arg)
+{
+  return uh.stat.rx_bytes >= *(uint32_t *)arg;
+}
+
+static void test_replay(void)
+{
+  enum { N_REPEAT = 20 };
+  static NMEA_PARSER np;
+  size_t len = sizeof(nmea_log) - 1;
+  uint32_t target = 0;
+  int types = 0;
+
+  sim_reset();
+  sim_uart_connect(0, 0);
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  setup(&np, &uh);
+
+  // poll at a half of rxfifo.
+  for( int i = 0; i < N_REPEAT; i++ ) {
+    for( size_t ofs = 0; ofs < len; ofs += 30 ) {
+      size_t n = (len - ofs < 30) ? len - ofs : 30;
+      CHECK_EQ(uart_write(&uh, nmea_log + ofs, n), n);
+      target += n;
+      sim_run_until(log_received, &target, SIM_CHAR_TIME * (n + 10));
+      types |= nmea_poll(&np);
+    }
+  }
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(st.rx_overflow, 0);
+  CHECK_EQ(n_checked, N_LOG_SENTENCES * N_REPEAT);
+  CHECK_EQ(np.n_cksum_error, 0);
+  CHECK_EQ(np.n_format_error, 0);
+  CHECK_EQ(types, NMEA_TYPE_GGA | NMEA_TYPE_RMC | NMEA_TYPE_OTHER);
+}
+
+
+//================================================================
+/*! the former way. a line is copied as uart_gets(), and tokenized.
+*/
+static int32_t line_degree(const char *f, const char *hemi)
+{
+  double v = atof(f);
+  int deg = (int)(v / 100);
+  int32_t d = (deg + (v - deg * 100) / 60) * 1e7;
+  return (*hemi == 'S' || *hemi == 'W') ? -d : d;
+}
+
+static uint32_t line_time(const char *f)
+{
+  double t = atof(f);
+  uint32_t hms = (uint32_t)t;
+  return (hms / 10000) * 3600000 + (hms / 100 % 100) * 60000 +
+         (uint32_t)((t - hms / 100 * 100) * 1000 + 0.5);
+}
+
+static int parse_line(const char *line, NMEA_GGA *gga, NMEA_RMC *rmc)
+{
+  char buf[NMEA_MAX_LENGTH + 3];
+  char *field[24];
+  int n = 0;
+
+  // uart_gets()
+  while( n < sizeof(buf) - 1 && line[n] != '\n' ) { buf[n] = line[n]; n++; }
+  buf[n] = 0;
+
+  char *star = strchr(buf, '*');
+  if( buf[0] != '$' || !star ) return 0;
+
+  uint8_t cksum = 0;
+  for( char *p = buf + 1; p < star; p++ ) cksum ^= *p;
+  if( cksum != strtoul(star + 1, 0, 16) ) return 0;
+  *star = 0;
+
+  char *p = buf + 1;
+  n = 0;
+  while( n < 24 ) {
+    field[n++] = p;
+    if( !(p = strchr(p, ',')) ) break;
+    *p++ = 0;
+  }
+
+  if( n >= 12 && strcmp(field[0] + 2, "GGA") == 0 ) {
+    gga->time  = line_time(field[1]);
+    gga->lat   = line_degree(field[2], field[3]);
+    gga->lon   = line_degree(field[4], field[5]);
+    gga->fix   = atoi(field[6]);
+    gga->sats  = atoi(field[7]);
+    gga->hdop  = atof(field[8]) * 100;
+    gga->alt   = atof(field[9]) * 100;
+    gga->geoid = atof(field[11]) * 100;
+    return NMEA_TYPE_GGA;
+  }
+  if( n >= 10 && strcmp(field[0] + 2, "RMC") == 0 ) {
+    rmc->time   = line_time(field[1]);
+    rmc->valid  = (field[2][0] == 'A');
+    rmc->lat    = line_degree(field[3], field[4]);
+    rmc->lon    = line_degree(field[5], field[6]);
+    rmc->speed  = atof(field[7]) * 100;
+    rmc->course = atof(field[8]) * 100;
+    int date    = atoi(field[9]);
+    rmc->day    = date / 10000;
+    rmc->month  = date / 100 % 100;
+    rmc->year   = date % 100 + 2000;
+    return NMEA_TYPE_RMC;
+  }
+  return NMEA_TYPE_OTHER;
+}
+
+
+//================================================================
+/*! cycles/byte of the log. (nmea_parse / line by line)
+*/
+static void bench_parse(void)
+{
+  enum { N_LOOP = 20000 };
+  static NMEA_PARSER np;
+  static NMEA_GGA gga;
+  static NMEA_RMC rmc;
+  size_t len = sizeof(nmea_log) - 1;
+  int n = 0;
+
+  nmea_init(&np, 0);
+  uint64_t t0 = bench_cycles();
+  for( int loop = 0; loop < N_LOOP; loop++ ) {
+    n += nmea_parse(&np, nmea_log, len);
+  }
+  uint64_t t_parse = bench_cycles() - t0;
+
+  t0 = bench_cycles();
+  for( int loop = 0; loop < N_LOOP; loop++ ) {
+    const char *p = nmea_log;
+    while( *p ) {
+      n += parse_line(p, &gga, &rmc);
+      p = strchr(p, '\n') + 1;
+    }
+  }
+  uint64_t t_line = bench_cycles() - t0;
+  BENCH_KEEP(n);
+  BENCH_KEEP(gga.alt);
+  BENCH_KEEP(rmc.speed);
+
+  printf("NMEA log %d bytes: nmea_parse %.2f, uart_gets + tokenize + atof %.2f cycles/byte\n",
+         (int)len, (double)t_parse / N_LOOP / len, (double)t_line / N_LOOP / len);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_split();
+  test_errors();
+  test_replay();
+
+  if( argc > 1 && strcmp(argv[1], "bench") == 0 ) bench_parse();
+
+  return TEST_MAIN_RESULT();
+}
@@ -0,0 +1,248 @@
+/*! @file
+  @brief
+  Host test of the address filter (multi-drop) of uart2.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  Frames to this node, to the broadcast address and to the other
+  nodes are received by UART_1, in mark parity mode (SIM_RX_STS_MRKSPC
+  with the address byte) and in prefix mode. Only the frames to this
+  node and the broadcast are stored, from the address byte, and the
+  other bytes are counted in stat.rx_filtered.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define MY_ADDRESS      0x05
+#define BROADCAST       0x00
+#define PREFIX          0xc0
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static UART_ADDR_FILTER af;
+static uint8_t rxbuf[256];
+static uint8_t txbuf[16];
+
+UART_ISR( &uh, UART_1 );
+
+static uint8_t expected[4096];          // bytes to be stored.
+static int n_expected;
+static uint32_t n_dropped;              // bytes to be filtered.
+
+
+/***** Local functions ******************************************************/
+
+static void setup(void)
+{
+  sim_reset();
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  n_expected = 0;
+  n_dropped = 0;
+}
+
+//! the Rx ISR receives a byte.
+static void rx_byte(uint8_t ch, uint8_t flags)
+{
+  sim_uart_rx(0, ch, flags);
+  sim_dispatch();
+}
+
+//! a frame in mark parity mode. the address byte has the mark.
+static void rx_frame_mark(uint8_t address, const uint8_t *data, int len)
+{
+  int match = (address == MY_ADDRESS || address == BROADCAST);
+
+  rx_byte(address, SIM_RX_STS_MRKSPC);
+  for( int i = 0; i < len; i++ ) rx_byte(data[i], 0);
+
+  if( match ) {
+    expected[n_expected++] = address;
+    memcpy(&expected[n_expected], data, len);
+    n_expected += len;
+  } else {
+    n_dropped += 1 + len;
+  }
+}
+
+//! a frame in prefix mode. the prefix is not stored.
+static void rx_frame_prefix(uint8_t address, const uint8_t *data, int len)
+{
+  int match = (address == MY_ADDRESS || address == BROADCAST);
+
+  rx_byte(PREFIX, 0);
+  rx_byte(address, 0);
+  for( int i = 0; i < len; i++ ) rx_byte(data[i], 0);
+
+  n_dropped++;
+  if( match ) {
+    expected[n_expected++] = address;
+    memcpy(&expected[n_expected], data, len);
+    n_expected += len;
+  } else {
+    n_dropped += 1 + len;
+  }
+}
+
+//! rxfifo has the expected bytes.
+static void check_received(void)
+{
+  uint8_t buf[sizeof(expected)];
+  int n = uart_read_nonblock(&uh, buf, sizeof(buf));
+
+  CHECK_EQ(n, n_expected);
+  CHECK(memcmp(buf, expected, n_expected) == 0);
+  CHECK_EQ(uh.stat.rx_filtered, n_dropped);
+  CHECK_EQ(uh.stat.rx_overflow, 0);
+  n_expected = 0;
+}
+
+
+//================================================================
+/*! mark parity mode. match, broadcast and mismatch.
+*/
+static void test_mark(void)
+{
+  // data bytes equal to the addresses, without the mark.
+  static const uint8_t data1[] = { 0x11, MY_ADDRESS, 0x22 };
+  static const uint8_t data2[] = { MY_ADDRESS, BROADCAST, 0x33, 0x44 };
+
+  setup();
+  uart_set_address_mark(&uh, &af, UART_1, MY_ADDRESS, BROADCAST);
+
+  // bytes before the first address are discarded.
+  rx_byte(0x99, 0);
+  n_dropped++;
+  check_received();
+
+  rx_frame_mark(MY_ADDRESS, data1, sizeof(data1));
+  check_received();
+  rx_frame_mark(0x07, data2, sizeof(data2));
+  check_received();
+  rx_frame_mark(BROADCAST, data1, sizeof(data1));
+  check_received();
+  rx_frame_mark(0x06, data1, sizeof(data1));
+  rx_frame_mark(MY_ADDRESS, data2, sizeof(data2));
+  rx_frame_mark(0x04, data1, 0);
+  rx_frame_mark(MY_ADDRESS, data1, 0);
+  check_received();
+
+  // cleared in the middle of a frame, the rest is discarded.
+  rx_frame_mark(MY_ADDRESS, data1, sizeof(data1));
+  uart_clear_rx_buffer(&uh);
+  n_expected = 0;
+  rx_byte(0x55, 0);
+  n_dropped++;
+  check_received();
+
+  // without the filter, all bytes are stored.
+  uart_clear_address_filter(&uh);
+  rx_byte(0x07, SIM_RX_STS_MRKSPC);
+  rx_byte(0x66, 0);
+  expected[n_expected++] = 0x07;
+  expected[n_expected++] = 0x66;
+  check_received();
+}
+
+
+//================================================================
+/*! prefix mode. match, broadcast and mismatch.
+*/
+static void test_prefix(void)
+{
+  static const uint8_t data1[] = { 0x11, MY_ADDRESS, 0x22 };
+  static const uint8_t data2[] = { MY_ADDRESS, BROADCAST, 0x33, 0x44 };
+
+  setup();
+  uart_set_address_prefix(&uh, &af, PREFIX, MY_ADDRESS, BROADCAST);
+
+  rx_byte(MY_ADDRESS, 0);
+  n_dropped++;
+  check_received();
+
+  rx_frame_prefix(MY_ADDRESS, data1, sizeof(data1));
+  check_received();
+  rx_frame_prefix(0x07, data2, sizeof(data2));
+  check_received();
+  rx_frame_prefix(BROADCAST, data2, sizeof(data2));
+  check_received();
+  rx_frame_prefix(0x06, data1, sizeof(data1));
+  rx_frame_prefix(MY_ADDRESS, data2, sizeof(data2));
+  rx_frame_prefix(0x04, data1, 0);
+  rx_frame_prefix(MY_ADDRESS, data1, 0);
+  check_received();
+
+  // a prefix alone closes the frame.
+  rx_frame_prefix(MY_ADDRESS, data1, sizeof(data1));
+  rx_byte(PREFIX, 0);
+  n_dropped++;
+  check_received();
+}
+
+
+//================================================================
+/*! random frames, in both modes.
+*/
+static void test_random(void)
+{
+  static const uint8_t addresses[] = { MY_ADDRESS, BROADCAST, 0x01, 0x06, 0x7f };
+  uint8_t data[20];
+  uint32_t seed = 1;
+
+  for( int mode = 0; mode < 2; mode++ ) {
+    setup();
+    if( mode == 0 ) {
+      uart_set_address_mark(&uh, &af, UART_1, MY_ADDRESS, BROADCAST);
+    } else {
+      uart_set_address_prefix(&uh, &af, PREFIX, MY_ADDRESS, BROADCAST);
+    }
+
+    for( int i = 0; i < 5000; i++ ) {
+      seed = seed * 1103515245 + 12345;
+      uint8_t address = addresses[(seed >> 16) % sizeof(addresses)];
+      int len = (seed >> 8) % sizeof(data);
+
+      for( int j = 0; j < len; j++ ) {
+        seed = seed * 1103515245 + 12345;
+        data[j] = seed >> 16;
+        if( data[j] == PREFIX ) data[j] = 0;    // not in data.
+      }
+      if( mode == 0 ) {
+        rx_frame_mark(address, data, len);
+      } else {
+        rx_frame_prefix(address, data, len);
+      }
+      if( n_expected > sizeof(rxbuf) / 2 ) check_received();
+    }
+    check_received();
+    CHECK(n_dropped > 5000);
+  }
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_mark();
+  test_prefix();
+  test_random();
+
+  return TEST_MAIN_RESULT();
+}
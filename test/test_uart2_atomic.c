@@ -0,0 +1,250 @@
+/*! @file
+  @brief
+  Host stress test of uart2 multi-writer transmit, with signals as ISRs.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  main writes by uart_write(), and two timer signals standing in for
+  ISRs write records by uart_write_atomic(). The signals preempt main
+  and each other at any instruction, as nested ISRs do. (critical
+  sections block them, see sim_use_signals)
+
+  Preemption inside reserve .. commit is rare by timing alone. So the
+  source buffer of main is read protected at times, and the SIGSEGV
+  handler runs the ISR in the middle of the copy to txfifo.
+
+  Each byte has the writer in the upper 2 bits and a sequence number
+  in the lower 6 bits. The Tx line must carry every queued byte once,
+  in order per writer, and every record of the ISRs in one piece.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define N_WRITERS       4       // main, SIGALRM, SIGUSR1, SIGSEGV
+#define MAX_RECORD      8
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static uint8_t txbuf[251];             // not a multiple of 64, stale data differs.
+
+UART_ISR( &uh, UART_1 );
+
+//! writer side.
+static uint32_t n_sent[N_WRITERS];      // bytes queued.
+static uint32_t n_records[N_WRITERS];   // records queued.
+static uint32_t n_dropped;              // records retried for txfifo full.
+static volatile int isr_depth;
+static uint32_t n_preempt_writer;       // ISR entered while a writer was busy.
+static uint32_t n_nested;               // ISR entered in the other ISR.
+
+//! line side.
+static uint32_t n_recv[N_WRITERS];
+static uint32_t n_recv_records[N_WRITERS];
+static int      rec_writer = -1;        // writer of the record receiving.
+static int      rec_left;
+static uint32_t n_error;
+
+static timer_t timer[2];
+static uint8_t *chunk;                  // source of main, a page.
+static size_t page_size;
+static uint32_t n_in_copy;              // ISR run in the copy of main.
+
+
+/***** Local functions ******************************************************/
+
+static uint8_t make_byte(int writer, uint32_t i)
+{
+  return (writer << 6) | (i & 0x3f);
+}
+
+static int record_length(uint32_t rec)
+{
+  return 1 + rec % MAX_RECORD;
+}
+
+
+//================================================================
+/*! ISR writes a record.
+*/
+static void isr_write(int writer)
+{
+  uint8_t rec[MAX_RECORD];
+
+  if( isr_depth++ ) n_nested++;
+  if( uh.tx_busy ) n_preempt_writer++;
+
+  int len = record_length(n_records[writer]);
+  for( int i = 0; i < len; i++ ) rec[i] = make_byte(writer, n_sent[writer] + i);
+
+  // a dropped record is sent again at the next time.
+  if( uart_write_atomic(&uh, rec, len) == len ) {
+    n_sent[writer] += len;
+    n_records[writer]++;
+  } else {
+    n_dropped++;
+  }
+  isr_depth--;
+}
+
+//! signal handlers as ISRs.
+static void isr_writer(int sig)
+{
+  isr_write((sig == SIGALRM) ? 1 : 2);
+}
+
+
+//================================================================
+/*! main reads the protected source, in uart_tx_copy().
+*/
+static void on_segv(int sig)
+{
+  mprotect(chunk, page_size, PROT_READ | PROT_WRITE);
+  n_in_copy++;
+  isr_write(3);
+}
+
+
+//================================================================
+/*! the Tx line, checks the sequence of each writer.
+*/
+static void line_sink(void *arg, uint8_t ch)
+{
+  int writer = ch >> 6;
+
+  if( writer >= N_WRITERS ) {
+    n_error++;
+    return;
+  }
+
+  // a record of ISR must not be interleaved.
+  if( rec_left > 0 && writer != rec_writer ) n_error++;
+  if( writer != 0 && rec_left == 0 ) {
+    rec_writer = writer;
+    rec_left = record_length(n_recv_records[writer]++);
+  }
+  if( writer != 0 ) rec_left--;
+
+  if( ch != make_byte(writer, n_recv[writer]) ) n_error++;
+  n_recv[writer]++;
+}
+
+static int tx_idle(void *arg)
+{
+  return sim_uart_tx_idle(0) && uart_is_write_finished(&uh);
+}
+
+
+//================================================================
+/*! start or stop the timers.
+*/
+static void timers(int enable)
+{
+  static const int sig[2] = { SIGALRM, SIGUSR1 };
+  static const long period_ns[2] = { 200000, 290000 };
+
+  if( enable ) sim_use_signals(1);
+  for( int i = 0; i < 2; i++ ) {
+    if( enable ) {
+      // the other signal can preempt the handler, as a nested ISR.
+      struct sigaction sa = { .sa_handler = isr_writer };
+      sigemptyset(&sa.sa_mask);
+      sigaction(sig[i], &sa, 0);
+
+      struct sigevent sev = { .sigev_notify = SIGEV_SIGNAL, .sigev_signo = sig[i] };
+      struct itimerspec its = { .it_interval = { 0, period_ns[i] },
+                                .it_value    = { 0, period_ns[i] } };
+      timer_create(CLOCK_MONOTONIC, &sev, &timer[i]);
+      timer_settime(timer[i], 0, &its, 0);
+    } else {
+      timer_delete(timer[i]);
+    }
+  }
+  if( !enable ) sim_use_signals(0);
+}
+
+
+//================================================================
+/*! main and the ISRs write at the same time.
+*/
+static void test_interleave(void)
+{
+  enum { N_BYTES = 30000, MAX_CHUNK = 40 };
+
+  page_size = sysconf(_SC_PAGESIZE);
+  chunk = mmap(0, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  struct sigaction sa = { .sa_handler = on_segv };
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, 0);
+
+  sim_reset();
+  uart_init_tx_buffer(&uh, UART_1, txbuf, sizeof(txbuf));
+  sim_uart[0].sink = line_sink;
+  timers(1);
+
+  uint32_t seed = 1;
+  while( n_sent[0] < N_BYTES ) {
+    seed = seed * 1103515245 + 12345;
+    int len = 1 + (seed >> 16) % MAX_CHUNK;
+    for( int i = 0; i < len; i++ ) chunk[i] = make_byte(0, n_sent[0] + i);
+    if( (seed >> 8) % 4 == 0 ) mprotect(chunk, page_size, PROT_NONE);
+    CHECK_EQ(uart_write(&uh, chunk, len), len);
+    n_sent[0] += len;
+
+    // bursts keep txfifo full, and the rest wait for Tx idle.
+    if( (n_sent[0] / 2000) % 2 ) sim_run_until(tx_idle, 0, SIM_CHAR_TIME * len * 4);
+  }
+
+  timers(0);
+  CHECK_EQ(sim_run_until(tx_idle, 0, SIM_CHAR_TIME * (sizeof(txbuf) + 10)), 0);
+
+  CHECK_EQ(n_error, 0);
+  for( int w = 0; w < N_WRITERS; w++ ) {
+    CHECK_EQ(n_recv[w], n_sent[w]);
+    CHECK_EQ(n_recv_records[w], n_records[w]);
+  }
+  CHECK(n_records[1] > 500);
+  CHECK(n_records[2] > 500);
+  CHECK(n_records[3] > 50);
+  CHECK_EQ(rec_left, 0);
+  CHECK_EQ(uh.tx_busy, 0);
+  CHECK_EQ(sim_uart[0].tx_lost, 0);
+
+  // preempted inside reserve .. commit, not only between the calls.
+  CHECK(n_in_copy > 100);
+  CHECK(n_preempt_writer >= n_in_copy);
+  CHECK(n_nested > 0);
+
+  munmap(chunk, page_size);
+  signal(SIGSEGV, SIG_DFL);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_interleave();
+
+  return TEST_MAIN_RESULT();
+}
@@ -0,0 +1,254 @@
+/*! @file
+  @brief
+  Host test of uart2 DMA transmit.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The DMA of UART_1 Tx is requested by the Tx interrupt, a byte per
+  rising edge. (see psoc_sim.h) A contiguous block of txfifo not
+  shorter than UART_TX_DMA_MIN_SIZE is sent by DMA, and the rest by
+  Tx ISR.
+
+  Each byte has the writer in the upper bit and a sequence number in
+  the lower 7 bits. The Tx line must carry every queued byte once, in
+  order per writer. With a timer signal writing by uart_write_atomic()
+  as an ISR, txfifo must never be left with data while the
+  transmitter is idle.
+
+  The window of the DMA complete ISR between the check of txfifo and
+  the set of flag_tx_finished is a few instructions. So the handle is
+  placed across a page boundary at flag_tx_finished, and the page is
+  write protected while the ISR runs. The SIGSEGV handler raises the
+  timer signal at the write, as the writer ISR preempting there.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define N_WRITERS       2       // main, SIGALRM
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE *uh;                 // across the page boundary.
+static UART_TX_DMA dma;
+static uint8_t txbuf[200];
+
+UART_ISR_TX( uh, UART_1 );
+UART_ISR_TX_DMA( uh, UART_1 );
+
+static uint32_t n_sent[N_WRITERS];
+static uint32_t n_recv[N_WRITERS];
+static uint32_t n_error;
+static uint32_t n_dma;                  // DMA transfers started.
+static uint32_t n_stuck;                // bit times with data left while idle.
+static uint16_t last_dma_size;
+static timer_t timer;
+
+static uint8_t *mem;                    // 2 pages, the handle is at the boundary.
+static size_t page_size;
+static SIM_ISR dma_isr;                 // isr_UART_1_TxDma.
+static volatile int in_dma_isr;
+static uint32_t n_in_dma_isr;           // writer run in the DMA complete ISR.
+
+
+/***** Local functions ******************************************************/
+
+static uint8_t make_byte(int writer, uint32_t i)
+{
+  return (writer << 7) | (i & 0x7f);
+}
+
+static void line_sink(void *arg, uint8_t ch)
+{
+  int writer = ch >> 7;
+
+  if( ch != make_byte(writer, n_recv[writer]) ) n_error++;
+  n_recv[writer]++;
+}
+
+//! watch DMA starts, and txfifo left with data.
+static void watch(void)
+{
+  if( dma.size != 0 && last_dma_size == 0 ) n_dma++;
+  last_dma_size = dma.size;
+
+  if( uh->flag_tx_finished && uh->tx_rd != uh->tx_wr && sim_uart_tx_idle(0) ) n_stuck++;
+}
+
+//! the DMA complete ISR, with the 2nd page write protected.
+static void dma_isr_protected(void)
+{
+  in_dma_isr = 1;
+  mprotect(mem + page_size, page_size, PROT_READ);
+  dma_isr();
+  mprotect(mem + page_size, page_size, PROT_READ | PROT_WRITE);
+  in_dma_isr = 0;
+}
+
+//! the DMA complete ISR writes flag_tx_finished.
+static void on_segv(int sig)
+{
+  mprotect(mem + page_size, page_size, PROT_READ | PROT_WRITE);
+  if( in_dma_isr ) {
+    n_in_dma_isr++;
+    raise(SIGALRM);     // pending until the critical section ends.
+  }
+}
+
+static int tx_idle(void *arg)
+{
+  return sim_uart_tx_idle(0) && uart_is_write_finished(uh);
+}
+
+static void setup(void)
+{
+  if( !mem ) {
+    page_size = sysconf(_SC_PAGESIZE);
+    mem = mmap(0, page_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uh = (UART_HANDLE *)(mem + page_size - offsetof(UART_HANDLE, flag_tx_finished));
+  }
+
+  sim_reset();
+  uart_init_tx_buffer(uh, UART_1, txbuf, sizeof(txbuf));
+  uart_init_tx_dma(uh, &dma, UART_1);
+  sim_uart[0].sink = line_sink;
+  sim_add_hook(watch);
+
+  memset(n_sent, 0, sizeof(n_sent));
+  memset(n_recv, 0, sizeof(n_recv));
+  n_error = n_dma = n_stuck = 0;
+  last_dma_size = 0;
+}
+
+//! main writes len bytes.
+static void write_main(int len)
+{
+  uint8_t buf[sizeof(txbuf)];
+
+  for( int i = 0; i < len; i++ ) buf[i] = make_byte(0, n_sent[0] + i);
+  CHECK_EQ(uart_write(uh, buf, len), len);
+  n_sent[0] += len;
+}
+
+
+//================================================================
+/*! bursts of every length, and at every position of txfifo.
+*/
+static void test_burst(void)
+{
+  setup();
+  for( int len = 1; len <= 120; len++ ) {
+    uint32_t n_dma_before = n_dma;
+    uint16_t n_cont = sizeof(txbuf) - uart_ring_pos(uh->tx_wr, sizeof(txbuf));
+
+    write_main(len);
+    CHECK_EQ(sim_run_until(tx_idle, 0, SIM_CHAR_TIME * (len + 10)), 0);
+    CHECK_EQ(n_recv[0], n_sent[0]);
+
+    // DMA only for a contiguous block long enough.
+    if( len < UART_TX_DMA_MIN_SIZE ) {
+      CHECK_EQ(n_dma, n_dma_before);
+    } else if( n_cont >= len ) {
+      CHECK(n_dma > n_dma_before);
+    }
+  }
+  CHECK_EQ(n_error, 0);
+  CHECK_EQ(n_stuck, 0);
+  CHECK_EQ(dma.size, 0);
+  CHECK_EQ(sim_uart[0].tx_lost, 0);
+  CHECK_EQ(sim_uart[0].tx_isr_enabled, 1);
+}
+
+
+//================================================================
+/*! ISR writes records, while DMA transfers complete.
+*/
+static void isr_writer(int sig)
+{
+  uint8_t rec[4];
+  int len = 1 + n_sent[1] % sizeof(rec);
+
+  for( int i = 0; i < len; i++ ) rec[i] = make_byte(1, n_sent[1] + i);
+  if( uart_write_atomic(uh, rec, len) == len ) n_sent[1] += len;
+}
+
+static void timer_enable(int enable)
+{
+  if( enable ) {
+    sim_use_signals(1);
+
+    struct sigaction sa = { .sa_handler = isr_writer };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, 0);
+
+    struct sigevent sev = { .sigev_notify = SIGEV_SIGNAL, .sigev_signo = SIGALRM };
+    struct itimerspec its = { .it_interval = { 0, 1000000 }, .it_value = { 0, 1000000 } };
+    timer_create(CLOCK_MONOTONIC, &sev, &timer);
+    timer_settime(timer, 0, &its, 0);
+  } else {
+    timer_delete(timer);
+    sim_use_signals(0);
+  }
+}
+
+static void test_concurrent(void)
+{
+  enum { N_BYTES = 100000 };
+  uint32_t seed = 1;
+
+  setup();
+  struct sigaction sa = { .sa_handler = on_segv };
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, 0);
+  dma_isr = sim_uart[0].dma_isr;
+  sim_uart[0].dma_isr = dma_isr_protected;
+  timer_enable(1);
+  while( n_sent[0] < N_BYTES ) {
+    seed = seed * 1103515245 + 12345;
+    write_main(1 + (seed >> 16) % 80);
+    sim_run((seed >> 8) % (SIM_CHAR_TIME * 100));
+  }
+  timer_enable(0);
+  sim_uart[0].dma_isr = dma_isr;
+  signal(SIGSEGV, SIG_DFL);
+  CHECK_EQ(sim_run_until(tx_idle, 0, SIM_CHAR_TIME * (sizeof(txbuf) + 10)), 0);
+
+  CHECK_EQ(n_error, 0);
+  CHECK_EQ(n_stuck, 0);
+  for( int w = 0; w < N_WRITERS; w++ ) CHECK_EQ(n_recv[w], n_sent[w]);
+  CHECK(n_sent[1] > 1000);
+  CHECK(n_dma > 300);
+  CHECK(n_in_dma_isr > 100);
+  CHECK_EQ(sim_uart[0].tx_lost, 0);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_burst();
+  test_concurrent();
+
+  return TEST_MAIN_RESULT();
+}
@@ -0,0 +1,227 @@
+/*! @file
+  @brief
+  Host test of uart2 interrupt handlers, and call cost benchmark.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The per-instance ISRs made by UART_ISR call NAME_ReadRxData etc.
+  directly. uart_isr_rx() calls them through the handle. Both must
+  give the same result, and the benchmark compares the cost.
+
+  On the host the two are about the same, the indirect call is
+  predicted. The benchmark also shows the cost of the per-byte feature
+  checks, which the ISR skips when no feature is attached.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+
+UART_ISR( &uh, UART_1 );
+
+
+/***** Local functions ******************************************************/
+
+//! generic handlers through the handle.
+static CY_ISR(isr_generic_Tx) { uart_isr_tx(&uh); }
+static CY_ISR(isr_generic_Rx) { uart_isr_rx(&uh); }
+
+static int n_read;
+
+static int rx_count_reached(void *arg)
+{
+  return n_read + uart_bytes_available(&uh) >= *(int *)arg;
+}
+
+
+//================================================================
+/*! loop back through UART_1, with the ISRs given.
+*/
+static void loopback(SIM_ISR tx_isr, SIM_ISR rx_isr)
+{
+  uint8_t data[300];
+  uint8_t buf[sizeof(data)];
+  int n = 0;
+
+  n_read = 0;
+  sim_reset();
+  sim_uart_connect(0, 0);
+  uart_init(&uh, UART_1);
+  sim_uart[0].tx_isr = tx_isr;
+  sim_uart[0].rx_isr = rx_isr;
+
+  for( int i = 0; i < sizeof(data); i++ ) data[i] = i * 13 + 5;
+
+  // write in chunks, and read while receiving.
+  for( int i = 0; i < sizeof(data); i += 50 ) {
+    int target = i + 50;
+    CHECK_EQ(uart_write(&uh, data + i, 50), 50);
+    if( sim_run_until(rx_count_reached, &target, SIM_CHAR_TIME * 1000) < 0 ) break;
+    n += uart_read(&uh, buf + n, sizeof(buf) - n);
+    n_read = n;
+  }
+  CHECK_EQ(n, sizeof(data));
+  CHECK(memcmp(buf, data, sizeof(data)) == 0);
+  CHECK(uart_is_write_finished(&uh));
+  CHECK_EQ(sim_uart[0].tx_lost, 0);
+  CHECK_EQ(sim_uart[0].rx_overrun, 0);
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(st.rx_bytes, sizeof(data));
+  CHECK_EQ(st.rx_overflow, 0);
+}
+
+
+//================================================================
+/*! per-instance ISRs and generic ISRs.
+*/
+static void test_isr(void)
+{
+  loopback(isr_UART_1_Tx, isr_UART_1_Rx);
+  loopback(isr_generic_Tx, isr_generic_Rx);
+}
+
+
+//================================================================
+/*! error status is counted by both ISRs.
+*/
+static void test_errors(void)
+{
+  SIM_ISR rx_isr[] = { isr_UART_1_Rx, isr_generic_Rx };
+
+  for( int i = 0; i < 2; i++ ) {
+    sim_reset();
+    uart_init(&uh, UART_1);
+    sim_uart[0].rx_isr = rx_isr[i];
+
+    sim_uart_rx(0, 'a', SIM_RX_STS_STOP_ERROR);
+    sim_uart_rx(0, 'b', SIM_RX_STS_PAR_ERROR);
+    sim_run(1);
+    for( int j = 0; j < 6; j++ ) sim_uart_rx(0, 'c', 0);     // overrun
+    sim_run(1);
+
+    UART_STATISTICS st;
+    uart_get_statistics(&uh, &st);
+    CHECK_EQ(st.rx_framing_error, 1);
+    CHECK_EQ(st.rx_parity_error, 1);
+    CHECK_EQ(st.rx_overrun, 1);
+    CHECK_EQ(uart_bytes_available(&uh), 2 + SIM_FIFO_SIZE);
+  }
+}
+
+
+//================================================================
+/*! light stand-in of the hardware for the benchmark.
+  noinline, as the component functions are in the other file.
+*/
+static const uint8_t *bench_p;
+static int bench_left;
+
+static __attribute__((noinline)) uint8 bench_ReadRxStatus(void)
+{
+  return bench_left ? SIM_RX_STS_FIFO_NOTEMPTY : 0;
+}
+
+static __attribute__((noinline)) uint8 bench_ReadRxData(void)
+{
+  bench_left--;
+  return *bench_p++;
+}
+
+static __attribute__((noinline)) void bench_isr_rx_t(UART_HANDLE *uh)
+{
+  uart_isr_rx_t(uh, SIM_RX_STS_FIFO_NOTEMPTY,
+                SIM_RX_STS_OVERRUN | SIM_RX_STS_STOP_ERROR |
+                SIM_RX_STS_PAR_ERROR | SIM_RX_STS_BREAK,
+                bench_ReadRxStatus, bench_ReadRxData);
+}
+
+
+static void bench_on_event(UART_HANDLE *uh, int event)
+{
+}
+
+
+//================================================================
+/*! cycles/byte of an Rx ISR, the best of some rounds.
+*/
+static double bench_rx_cycles(void (*isr)(UART_HANDLE *))
+{
+  enum { N_ROUND = 5, N_LOOP = 200000, N_BYTES = SIM_FIFO_SIZE };
+  static const uint8_t data[N_BYTES] = "abcd";
+  uint64_t t_min = ~0ULL;
+
+  // measure each loop as a whole, the counter is slower than the ISR.
+  for( int round = 0; round < N_ROUND; round++ ) {
+    uint64_t t0 = bench_cycles();
+    for( int loop = 0; loop < N_LOOP; loop++ ) {
+      uh.rx_rd = uh.rx_wr;
+      bench_p = data;
+      bench_left = N_BYTES;
+      isr(&uh);
+    }
+    uint64_t t = bench_cycles() - t0;
+    if( t < t_min ) t_min = t;
+  }
+  return (double)t_min / N_LOOP / N_BYTES;
+}
+
+
+//================================================================
+/*! cycles/byte of Rx ISR.
+  direct call / call through the handle, and with a feature attached.
+*/
+static void bench_isr_rx(void)
+{
+  static UART_HW hw;
+
+  sim_reset();
+  uart_init(&uh, UART_1);
+  hw = *uh.hw;
+  hw.ReadRxStatus = bench_ReadRxStatus;
+  hw.ReadRxData   = bench_ReadRxData;
+  uh.hw = &hw;
+
+  double t_direct   = bench_rx_cycles(bench_isr_rx_t);
+  double t_indirect = bench_rx_cycles(uart_isr_rx);
+
+  // a Tx event takes the Rx ISR off the plain path, but is never called.
+  uart_set_callback(&uh, UART_EVENT_TX_DRAINED, bench_on_event);
+  double t_feature  = bench_rx_cycles(bench_isr_rx_t);
+  CHECK(uh.stat.rx_bytes > 0);
+  CHECK_EQ(uh.stat.rx_overflow, 0);
+
+  printf("Rx ISR %d bytes: direct call %.2f, function table %.2f, "
+         "with a callback %.2f cycles/byte\n",
+         SIM_FIFO_SIZE, t_direct, t_indirect, t_feature);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_isr();
+  test_errors();
+
+  if( argc > 1 && strcmp(argv[1], "bench") == 0 ) bench_isr_rx();
+
+  return TEST_MAIN_RESULT();
+}
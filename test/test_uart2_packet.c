@@ -0,0 +1,404 @@
+/*! @file
+  @brief
+  Host test of COBS/SLIP packets in loopback, and send cost benchmark.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  UART_1 Tx is connected to its own Rx. While main sends packets,
+  the timer signal (standing in for an ISR, sim_use_signals) writes a
+  delimiter to the same handle by uart_write_atomic(). Between packets, it makes an empty packet and
+  is ignored. Inside a packet, it would cut the packet. So every
+  packet must arrive intact and in order.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define SIZE_RXBUF      8192
+#define SIZE_TXBUF      1024
+#define N_FRAMEQ        64
+#define MAX_PACKET      600
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static UART_FRAMEQ frame;
+static UART_FRAME fq[N_FRAMEQ];
+static uint8_t rxbuf[SIZE_RXBUF];
+static uint8_t txbuf[SIZE_TXBUF];
+
+UART_ISR( &uh, UART_1 );
+
+static uint8_t isr_delimiter;          //!< written by the ISR.
+static int n_isr_sent;
+
+static uint32_t rand_state;
+static uint32_t seq_state[256];         // rand_state at each packet made.
+static int n_received;
+static int n_error;
+
+
+/***** Local functions ******************************************************/
+
+static uint32_t rand_next(void)
+{
+  rand_state = rand_state * 1103515245 + 12345;
+  return rand_state >> 16;
+}
+
+//! timer signal as ISR, writes to the same handle.
+static void isr_writer(int sig)
+{
+  n_isr_sent += uart_write_atomic(&uh, &isr_delimiter, 1);
+}
+
+static void isr_writer_start(int enable)
+{
+  struct itimerval it = { .it_interval = { 0, 50 }, .it_value = { 0, 50 } };
+
+  if( !enable ) it = (struct itimerval){ 0 };
+  sim_use_signals(enable);
+  signal(SIGALRM, isr_writer);
+  setitimer(ITIMER_REAL, &it, 0);
+}
+
+
+//================================================================
+/*! make a packet. zeros, SLIP END/ESC, and long runs without zero.
+*/
+static int make_packet(uint8_t *p, int seq)
+{
+  static const int runs[] = { 253, 254, 255, 508, 509 };
+  int len;
+
+  if( seq % 8 == 7 ) {
+    len = runs[(seq / 8) % 5];
+    for( int i = 0; i < len; i++ ) p[i] = 1 + (seq + i) % 255;
+  } else {
+    len = 1 + rand_next() % 120;
+    for( int i = 0; i < len; i++ ) {
+      static const uint8_t special[] = { 0x00, 0xc0, 0xdb, 0xdc, 0xdd };
+      uint32_t r = rand_next();
+      p[i] = (r % 4 == 0) ? special[(r >> 4) % 5] : (uint8_t)(r >> 8);
+    }
+  }
+  p[0] = seq;
+  return len;
+}
+
+
+//================================================================
+/*! read out the received packets, and check against the sequence.
+*/
+static void check_received(void)
+{
+  static uint8_t buf[MAX_PACKET], expected[MAX_PACKET];
+  int n;
+
+  while( (n = uart_read_frame(&uh, buf, sizeof(buf))) > 0 ) {
+    // regenerate the packet from the state saved at the sender.
+    uint32_t saved = rand_state;
+    rand_state = seq_state[n_received % 256];
+    int len = make_packet(expected, n_received);
+    rand_state = saved;
+
+    if( n != len || memcmp(buf, expected, len) != 0 ) n_error++;
+    n_received++;
+  }
+}
+
+
+//================================================================
+/*! send packets in loopback, with or without the ISR writer.
+*/
+static void loopback(int mode, int with_isr)
+{
+  enum { N_PACKETS = 300 };
+  static uint8_t pkt[MAX_PACKET];
+
+  sim_reset();
+  sim_uart_connect(0, 0);
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  uart_init_frame(&uh, &frame, fq, N_FRAMEQ);
+  CHECK_EQ(uart_set_packet_mode(&uh, mode), 0);
+
+  isr_delimiter = (mode == UART_PACKET_COBS) ? 0x00 : 0xc0;
+  n_isr_sent = 0;
+  n_received = n_error = 0;
+  if( with_isr ) isr_writer_start(1);
+
+  rand_state = 1;
+  for( int seq = 0; seq < N_PACKETS; seq++ ) {
+    seq_state[seq % 256] = rand_state;
+    int len = make_packet(pkt, seq);
+    CHECK_EQ(uart_send_packet(&uh, pkt, len), len);
+    check_received();
+  }
+
+  if( with_isr ) isr_writer_start(0);
+  sim_run(SIM_CHAR_TIME * (SIZE_TXBUF + 10));
+  check_received();
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(n_received, N_PACKETS);
+  CHECK_EQ(n_error, 0);
+  CHECK_EQ(st.rx_packet_error, 0);
+  CHECK_EQ(st.rx_overflow, 0);
+  CHECK(!with_isr || n_isr_sent > 100);
+}
+
+static void test_loopback(void)
+{
+  loopback(UART_PACKET_COBS, 0);
+  loopback(UART_PACKET_SLIP, 0);
+  loopback(UART_PACKET_COBS, 1);
+  loopback(UART_PACKET_SLIP, 1);
+}
+
+
+//================================================================
+/*! encoded size, and the limits.
+*/
+static void test_size(void)
+{
+  static uint8_t pkt[SIZE_TXBUF];
+
+  sim_reset();
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  uart_init_frame(&uh, &frame, fq, N_FRAMEQ);
+
+  // not in packet mode.
+  CHECK_EQ(uart_send_packet(&uh, "a", 1), -1);
+
+  // COBS: a code byte per 254 bytes, and a zero is replaced by a code.
+  uart_set_packet_mode(&uh, UART_PACKET_COBS);
+  memset(pkt, 0x55, sizeof(pkt));
+  uart_set_mode(&uh, UART_WRITE_NONBLOCK);
+  uh.flag_tx_finished = 0;              // hold the data in txfifo.
+  CHECK_EQ(uart_send_packet(&uh, pkt, 254), 254);
+  CHECK_EQ(uart_ring_count(uh.tx_rd, uh.tx_wr, uh.tx_size), 254 + 2);
+  uh.tx_rd = uh.tx_wr;
+  CHECK_EQ(uart_send_packet(&uh, pkt, 255), 255);
+  CHECK_EQ(uart_ring_count(uh.tx_rd, uh.tx_wr, uh.tx_size), 255 + 3);
+  uh.tx_rd = uh.tx_wr;
+  pkt[10] = 0;
+  CHECK_EQ(uart_send_packet(&uh, pkt, 20), 20);
+  CHECK_EQ(uart_ring_count(uh.tx_rd, uh.tx_wr, uh.tx_size), 20 + 2);
+  uh.tx_rd = uh.tx_wr;
+
+  // larger than txfifo, never sent in part.
+  memset(pkt, 0x55, sizeof(pkt));
+  CHECK_EQ(uart_send_packet(&uh, pkt, SIZE_TXBUF - 4), -1);
+  CHECK_EQ(uart_send_packet(&uh, pkt, SIZE_TXBUF - 8), SIZE_TXBUF - 8);
+
+  // NONBLOCK: 0 if txfifo doesn't have space for the whole packet.
+  CHECK_EQ(uart_send_packet(&uh, pkt, 10), 0);
+  CHECK_EQ(uart_ring_count(uh.tx_rd, uh.tx_wr, uh.tx_size), SIZE_TXBUF - 8 + 5);
+  uh.tx_rd = uh.tx_wr;
+
+  // SLIP: END at both ends, and END/ESC are escaped.
+  uart_set_packet_mode(&uh, UART_PACKET_SLIP);
+  pkt[0] = 0xc0;
+  pkt[1] = 0xdb;
+  CHECK_EQ(uart_send_packet(&uh, pkt, 10), 10);
+  CHECK_EQ(uart_ring_count(uh.tx_rd, uh.tx_wr, uh.tx_size), 10 + 2 + 2);
+}
+
+
+//================================================================
+/*! frame queue full. the packets are dropped, counted in bytes.
+*/
+static void rx_bytes(const uint8_t *p, int len)
+{
+  for( int i = 0; i < len; i++ ) {
+    sim_uart_rx(0, p[i], 0);
+    sim_dispatch();
+  }
+}
+
+static void test_frameq_full(void)
+{
+  static UART_FRAME fq2[2];
+  static const uint8_t pkt3[] = { 0x04, 0x31, 0x32, 0x33, 0x00 };  // 3 bytes.
+  static const uint8_t pkt5[] = { 0x06, 0x51, 0x52, 0x53, 0x54, 0x55, 0x00 };
+  uint8_t buf[16];
+  UART_STATISTICS st;
+
+  sim_reset();
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  CHECK_EQ(uart_init_frame(&uh, &frame, fq2, 2), 0);
+  uart_set_packet_mode(&uh, UART_PACKET_COBS);
+
+  // fill the queue, and 2 packets more.
+  int n_hold = uart_ring_space(0, 0, 2);
+  for( int i = 0; i < n_hold; i++ ) rx_bytes(pkt3, sizeof(pkt3));
+  rx_bytes(pkt5, sizeof(pkt5));
+  rx_bytes(pkt3, sizeof(pkt3));
+  uart_get_statistics(&uh, &st);
+  CHECK(uart_is_rx_overflow(&uh));
+  CHECK_EQ(st.rx_overflow, 5 + 3);
+
+  // the dropped bytes are skipped.
+  for( int i = 0; i < n_hold; i++ ) CHECK_EQ(uart_read_frame(&uh, buf, sizeof(buf)), 3);
+  CHECK_EQ(uart_read_frame(&uh, buf, sizeof(buf)), 0);
+  rx_bytes(pkt5, sizeof(pkt5));
+  CHECK_EQ(uart_read_frame(&uh, buf, sizeof(buf)), 5);
+  CHECK_EQ(buf[0], 0x51);
+  CHECK_EQ(uart_bytes_available(&uh), 0);
+}
+
+
+//================================================================
+/*! the former implementation, uart_write() per block or escape.
+*/
+static int send_packet_per_write(UART_HANDLE *uh, const void *buffer, size_t size)
+{
+  static const uint8_t slip_esc[][2] = {{ 0xdb, 0xdc }, { 0xdb, 0xdd }};
+  const uint8_t *p = buffer;
+  const uint8_t *p_end = p + size;
+
+  if( uh->mode & UART_PACKET_COBS ) {
+    while( 1 ) {
+      const uint8_t *p_zero = memchr( p, 0, p_end - p );
+      size_t n = (p_zero ? p_zero : p_end) - p;
+      if( n > 254 ) n = 254;
+
+      uint8_t code = n + 1;
+      uart_write(uh, &code, 1);
+      uart_write(uh, p, n);
+      p += n;
+
+      if( p == p_end ) break;
+      if( n != 254 ) p++;
+    }
+    uart_write(uh, "", 1);
+
+  } else {
+    uart_write(uh, "\xc0", 1);
+    while( p < p_end ) {
+      const uint8_t *p1 = p;
+      while( p1 < p_end && *p1 != 0xc0 && *p1 != 0xdb ) p1++;
+      uart_write(uh, p, p1 - p);
+      if( p1 == p_end ) break;
+      uart_write(uh, slip_esc[*p1 == 0xdb], 2);
+      p = p1 + 1;
+    }
+    uart_write(uh, "\xc0", 1);
+  }
+  return size;
+}
+
+
+//================================================================
+/*! light stand-in of the hardware for the benchmark.
+  The hardware FIFO is never empty, so the data stay in txfifo.
+*/
+static __attribute__((noinline)) uint8 bench_ReadTxStatus(void)
+{
+  return 0;
+}
+
+static uint64_t bench_send(int (*send)(UART_HANDLE *, const void *, size_t),
+                           const uint8_t *pkt, int len, int n_loop)
+{
+  uint64_t t0 = bench_cycles();
+  for( int loop = 0; loop < n_loop; loop++ ) {
+    send(&uh, pkt, len);
+    uh.tx_rd = uh.tx_wr;
+  }
+  return bench_cycles() - t0;
+}
+
+
+//================================================================
+/*! cycles/packet of uart_send_packet(). (single reservation / per write)
+*/
+static void bench_send_packet(void)
+{
+  enum { N_LOOP = 200000, LEN = 64 };
+  static const char *name[] = { "COBS", "SLIP" };
+  static const int mode[] = { UART_PACKET_COBS, UART_PACKET_SLIP };
+  uint8_t pkt[LEN];
+  static UART_HW hw;
+
+  // typical binary data: a zero or SLIP END every ~16 bytes.
+  for( int i = 0; i < LEN; i++ ) pkt[i] = (i % 16 == 5) ? 0x00 : (i % 16 == 11) ? 0xc0 : i + 1;
+
+  for( int i = 0; i < 2; i++ ) {
+    sim_reset();
+    uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+    uart_init_frame(&uh, &frame, fq, N_FRAMEQ);
+    uart_set_packet_mode(&uh, mode[i]);
+    hw = *uh.hw;
+    hw.ReadTxStatus = bench_ReadTxStatus;
+    uh.hw = &hw;
+
+    uint64_t t_single = bench_send(uart_send_packet, pkt, LEN, N_LOOP);
+    uint64_t t_write  = bench_send(send_packet_per_write, pkt, LEN, N_LOOP);
+    BENCH_KEEP(uh.tx_wr);
+
+    printf("send %s packet %d bytes: single reservation %.1f, uart_write per block %.1f cycles/packet\n",
+           name[i], LEN, (double)t_single / N_LOOP, (double)t_write / N_LOOP);
+  }
+}
+
+
+#if defined(UART_RING_POW2)
+//================================================================
+/*! sizes not power of 2 are rejected. (UART_RING_POW2)
+*/
+static void test_pow2_sizes(void)
+{
+  sim_reset();
+  sim_n_halt = 0;
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  CHECK_EQ(sim_n_halt, 0);
+  CHECK_EQ(uart_init_frame(&uh, &frame, fq, N_FRAMEQ), 0);
+  CHECK(uh.frame == &frame);
+
+  uh.frame = 0;
+  CHECK_EQ(uart_init_frame(&uh, &frame, fq, N_FRAMEQ - 1), -1);
+  CHECK(uh.frame == 0);
+  CHECK_EQ(uart_init_frame(&uh, &frame, fq, 0), -1);
+
+  uart_init_buffer(&uh, UART_1, rxbuf, 1000, txbuf, sizeof(txbuf));
+  CHECK_EQ(sim_n_halt, 1);
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, 1000);
+  CHECK_EQ(sim_n_halt, 2);
+}
+#endif
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_loopback();
+  test_size();
+  test_frameq_full();
+#if defined(UART_RING_POW2)
+  test_pow2_sizes();
+#endif
+
+  if( argc > 1 && strcmp(argv[1], "bench") == 0 ) bench_send_packet();
+
+  return TEST_MAIN_RESULT();
+}
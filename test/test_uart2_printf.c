@@ -0,0 +1,269 @@
+/*! @file
+  @brief
+  Host test of uart_printf against snprintf, and call cost benchmark.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The Tx line of UART_1 is captured, and compared with the output of
+  vsnprintf for the same format and arguments. %q has no counterpart,
+  so it is compared with the expected string.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+#include <stdarg.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static uint8_t txbuf[256];
+
+UART_ISR( &uh, UART_1 );
+
+static char line[512];                  //!< captured Tx line.
+static int  line_len;
+
+
+/***** Local functions ******************************************************/
+
+static void line_sink(void *arg, uint8_t ch)
+{
+  if( line_len < sizeof(line) - 1 ) line[line_len++] = ch;
+}
+
+static int tx_idle(void *arg)
+{
+  return sim_uart_tx_idle(0) && uart_is_write_finished(&uh);
+}
+
+static void setup(void)
+{
+  sim_reset();
+  uart_init_tx_buffer(&uh, UART_1, txbuf, sizeof(txbuf));
+  sim_uart[0].sink = line_sink;
+}
+
+
+//================================================================
+/*! uart_printf the format, and return the Tx line.
+*/
+static const char *output(int *ret, const char *fmt, va_list ap)
+{
+  line_len = 0;
+  *ret = uart_vprintf(&uh, fmt, ap);
+  sim_run_until(tx_idle, 0, SIM_CHAR_TIME * (sizeof(line) + 10));
+  line[line_len] = 0;
+  return line;
+}
+
+//! same output as snprintf.
+static void check_fmt(const char *fmt, ...)
+{
+  char expected[sizeof(line)];
+  va_list ap, ap2;
+  int ret;
+
+  va_start(ap, fmt);
+  va_copy(ap2, ap);
+  int len = vsnprintf(expected, sizeof(expected), fmt, ap);
+  const char *s = output(&ret, fmt, ap2);
+  va_end(ap2);
+  va_end(ap);
+
+  if( strcmp(s, expected) != 0 ) {
+    printf("  format \"%s\": \"%s\", expected \"%s\"\n", fmt, s, expected);
+  }
+  CHECK(strcmp(s, expected) == 0);
+  CHECK_EQ(ret, len);
+}
+
+//! the output is the expected string.
+static void check_str(const char *expected, const char *fmt, ...)
+{
+  va_list ap;
+  int ret;
+
+  va_start(ap, fmt);
+  const char *s = output(&ret, fmt, ap);
+  va_end(ap);
+
+  if( strcmp(s, expected) != 0 ) {
+    printf("  format \"%s\": \"%s\", expected \"%s\"\n", fmt, s, expected);
+  }
+  CHECK(strcmp(s, expected) == 0);
+  CHECK_EQ(ret, strlen(expected));
+}
+
+
+//================================================================
+/*! integer conversions, flags, width and precision.
+*/
+static void test_integer(void)
+{
+  static const int32_t values[] = { 0, 1, -1, 9, 10, -99, 12345, -12345,
+                                    0x7fffffff, -0x7fffffff - 1 };
+  static const char *fmts[] = { "%d", "%i", "%5d", "%-5d|", "%05d", "%.3d",
+                                "%8.3d", "%-8.3d|", "%08.3d", "%.0d", "%u",
+                                "%x", "%X", "%08x", "%.6x", "%-10X|", "%.25d",
+                                "%.40x", "%45.30u" };
+
+  setup();
+  for( int i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++ ) {
+    for( int j = 0; j < sizeof(values) / sizeof(values[0]); j++ ) {
+      check_fmt(fmts[i], values[j]);
+    }
+  }
+  check_fmt("%ld %lu %lx %hd", -123456L, 123456UL, 0xabcdefUL, 42);
+}
+
+
+//================================================================
+/*! '*' for width and precision, negative values.
+*/
+static void test_star(void)
+{
+  setup();
+  check_fmt("%*d|", 6, 42);
+  check_fmt("%*d|", -6, 42);
+  check_fmt("%0*d|", -6, 42);
+  check_fmt("%*s|", -8, "abc");
+  check_fmt("%*c|", -3, 'x');
+  check_fmt("%.*d|", 5, 42);
+  check_fmt("%.*d|", -5, 42);
+  check_fmt("%*.*x|", -12, 30, 0xbeef);
+  check_fmt("%.*s|", 2, "abcdef");
+  check_fmt("%.*s|", -1, "abcdef");
+}
+
+
+//================================================================
+/*! strings, characters and the others.
+*/
+static void test_string(void)
+{
+  setup();
+  check_fmt("plain text");
+  check_fmt("%s", "");
+  check_fmt("%s,%s", "abc", "defghijklmnopqrstuvwxyz");
+  check_fmt("%8s|%-8s|%.2s", "ab", "cd", "efgh");
+  check_fmt("%c%c%3c", 'a', 'b', 'c');
+  check_fmt("100%%");
+  check_str("(null)", "%s", (char *)0);
+
+  // longer than a chunk, and longer than txfifo.
+  char s[300];
+  memset(s, 'x', sizeof(s) - 1);
+  s[sizeof(s) - 1] = 0;
+  check_fmt("[%s]", s);
+}
+
+
+//================================================================
+/*! fixed point.
+*/
+static void test_fixed(void)
+{
+  setup();
+  check_str("25.3", "%.1q", 253);
+  check_str("-25.3", "%.1q", -253);
+  check_str("0.05", "%.2q", 5);
+  check_str("-0.05", "%.2q", -5);
+  check_str("0.000", "%.3q", 0);
+  check_str("253", "%q", 253);
+  check_str("253", "%.0q", 253);
+  check_str("   -1.5|", "%7.1q|", -15);
+  check_str("-0001.5|", "%07.1q|", -15);
+  check_str("1.5    |", "%-7.1q|", 15);
+  check_str("   12.345|", "%*.*q|", 9, 3, 12345);
+  check_str("12.345   |", "%*.*q|", -9, 3, 12345);
+  check_str("-214748.3648", "%.4lq", (long)(-0x7fffffff - 1));
+
+  // more decimal places than the digits of 32bit value.
+  check_str("0.0000000000000000000000000000000042", "%.34q", 42);
+}
+
+
+//================================================================
+/*! light stand-in of the hardware for the benchmark.
+  The hardware FIFO is never empty, so the data stay in txfifo.
+*/
+static __attribute__((noinline)) uint8 bench_ReadTxStatus(void)
+{
+  return 0;
+}
+
+//! the former way, format into a stack buffer.
+static int snprintf_puts(UART_HANDLE *uh, const char *fmt, ...)
+{
+  char buf[128];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  return uart_puts(uh, buf);
+}
+
+
+//================================================================
+/*! cycles/call of uart_printf() and snprintf() + uart_puts().
+*/
+static void bench_printf(void)
+{
+  enum { N_LOOP = 200000 };
+  static UART_HW hw;
+  int16_t temp = 253;
+  uint16_t adc = 0x1f3;
+  int ret = 0;
+
+  setup();
+  hw = *uh.hw;
+  hw.ReadTxStatus = bench_ReadTxStatus;
+  uh.hw = &hw;
+
+  uint64_t t0 = bench_cycles();
+  for( int loop = 0; loop < N_LOOP; loop++ ) {
+    ret += uart_printf(&uh, "temp=%d adc=%04x %s\r\n", temp, adc, "OK");
+    uh.tx_rd = uh.tx_wr;
+  }
+  uint64_t t_printf = bench_cycles() - t0;
+
+  t0 = bench_cycles();
+  for( int loop = 0; loop < N_LOOP; loop++ ) {
+    ret += snprintf_puts(&uh, "temp=%d adc=%04x %s\r\n", temp, adc, "OK");
+    uh.tx_rd = uh.tx_wr;
+  }
+  uint64_t t_snprintf = bench_cycles() - t0;
+  BENCH_KEEP(ret);
+
+  printf("printf 23 chars: uart_printf %.1f, snprintf + uart_puts %.1f cycles/call\n",
+         (double)t_printf / N_LOOP, (double)t_snprintf / N_LOOP);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_integer();
+  test_star();
+  test_string();
+  test_fixed();
+
+  if( argc > 1 && strcmp(argv[1], "bench") == 0 ) bench_printf();
+
+  return TEST_MAIN_RESULT();
+}
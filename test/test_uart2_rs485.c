@@ -0,0 +1,175 @@
+/*! @file
+  @brief
+  Host test of RS-485 DE control of uart2.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The model sets TX_STS_COMPLETE after every byte, and clears it on
+  read. (see psoc_sim.h) DE must be asserted while any bit is on the
+  line, and released at the stop bit of the last byte, for bursts of
+  any length and writes at any time, including during the release.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static UART_RS485 rs485;
+
+UART_ISR( &uh, UART_1 );
+
+static uint8_t  de_level;
+static uint32_t n_de_on, n_de_off;
+static uint32_t n_early;                // DE was low while transmitting.
+static uint32_t idle_de_steps;          // steps of idle line with DE high.
+static uint32_t max_idle_de_steps;
+static uint32_t n_complete;             // UART_EVENT_TX_COMPLETE.
+static uint32_t n_received;
+
+
+/***** Local functions ******************************************************/
+
+//! DE pin component.
+void DE_Write(uint8 value)
+{
+  if( value && !de_level ) n_de_on++;
+  if( !value && de_level ) n_de_off++;
+  de_level = value;
+}
+
+static void on_event(UART_HANDLE *uh, int event)
+{
+  if( event == UART_EVENT_TX_COMPLETE ) n_complete++;
+}
+
+static void line_sink(void *arg, uint8_t ch)
+{
+  if( !de_level ) n_early++;
+  n_received++;
+}
+
+//! check DE at every bit time.
+static void check_de(void)
+{
+  if( !sim_uart_tx_idle(0) ) {
+    if( !de_level ) n_early++;
+    idle_de_steps = 0;
+  } else if( de_level ) {
+    if( ++idle_de_steps > max_idle_de_steps ) max_idle_de_steps = idle_de_steps;
+  } else {
+    idle_de_steps = 0;
+  }
+}
+
+static int tx_complete(void *arg)
+{
+  return uart_is_tx_complete(&uh);
+}
+
+static void setup(void)
+{
+  static int hooked;
+
+  sim_reset();
+  uart_init(&uh, UART_1);
+  uart_init_rs485(&uh, &rs485, UART_1, DE);
+  uart_set_callback(&uh, UART_EVENT_TX_COMPLETE, on_event);
+  sim_uart[0].sink = line_sink;
+  if( !hooked++ ) sim_add_hook(check_de);
+
+  n_de_on = n_de_off = n_early = n_complete = n_received = 0;
+  idle_de_steps = max_idle_de_steps = 0;
+}
+
+
+//================================================================
+/*! a burst, and DE is released at the stop bit of the last byte.
+*/
+static void test_burst(void)
+{
+  static const uint8_t data[20] = "0123456789abcdefghi";
+
+  for( int len = 1; len <= sizeof(data); len++ ) {
+    setup();
+    CHECK_EQ(uart_write(&uh, data, len), len);
+    CHECK_EQ(de_level, 1);
+    CHECK_EQ(sim_run_until(tx_complete, 0, SIM_CHAR_TIME * (len + 10)), 0);
+
+    // the release is in the same bit time as the stop bit.
+    CHECK_EQ(n_received, len);
+    CHECK(sim_uart_tx_idle(0));
+    CHECK_EQ(de_level, 0);
+    CHECK_EQ(n_early, 0);
+    CHECK(max_idle_de_steps <= 1);
+    CHECK_EQ(n_complete, 1);
+    CHECK_EQ(rs485.sent, len);
+
+    // FIFO empty interrupt works after the release.
+    CHECK_EQ(uart_write(&uh, data, len), len);
+    CHECK_EQ(sim_run_until(tx_complete, 0, SIM_CHAR_TIME * (len + 10)), 0);
+    CHECK_EQ(n_received, 2 * len);
+    CHECK_EQ(n_complete, 2);
+    CHECK_EQ(n_early, 0);
+  }
+}
+
+
+//================================================================
+/*! writes at random times, also while waiting TX complete.
+*/
+static void test_random(void)
+{
+  enum { N_WRITES = 3000 };
+  uint8_t data[16];
+  uint32_t n_sent = 0;
+  uint32_t seed = 1;
+
+  setup();
+  memset(data, 0x55, sizeof(data));
+  for( int i = 0; i < N_WRITES; i++ ) {
+    seed = seed * 1103515245 + 12345;
+    int len = 1 + (seed >> 16) % sizeof(data);
+    CHECK_EQ(uart_write(&uh, data, len), len);
+    n_sent += len;
+
+    // gaps around the end of the burst, by bit time.
+    int gap = (seed >> 8) % (SIM_CHAR_TIME * (len + 3) * 2);
+    sim_run(gap);
+  }
+  CHECK_EQ(sim_run_until(tx_complete, 0, SIM_CHAR_TIME * (UART_SIZE_TXFIFO + 10)), 0);
+
+  CHECK_EQ(n_received, n_sent);
+  CHECK_EQ(n_early, 0);
+  CHECK(max_idle_de_steps <= 1);
+  CHECK_EQ(de_level, 0);
+  CHECK_EQ(n_de_on, n_de_off);
+  CHECK_EQ(n_complete, n_de_off);
+  CHECK(n_de_off > N_WRITES / 10);
+  CHECK_EQ(sim_uart[0].tx_lost, 0);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_burst();
+  test_random();
+
+  return TEST_MAIN_RESULT();
+}
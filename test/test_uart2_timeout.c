@@ -0,0 +1,260 @@
+/*! @file
+  @brief
+  Host test of the timeout functions of uart2.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  uart_tick() is called every TICK_BITS bit times, as 1ms at
+  115200bps. The functions sleep by CyPmAltAct(), which advances the
+  simulation by a bit time. They must return -1 at the deadline, never
+  later, and return at once when the data arrives. A buffer of size 0
+  returns 0 at once, and keeps the received data.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define TICK_BITS       115     //!< bit times of 1ms at 115200bps.
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static UART_FLOW flow;
+static UART_FRAMEQ frame;
+static UART_FRAME fq[4];
+static uint8_t rxbuf[64];
+static uint8_t txbuf[16];
+
+UART_ISR( &uh, UART_1 );
+
+static uint8_t cts_level;               // CTS pin. (active low)
+
+static const uint8_t *rx_data;          // the peer sends, at rx_time.
+static int      rx_len;
+static uint32_t rx_time;
+
+
+/***** Local functions ******************************************************/
+
+//! RTS and CTS pin components.
+void RTS_Write(uint8 value)
+{
+}
+
+uint8 CTS_Read(void)
+{
+  return cts_level;
+}
+
+//! SysTick, and the peer.
+static void tick(void)
+{
+  if( sim_time % TICK_BITS == 0 ) uart_tick();
+
+  if( rx_len > 0 && (int32_t)(sim_time - rx_time) >= 0 && sim_time % SIM_CHAR_TIME == 0 ) {
+    sim_uart_rx(0, *rx_data++, 0);
+    rx_len--;
+  }
+}
+
+//! the peer sends data after ms.
+static void rx_after(uint32_t ms, const void *data, int len)
+{
+  rx_data = data;
+  rx_len  = len;
+  rx_time = sim_time + ms * TICK_BITS;
+}
+
+static void setup(void)
+{
+  sim_reset();
+  uart_init_buffer(&uh, UART_1, rxbuf, sizeof(rxbuf), txbuf, sizeof(txbuf));
+  sim_add_hook(tick);
+  uart_tick_count = 0;
+  rx_len = 0;
+  cts_level = 0;
+}
+
+//! sim_time from t0 is in (ms - 1, ms] ms.
+static void check_elapsed(uint32_t t0, uint32_t ms)
+{
+  uint32_t bits = sim_time - t0;
+
+  CHECK(bits > (ms - 1) * TICK_BITS);
+  CHECK(bits <= ms * TICK_BITS);
+}
+
+
+//================================================================
+/*! uart_read_timeout()
+*/
+static void test_read(void)
+{
+  uint8_t buf[16];
+  uint32_t t0;
+
+  setup();
+
+  // no data.
+  t0 = sim_time;
+  CHECK_EQ(uart_read_timeout(&uh, buf, sizeof(buf), 20), -1);
+  check_elapsed(t0, 20);
+
+  // data before the deadline.
+  rx_after(5, "abc", 3);
+  t0 = sim_time;
+  CHECK_EQ(uart_read_timeout(&uh, buf, sizeof(buf), 20), 1);
+  CHECK(sim_time - t0 < 6 * TICK_BITS);
+  sim_run(SIM_CHAR_TIME * 5);
+  CHECK_EQ(uart_read_timeout(&uh, buf + 1, sizeof(buf) - 1, 20), 2);
+  CHECK(memcmp(buf, "abc", 3) == 0);
+
+  // size 0, the data is kept.
+  rx_after(0, "d", 1);
+  sim_run(SIM_CHAR_TIME * 3);
+  t0 = sim_time;
+  CHECK_EQ(uart_read_timeout(&uh, buf, 0, 20), 0);
+  CHECK_EQ(uart_read_timeout(&uh, buf, 0, UART_TIMEOUT_FOREVER), 0);
+  CHECK_EQ(sim_time, t0);
+  CHECK_EQ(uart_bytes_available(&uh), 1);
+
+  // timeout 0 with data, and without.
+  CHECK_EQ(uart_read_timeout(&uh, buf, sizeof(buf), 0), 1);
+  CHECK_EQ(uart_read_timeout(&uh, buf, sizeof(buf), 0), -1);
+  CHECK_EQ(sim_time, t0);
+}
+
+
+//================================================================
+/*! uart_gets_timeout()
+*/
+static void test_gets(void)
+{
+  char buf[16];
+  uint32_t t0;
+
+  setup();
+
+  t0 = sim_time;
+  CHECK_EQ(uart_gets_timeout(&uh, buf, sizeof(buf), 10), -1);
+  CHECK_EQ(buf[0], '\0');
+  check_elapsed(t0, 10);
+
+  // a line before the deadline.
+  rx_after(3, "ab\ncd", 5);
+  CHECK_EQ(uart_gets_timeout(&uh, buf, sizeof(buf), 10), 3);
+  CHECK(strcmp(buf, "ab\n") == 0);
+
+  // size 0 and 1, the data is kept.
+  sim_run(SIM_CHAR_TIME * 5);
+  t0 = sim_time;
+  buf[0] = 'x';
+  CHECK_EQ(uart_gets_timeout(&uh, buf, 0, 10), 0);
+  CHECK_EQ(buf[0], 'x');
+  CHECK_EQ(uart_gets_timeout(&uh, buf, 1, 10), 0);
+  CHECK_EQ(buf[0], '\0');
+  CHECK_EQ(sim_time, t0);
+  CHECK_EQ(uart_bytes_available(&uh), 2);
+}
+
+
+//================================================================
+/*! uart_write_timeout(), the transmitter stopped by CTS.
+*/
+static void test_write(void)
+{
+  static const uint8_t data[40];
+  uint32_t t0;
+
+  setup();
+  uart_init_rtscts(&uh, &flow, RTS, CTS);
+  cts_level = 1;
+
+  // longer than txfifo.
+  t0 = sim_time;
+  CHECK_EQ(uart_write_timeout(&uh, data, sizeof(data), 10), -1);
+  check_elapsed(t0, 10);
+
+  // txfifo is full.
+  t0 = sim_time;
+  CHECK_EQ(uart_write_timeout(&uh, data, 1, 5), -1);
+  check_elapsed(t0, 5);
+  CHECK_EQ(uart_write_timeout(&uh, data, 0, 5), 0);
+
+  // restarted by the CTS interrupt.
+  cts_level = 0;
+  uart_cts_changed(&uh);
+  CHECK_EQ(uart_write_timeout(&uh, data, sizeof(data), 100), sizeof(data));
+}
+
+
+//================================================================
+/*! uart_recv_packet_timeout() and uart_read_frame()
+*/
+static void test_packet(void)
+{
+  static const uint8_t cobs[] = { 0x03, 0x11, 0x22, 0x00 };
+  uint8_t buf[16];
+  uint32_t t0;
+
+  setup();
+  CHECK_EQ(uart_init_frame(&uh, &frame, fq, 4), 0);
+  CHECK_EQ(uart_set_packet_mode(&uh, UART_PACKET_COBS), 0);
+
+  // no packet.
+  t0 = sim_time;
+  CHECK_EQ(uart_recv_packet_timeout(&uh, buf, sizeof(buf), 15), -1);
+  check_elapsed(t0, 15);
+
+  // a packet before the deadline.
+  rx_after(2, cobs, sizeof(cobs));
+  CHECK_EQ(uart_recv_packet_timeout(&uh, buf, sizeof(buf), 15), 2);
+  CHECK(memcmp(buf, "\x11\x22", 2) == 0);
+
+  // size 0, without a packet and with it. the packet is kept.
+  t0 = sim_time;
+  CHECK_EQ(uart_recv_packet_timeout(&uh, buf, 0, 15), 0);
+  CHECK_EQ(sim_time, t0);
+  rx_after(0, cobs, sizeof(cobs));
+  sim_run(SIM_CHAR_TIME * (sizeof(cobs) + 2));
+  t0 = sim_time;
+  CHECK_EQ(uart_recv_packet_timeout(&uh, buf, 0, UART_TIMEOUT_FOREVER), 0);
+  CHECK_EQ(uart_read_frame(&uh, buf, 0), 0);
+  CHECK_EQ(sim_time, t0);
+  CHECK_EQ(uart_read_frame(&uh, buf, sizeof(buf)), 2);
+  CHECK_EQ(uart_read_frame(&uh, buf, sizeof(buf)), 0);
+
+  // shorter buffer, the rest is discarded.
+  rx_after(0, cobs, sizeof(cobs));
+  CHECK_EQ(uart_recv_packet_timeout(&uh, buf, 1, 15), 1);
+  CHECK_EQ(buf[0], 0x11);
+  CHECK_EQ(uart_bytes_available(&uh), 0);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_read();
+  test_gets();
+  test_write();
+  test_packet();
+
+  return TEST_MAIN_RESULT();
+}
@@ -0,0 +1,403 @@
+/*! @file
+  @brief
+  Host test of flow control with a simulated peer. (XON/XOFF, RTS/CTS)
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  Built for uart.c, and for uart2.c with TEST_UART2. (RTS/CTS too)
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#if defined(TEST_UART2)
+# include "uart2.h"
+#else
+# include "uart.h"
+#endif
+#include "sim_peer.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define HIGH  96
+#define LOW   32
+
+//! usable bytes of rxfifo. (1 less than the size, unless UART_RING_POW2)
+#define RX_CAPACITY     uart_ring_space(0, 0, UART_SIZE_RXFIFO)
+
+
+/***** Macros ***************************************************************/
+#if defined(TEST_UART2)
+# define TEST_UART_INIT(uh) uart_init(uh, UART_1)
+#else
+# define TEST_UART_INIT(uh) uart_init(uh)
+#endif
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static SIM_PEER peer;
+
+#if defined(TEST_UART2)
+static UART_FLOW flow;
+
+UART_ISR( &uh, UART_1 );
+
+//! the other side of the bridge.
+static UART_HANDLE uh2;
+static SIM_PEER peer2;
+static UART_BRIDGE br, br2;
+
+UART_ISR( &uh2, UART_2 );
+
+static volatile uint8_t rts_level;
+static int n_rts_off;
+
+//! RTS and CTS pin components.
+void RTS_Write(uint8 value)
+{
+  if( value && !rts_level ) n_rts_off++;
+  rts_level = value;
+}
+
+uint8 CTS_Read(void)
+{
+  return peer.cts;
+}
+#endif
+
+
+/***** Local functions ******************************************************/
+
+static void setup(int mode)
+{
+  sim_reset();
+  sim_peer_init(&peer, 0);
+  TEST_UART_INIT(&uh);
+#if defined(TEST_UART2)
+  if( mode & UART_XONXOFF ) uart_init_xonxoff(&uh, &flow);
+#else
+  uart_set_mode(&uh, mode);
+#endif
+}
+
+static int peer_received(void *arg)
+{
+  return peer.received >= *(uint32_t *)arg;
+}
+
+
+//================================================================
+/*! the peer sends at full rate, and main reads slower.
+*/
+static void sustained(void)
+{
+  enum { N_BYTES = 20000 };
+  uint8_t buf[16];
+  uint32_t total = 0;
+  int err = 0;
+
+  peer.lag = SIM_FIFO_SIZE;
+  peer.to_send = N_BYTES;
+
+  // read 16 bytes per 40 character times.
+  while( total < N_BYTES && sim_time < SIM_CHAR_TIME * N_BYTES * 4 ) {
+    int n = uart_read_nonblock(&uh, buf, sizeof(buf));
+    err += sim_peer_check(buf, n, total);
+    total += n;
+    sim_run(SIM_CHAR_TIME * 40);
+  }
+  sim_run(SIM_CHAR_TIME * 2);
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(total, N_BYTES);
+  CHECK_EQ(err, 0);
+  CHECK_EQ(st.rx_overflow, 0);
+  CHECK_EQ(st.rx_overrun, 0);
+  CHECK(!uart_is_rx_overflow(&uh));
+}
+
+static void test_xonxoff_sustained(void)
+{
+  setup(UART_XONXOFF);
+  sustained();
+  CHECK(peer.n_xoff > 10);
+  CHECK_EQ(peer.n_xon, peer.n_xoff);
+  CHECK(!peer.xoff);
+}
+
+
+//================================================================
+/*! XOFF at the high watermark, XON at the low watermark, and not between.
+*/
+static void test_xonxoff_hysteresis(void)
+{
+  uint8_t buf[UART_SIZE_RXFIFO];
+
+  setup(UART_XONXOFF);
+  uart_set_rx_watermark(&uh, HIGH, LOW);
+  peer.to_send = 100000;
+
+  // no XOFF below the high watermark.
+  sim_run(SIM_CHAR_TIME * (HIGH - 1));
+  CHECK_EQ(peer.n_xoff, 0);
+
+  // the peer stops, 1 byte is in flight while XOFF is sent.
+  sim_run(SIM_CHAR_TIME * 100);
+  CHECK_EQ(peer.n_xoff, 1);
+  CHECK(peer.xoff_at <= HIGH + 1);
+  CHECK(uart_bytes_available(&uh) <= HIGH + 1);
+
+  // no XON above the low watermark.
+  uint32_t total = 0;
+  while( uart_bytes_available(&uh) > LOW + 1 ) {
+    total += uart_read_nonblock(&uh, buf, 1);
+    sim_run(SIM_CHAR_TIME * 2);
+  }
+  CHECK_EQ(peer.n_xon, 0);
+  total += uart_read_nonblock(&uh, buf, 1);
+  sim_run(SIM_CHAR_TIME * 2);
+  CHECK_EQ(peer.n_xon, 1);
+
+  // the peer restarts, and no XOFF until the high watermark again.
+  sim_run(SIM_CHAR_TIME * (HIGH - LOW - 4));
+  CHECK_EQ(peer.n_xoff, 1);
+  sim_run(SIM_CHAR_TIME * 10);
+  CHECK_EQ(peer.n_xoff, 2);
+
+  // all data in sequence.
+  int n = uart_read_nonblock(&uh, buf, sizeof(buf));
+  CHECK_EQ(sim_peer_check(buf, n, total), 0);
+  CHECK_EQ(total + n, peer.sent);
+}
+
+
+//================================================================
+/*! the peer ignores XOFF. rxfifo overflows, but it is counted and recovers.
+*/
+static void test_xonxoff_ignored(void)
+{
+  enum { N_BYTES = 500 };
+  uint8_t buf[UART_SIZE_RXFIFO];
+
+  setup(UART_XONXOFF);
+  peer.obey = 0;
+  peer.to_send = N_BYTES;
+  sim_run(SIM_CHAR_TIME * (N_BYTES + 10));
+
+  // XOFF once, not for every byte.
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(peer.n_xoff, 1);
+  CHECK(uart_is_rx_overflow(&uh));
+  CHECK_EQ(st.rx_overflow, N_BYTES - RX_CAPACITY);
+  CHECK_EQ(st.rx_overrun, 0);
+
+  // the oldest bytes are kept, and XON after reading.
+  CHECK_EQ(uart_read_nonblock(&uh, buf, sizeof(buf)), RX_CAPACITY);
+  CHECK_EQ(sim_peer_check(buf, RX_CAPACITY, 0), 0);
+  sim_run(SIM_CHAR_TIME * 2);
+  CHECK_EQ(peer.n_xon, 1);
+
+  // continues after the gap.
+  peer.to_send = 10;
+  sim_run(SIM_CHAR_TIME * 12);
+  CHECK_EQ(uart_read_nonblock(&uh, buf, sizeof(buf)), 10);
+  CHECK_EQ(sim_peer_check(buf, 10, N_BYTES), 0);
+}
+
+
+//================================================================
+/*! XOFF from the peer pauses Tx, and XON restarts it.
+*/
+static void test_xonxoff_tx_pause(void)
+{
+  uint8_t data[300];
+  uint32_t target = 50;
+
+  setup(UART_XONXOFF);
+  for( int i = 0; i < sizeof(data); i++ ) data[i] = sim_peer_data(i);
+
+  uart_write(&uh, data, 100);
+  CHECK_EQ(sim_run_until(peer_received, &target, SIM_CHAR_TIME * 100), 0);
+  sim_peer_send_ctrl(&peer, UART_XOFF);
+
+  // bytes in the hardware FIFO and the shift register are sent.
+  sim_run(SIM_CHAR_TIME * 20);
+  uint32_t received = peer.received;
+  CHECK(received <= target + 1 + SIM_FIFO_SIZE + 1);
+  sim_run(SIM_CHAR_TIME * 200);
+  CHECK_EQ(peer.received, received);
+  CHECK(!uart_is_write_finished(&uh));
+
+  // XOFF to the peer is sent while Tx is paused.
+  peer.to_send = 1000;
+  sim_run(SIM_CHAR_TIME * 200);
+  CHECK_EQ(peer.n_xoff, 1);
+  CHECK_EQ(peer.received, received);
+  CHECK(peer.sent < RX_CAPACITY);
+
+  // XON restarts, and txfifo is written meanwhile.
+  sim_peer_send_ctrl(&peer, UART_XON);
+  uart_write(&uh, data + 100, 200);
+  target = sizeof(data);
+  CHECK_EQ(sim_run_until(peer_received, &target, SIM_CHAR_TIME * 1000), 0);
+  CHECK_EQ(peer.rx_error, 0);
+  CHECK_EQ(sim_uart[0].tx_lost, 0);
+}
+
+
+#if defined(TEST_UART2)
+//================================================================
+/*! RTS stops the peer, at full rate.
+*/
+static void test_rtscts_sustained(void)
+{
+  setup(0);
+  n_rts_off = 0;
+  uart_init_rtscts(&uh, &flow, RTS, CTS);
+  peer.rts = &rts_level;
+  sustained();
+  CHECK(n_rts_off > 10);
+  CHECK_EQ(rts_level, 0);
+}
+
+
+//================================================================
+/*! RTS hysteresis.
+*/
+static void test_rtscts_hysteresis(void)
+{
+  uint8_t buf[1];
+
+  setup(0);
+  n_rts_off = 0;
+  uart_init_rtscts(&uh, &flow, RTS, CTS);
+  uart_set_rx_watermark(&uh, HIGH, LOW);
+  peer.rts = &rts_level;
+  peer.to_send = 100000;
+
+  sim_run(SIM_CHAR_TIME * (HIGH - 1));
+  CHECK_EQ(rts_level, 0);
+  sim_run(SIM_CHAR_TIME * 2);
+  CHECK_EQ(rts_level, 1);
+  sim_run(SIM_CHAR_TIME * 100);
+  CHECK_EQ(uart_bytes_available(&uh), HIGH);
+
+  while( uart_bytes_available(&uh) > LOW + 1 ) {
+    uart_read_nonblock(&uh, buf, 1);
+    CHECK_EQ(rts_level, 1);
+  }
+  uart_read_nonblock(&uh, buf, 1);
+  CHECK_EQ(rts_level, 0);
+  sim_run(SIM_CHAR_TIME * (HIGH - LOW - 2));
+  CHECK_EQ(n_rts_off, 1);
+}
+
+
+//================================================================
+/*! CTS pauses Tx.
+*/
+static void test_rtscts_tx_pause(void)
+{
+  uint8_t data[100];
+  uint32_t target = 30;
+
+  setup(0);
+  uart_init_rtscts(&uh, &flow, RTS, CTS);
+  for( int i = 0; i < sizeof(data); i++ ) data[i] = sim_peer_data(i);
+
+  uart_write(&uh, data, sizeof(data));
+  CHECK_EQ(sim_run_until(peer_received, &target, SIM_CHAR_TIME * 100), 0);
+  peer.cts = 1;
+  sim_run(SIM_CHAR_TIME * 200);
+  CHECK(peer.received <= target + SIM_FIFO_SIZE + 1);
+  CHECK(peer.received < sizeof(data));
+
+  peer.cts = 0;
+  uart_cts_changed(&uh);
+  target = sizeof(data);
+  CHECK_EQ(sim_run_until(peer_received, &target, SIM_CHAR_TIME * 200), 0);
+  CHECK_EQ(peer.rx_error, 0);
+}
+
+
+//================================================================
+/*! XON/XOFF of a bridge destination is sent between the bridged data.
+*/
+static void test_xonxoff_bridge(void)
+{
+  enum { N_BYTES = 3000 };
+  uint8_t buf[UART_SIZE_RXFIFO];
+
+  setup(UART_XONXOFF);
+  sim_peer_init(&peer2, 1);
+  uart_init(&uh2, UART_2);
+  uart_init_bridge(&uh, &br);
+  uart_init_bridge(&uh2, &br2);
+  CHECK_EQ(uart_bridge(&uh2, &uh), 0);
+
+  // Tx of UART_1 is kept busy by the bridge, while its Rx fills up.
+  peer2.to_send = N_BYTES;
+  peer.to_send = 100000;
+  sim_run(SIM_CHAR_TIME * 300);
+  CHECK_EQ(peer.n_xoff, 1);
+  CHECK(peer.xoff);
+  CHECK(!sim_uart_tx_idle(0));
+
+  // XON after reading, still while bridging.
+  uint32_t total = 0;
+  while( uart_bytes_available(&uh) > 0 ) {
+    int n = uart_read_nonblock(&uh, buf, sizeof(buf));
+    CHECK_EQ(sim_peer_check(buf, n, total), 0);
+    total += n;
+  }
+  sim_run(SIM_CHAR_TIME * 10);
+  CHECK_EQ(peer.n_xon, 1);
+  CHECK(!peer.xoff);
+  CHECK(!sim_uart_tx_idle(0));
+
+  // all data bridged, and XON/XOFF didn't break the sequence.
+  sim_run(SIM_CHAR_TIME * (N_BYTES + 10));
+  CHECK_EQ(peer.received, N_BYTES);
+  CHECK_EQ(peer.rx_error, 0);
+  CHECK_EQ(br.bytes, N_BYTES);
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(st.rx_overflow, 0);
+  CHECK_EQ(sim_uart[0].tx_lost, 0);
+  uart_bridge_stop(&uh2);
+}
+#endif
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_xonxoff_sustained();
+  test_xonxoff_hysteresis();
+  test_xonxoff_ignored();
+  test_xonxoff_tx_pause();
+#if defined(TEST_UART2)
+  test_rtscts_sustained();
+  test_rtscts_hysteresis();
+  test_rtscts_tx_pause();
+  test_xonxoff_bridge();
+#endif
+
+  return TEST_MAIN_RESULT();
+}
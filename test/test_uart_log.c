@@ -0,0 +1,177 @@
+/*! @file
+  @brief
+  Host test of uart_log and its decoder, and size comparison with text.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  Records are sent by UART_LOG through UART_1, and the Tx line is
+  captured into a file. uart_log_decode.py expands it with the format
+  strings in this executable, and the output must be the same as
+  snprintf of each record. The bytes on the wire are compared with
+  the text.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+#include <stdlib.h>
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+#include "uart_log.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define CAPTURE_FILE    "test_uart_log.bin"
+#define DECODER         "../uart_log/uart_log_decode.py"
+
+
+/***** Macros ***************************************************************/
+//! log a record, and make the expected text.
+#define LOG(fmt, ...)                                                   \
+  do {                                                                  \
+    UART_LOG(&uh, fmt, ##__VA_ARGS__);                                  \
+    text_len += snprintf(text + text_len, sizeof(text) - text_len,      \
+                         fmt "\n", ##__VA_ARGS__);                      \
+  } while( 0 )
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static uint8_t txbuf[1024];
+
+UART_ISR( &uh, UART_1 );
+
+static uint8_t line[4096];              //!< captured Tx line.
+static int line_len;
+static char text[4096];                 //!< expected output.
+static int text_len;
+
+
+/***** Local functions ******************************************************/
+
+static void line_sink(void *arg, uint8_t ch)
+{
+  if( line_len < sizeof(line) ) line[line_len++] = ch;
+}
+
+static int tx_idle(void *arg)
+{
+  return sim_uart_tx_idle(0) && uart_is_write_finished(&uh);
+}
+
+static void setup(void)
+{
+  sim_reset();
+  uart_init_tx_buffer(&uh, UART_1, txbuf, sizeof(txbuf));
+  sim_uart[0].sink = line_sink;
+  line_len = 0;
+  text_len = 0;
+  uart_log_dropped = 0;
+}
+
+static void flush(void)
+{
+  CHECK_EQ(sim_run_until(tx_idle, 0, SIM_CHAR_TIME * (sizeof(txbuf) + 10)), 0);
+}
+
+
+//================================================================
+/*! expand the capture by the decoder, and compare with the text.
+*/
+static void check_decoded(const char *argv0)
+{
+  static char out[sizeof(text)];
+  char cmd[256];
+
+  FILE *fp = fopen(CAPTURE_FILE, "wb");
+  fwrite(line, 1, line_len, fp);
+  fclose(fp);
+
+  snprintf(cmd, sizeof(cmd), "python3 " DECODER " %s " CAPTURE_FILE, argv0);
+  fp = popen(cmd, "r");
+  int n = fread(out, 1, sizeof(out) - 1, fp);
+  int status = pclose(fp);
+  out[n > 0 ? n : 0] = '\0';
+  remove(CAPTURE_FILE);
+
+  CHECK_EQ(status, 0);
+  if( strcmp(out, text) != 0 ) {
+    printf("  decoded:\n%s  expected:\n%s", out, text);
+  }
+  CHECK(strcmp(out, text) == 0);
+}
+
+
+//================================================================
+/*! arguments at the limits of each varint length, and of 32 bit.
+*/
+static void test_values(const char *argv0)
+{
+  static const int32_t values[] = {
+    0, 1, -1, 63, -64, 64, -65, 8191, -8192, 8192, 1048575, -1048576,
+    134217727, -134217728, 134217728, INT32_MAX, INT32_MIN,
+  };
+
+  setup();
+  LOG("start");
+  for( int i = 0; i < sizeof(values) / sizeof(values[0]); i++ ) {
+    int32_t v = values[i];
+    LOG("%d %u %x %08X", v, (unsigned)v, (unsigned)v, (unsigned)v);
+  }
+  LOG("%c%c %5d|%-5d|%%", 'o', 'k', 42, -42);
+  LOG("8 args %d %d %d %d %d %d %d %d", 1, -2, 300, -40000, 5000000, -600000000, 7, 0);
+  flush();
+
+  CHECK_EQ(uart_log_dropped, 0);
+  check_decoded(argv0);
+}
+
+
+//================================================================
+/*! typical records, bytes on the wire and as text.
+*/
+static void test_size(const char *argv0, int bench)
+{
+  int temp = 253, adc = 0x1f3;
+
+  setup();
+  for( int i = 0; i < 20; i++ ) {
+    LOG("temp=%d.%d adc=0x%04x", temp / 10, temp % 10, adc);
+    LOG("state %d -> %d, err=%d t=%u", i % 4, (i + 1) % 4, -i, 1000 + i * 37);
+    temp += (i % 2) ? 7 : -5;
+    adc += 3;
+  }
+  flush();
+  check_decoded(argv0);
+
+  // text with CR LF, as uart_printf() would send.
+  int text_bytes = text_len + 40;
+  CHECK(line_len * 2 < text_bytes);
+  if( bench ) {
+    printf("40 records: uart_log %d bytes, text %d bytes (%.1fx)\n",
+           line_len, text_bytes, (double)text_bytes / line_len);
+  }
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  int bench = (argc > 1 && strcmp(argv[1], "bench") == 0);
+
+  test_values(argv[0]);
+  test_size(argv[0], bench);
+
+  return TEST_MAIN_RESULT();
+}
@@ -0,0 +1,304 @@
+/*! @file
+  @brief
+  Host stress test of uart_rx_peek / uart_rx_consume with Rx ISR traffic.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  Built for uart.c, and for uart2.c with TEST_UART2.
+
+  A timer signal standing in for the Rx ISR fills rxfifo as long as it
+  has space, while main reads by peek/consume and by uart_gets().
+  rxfifo is read protected at times during uart_rx_consume(), and the
+  SIGSEGV handler runs the ISR in the middle of the consume, as the
+  ISR preempting it on the target.
+
+  After each read, the delimiter count must match the delimiters left
+  in rxfifo. Otherwise uart_can_read_line() returns a wrong answer, or
+  a line is cut at a wrong position.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/***** Local headers ********************************************************/
+#if defined(TEST_UART2)
+# include "uart2.h"
+#else
+# include "uart.h"
+#endif
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#if defined(TEST_UART2)
+# define RX_SIZE        200
+#else
+# define RX_SIZE        UART_SIZE_RXFIFO
+#endif
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE *uh;
+static size_t page_size;
+static volatile uint8_t *rxfifo;        // rxfifo, at the top of a page.
+
+#if defined(TEST_UART2)
+static uint8_t txbuf[64];
+static UART_HANDLE uh_;
+
+UART_ISR( &uh_, UART_1 );
+#endif
+
+static volatile uint32_t n_fed;         // bytes given to the Rx ISR.
+static uint32_t n_read;                 // bytes read by main.
+static uint32_t n_in_consume;           // ISR run in uart_rx_consume().
+static uint32_t n_lines;
+static uint32_t n_mismatch;             // delimiter count mismatches.
+static timer_t timer;
+
+
+/***** Local functions ******************************************************/
+
+//! the byte of the stream. '\n' at about 1/6.
+static uint8_t stream(uint32_t i)
+{
+  uint32_t h = i * 2654435761u;
+  h ^= h >> 15;
+  return (h % 6 == 0) ? '\n' : 'a' + (h >> 8) % 26;
+}
+
+
+//================================================================
+/*! the Rx ISR receives the stream, while rxfifo has space.
+*/
+static void rx_feed(void)
+{
+  while( 1 ) {
+    uint16_t space = uart_ring_space(uh->rx_rd, uh->rx_wr, RX_SIZE);
+    if( sim_uart[0].rx_n >= space || sim_uart[0].rx_n == SIM_FIFO_SIZE ) break;
+
+    sim_uart_rx(0, stream(n_fed), 0);
+    n_fed++;
+    sim_dispatch();
+  }
+}
+
+static void on_timer(int sig)
+{
+  static uint32_t last_read, n_stall;
+
+  rx_feed();
+
+  // a lost delimiter makes main spin. report it instead of hanging.
+  if( n_read != last_read ) {
+    last_read = n_read;
+    n_stall = 0;
+  } else if( ++n_stall > 100000 ) {
+    static const char msg[] = "test_uart_peek: main makes no progress.\n";
+    write(2, msg, sizeof(msg) - 1);
+    _exit(1);
+  }
+}
+
+//! main reads the protected rxfifo, in uart_rx_consume().
+static void on_segv(int sig)
+{
+  mprotect((void *)rxfifo, page_size, PROT_READ | PROT_WRITE);
+  n_in_consume++;
+  rx_feed();
+}
+
+
+//================================================================
+/*! the delimiter count matches rxfifo.
+*/
+static void check_delimiters(void)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+  uint16_t n = 0;
+  int first = -1;
+
+  for( uint16_t idx = uh->rx_rd; idx != uh->rx_wr; idx = uart_ring_add(idx, 1, RX_SIZE) ) {
+    if( rxfifo[uart_ring_pos(idx, RX_SIZE)] == uh->delimiter ) {
+      if( n++ == 0 ) first = idx;
+    }
+  }
+  if( (uint16_t)(uh->rx_delim_in - uh->rx_delim_out) != n ) n_mismatch++;
+  if( n > 0 && uh->rx_delim_pos != first ) n_mismatch++;
+  CyExitCriticalSection(interrupts);
+}
+
+
+//================================================================
+/*! setup UART_1 with rxfifo at the top of a page.
+*/
+static void setup(void)
+{
+  page_size = sysconf(_SC_PAGESIZE);
+  sim_reset();
+
+#if defined(TEST_UART2)
+  rxfifo = mmap(0, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uh = &uh_;
+  uart_init_buffer(uh, UART_1, (void *)rxfifo, RX_SIZE, txbuf, sizeof(txbuf));
+#else
+  // rxfifo is the last member of the handle.
+  uint8_t *mem = mmap(0, page_size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uh = (UART_HANDLE *)(mem + page_size - offsetof(UART_HANDLE, rxfifo));
+  rxfifo = (volatile uint8_t *)uh->rxfifo;
+  uart_init(uh);
+#endif
+  n_fed = n_read = n_in_consume = n_lines = n_mismatch = 0;
+}
+
+static void teardown(void)
+{
+#if defined(TEST_UART2)
+  munmap((void *)rxfifo, page_size);
+#else
+  munmap((uint8_t *)rxfifo - page_size, page_size * 2);
+#endif
+}
+
+
+//================================================================
+/*! start or stop the timer.
+*/
+static void timer_enable(int enable)
+{
+  if( enable ) {
+    sim_use_signals(1);
+
+    struct sigaction sa = { .sa_handler = on_timer };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, 0);
+
+    struct sigevent sev = { .sigev_notify = SIGEV_SIGNAL, .sigev_signo = SIGALRM };
+    struct itimerspec its = { .it_interval = { 0, 50000 }, .it_value = { 0, 50000 } };
+    timer_create(CLOCK_MONOTONIC, &sev, &timer);
+    timer_settime(timer, 0, &its, 0);
+  } else {
+    timer_delete(timer);
+    sim_use_signals(0);
+  }
+}
+
+
+//================================================================
+/*! peek and consume, and gets, with the Rx ISR running.
+*/
+static void test_concurrent(void)
+{
+  enum { N_BYTES = 300000 };
+  uint32_t seed = 1;
+  sigset_t sigs, old;
+
+  setup();
+  struct sigaction sa = { .sa_handler = on_segv };
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, 0);
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGALRM);
+  timer_enable(1);
+
+  while( n_read < N_BYTES ) {
+    seed = seed * 1103515245 + 12345;
+
+    if( (seed >> 16) % 4 == 0 ) {
+      // a line.
+      if( !uart_can_read_line(uh) ) continue;
+
+      char buf[RX_SIZE + 1];
+      int n = uart_gets(uh, buf, sizeof(buf));
+      CHECK(n > 0);
+      for( int i = 0; i < n; i++ ) {
+        if( (uint8_t)buf[i] != stream(n_read + i) ) n_mismatch++;
+      }
+      if( n > 0 && buf[n-1] != '\n' ) n_mismatch++;
+      n_read += n;
+      n_lines++;
+
+    } else {
+      // peek, and consume a part.
+      const uint8_t *p;
+      int n = uart_rx_peek(uh, &p);
+      if( n == 0 ) continue;
+
+      int k = 1 + (seed >> 8) % n;
+      for( int i = 0; i < k; i++ ) {
+        if( p[i] != stream(n_read + i) ) n_mismatch++;
+      }
+
+      // the ISR runs at the first access to rxfifo in the consume.
+      int protect = (seed >> 4) % 2;
+      if( protect ) {
+        sigprocmask(SIG_BLOCK, &sigs, &old);
+        mprotect((void *)rxfifo, page_size, PROT_NONE);
+      }
+      uart_rx_consume(uh, k);
+      if( protect ) {
+        mprotect((void *)rxfifo, page_size, PROT_READ | PROT_WRITE);
+        sigprocmask(SIG_SETMASK, &old, 0);
+      }
+      n_read += k;
+    }
+    check_delimiters();
+  }
+  timer_enable(0);
+  signal(SIGSEGV, SIG_DFL);
+
+  CHECK_EQ(n_mismatch, 0);
+  CHECK(n_lines > 1000);
+  CHECK(n_in_consume > 100);
+  CHECK_EQ(sim_uart[0].rx_overrun, 0);
+  teardown();
+}
+
+
+//================================================================
+/*! the count lost, it is corrected from rxfifo.
+*/
+static void test_lost_count(void)
+{
+  static const char data[] = "ab\ncd";
+
+  setup();
+  for( int i = 0; i < sizeof(data) - 1; i++ ) {
+    sim_uart_rx(0, data[i], 0);
+    sim_dispatch();
+  }
+  CHECK(uart_can_read_line(uh));
+
+  // one more delimiter counted than in rxfifo.
+  uh->rx_delim_in++;
+  uart_rx_consume(uh, 3);
+  CHECK_EQ(uart_can_read_line(uh), 0);
+  CHECK_EQ(uh->rx_delim_in, uh->rx_delim_out);
+  CHECK_EQ(uart_bytes_available(uh), 2);
+  teardown();
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_concurrent();
+  test_lost_count();
+
+  return TEST_MAIN_RESULT();
+}
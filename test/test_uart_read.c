@@ -0,0 +1,248 @@
+/*! @file
+  @brief
+  Host test of uart.c read path, and cycles/byte benchmark.
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "uart.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+//! usable bytes of rxfifo. (1 less than the size, unless UART_RING_POW2)
+#define RX_CAPACITY     uart_ring_space(0, 0, UART_SIZE_RXFIFO)
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static uint8_t feed_seq;        // next byte of the endless sequence.
+static int feed_on;
+
+
+/***** Local functions ******************************************************/
+
+//! peer sends the sequence 0,1,2... at full rate.
+static void feed_hook(void)
+{
+  if( feed_on && sim_time % SIM_CHAR_TIME == 0 ) sim_uart_rx(0, feed_seq++, 0);
+}
+
+//! peer sends bytes. (blocking)
+static void feed(const void *data, int size)
+{
+  const uint8_t *p = data;
+
+  while( size-- > 0 ) {
+    sim_uart_rx(0, *p++, 0);
+    sim_run(SIM_CHAR_TIME);
+  }
+}
+
+static void setup(void)
+{
+  sim_reset();
+  sim_add_hook(feed_hook);
+  feed_seq = 0;
+  feed_on = 0;
+  uart_init(&uh);
+}
+
+
+//================================================================
+/*! uart_read across the end of rxfifo.
+*/
+static void test_read_wrap(void)
+{
+  uint8_t data[UART_SIZE_RXFIFO * 2];
+  uint8_t buf[UART_SIZE_RXFIFO * 2];
+
+  setup();
+  for( int i = 0; i < sizeof(data); i++ ) data[i] = i * 7 + 1;
+
+  // move rx_rd near the end of rxfifo.
+  feed(data, 100);
+  CHECK_EQ(uart_bytes_available(&uh), 100);
+  CHECK_EQ(uart_read(&uh, buf, sizeof(buf)), 100);
+  CHECK(memcmp(buf, data, 100) == 0);
+
+  // the next read is split in 2 segments.
+  feed(data + 100, 90);
+  CHECK_EQ(uart_read(&uh, buf, 50), 50);
+  CHECK_EQ(uart_read(&uh, buf + 50, sizeof(buf)), 40);
+  CHECK(memcmp(buf, data + 100, 90) == 0);
+  CHECK_EQ(uart_bytes_available(&uh), 0);
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(st.rx_bytes, 190);
+  CHECK_EQ(st.rx_overflow, 0);
+}
+
+
+//================================================================
+/*! uart_read_block waits for the data arriving meanwhile.
+*/
+static void test_read_block(void)
+{
+  uint8_t buf[1000];
+
+  setup();
+  feed_on = 1;
+  CHECK_EQ(uart_read_block(&uh, buf, sizeof(buf)), sizeof(buf));
+  feed_on = 0;
+
+  int err = 0;
+  for( int i = 0; i < sizeof(buf); i++ ) {
+    if( buf[i] != (uint8_t)i ) err++;
+  }
+  CHECK_EQ(err, 0);
+  CHECK(!uart_is_rx_overflow(&uh));
+}
+
+
+//================================================================
+/*! uart_gets with the line across the end of rxfifo.
+*/
+static void test_gets(void)
+{
+  char buf[64];
+  static const char line[] = "0123456789abcdefghijklmnopqrstuvwxyz"
+                             "ABCDEFGHIJKLMN\n";
+
+  // move rx_rd near the end of rxfifo.
+  setup();
+  feed(line, 50);
+  feed(line, 50);
+  CHECK_EQ(uart_read(&uh, buf, sizeof(buf)), sizeof(buf));
+  CHECK_EQ(uart_read(&uh, buf, sizeof(buf)), 100 - sizeof(buf));
+
+  // the line is split in 2 segments, and longer than the buffer.
+  feed(line, strlen(line));
+  feed(line, 29);
+  CHECK_EQ(uart_gets(&uh, buf, 20), 19);
+  CHECK(strncmp(buf, line, 19) == 0);
+  CHECK_EQ(uart_gets(&uh, buf, sizeof(buf)), strlen(line) - 19);
+  CHECK(strcmp(buf, line + 19) == 0);
+  CHECK_EQ(uart_bytes_available(&uh), 29);
+
+  // the rest has no delimiter.
+  CHECK_EQ(uart_can_read_line(&uh), 0);
+  uart_read(&uh, buf, sizeof(buf));
+
+  feed("hello\r\nworld\n", 13);
+  CHECK_EQ(uart_can_read_line(&uh), 7);
+  CHECK_EQ(uart_gets(&uh, buf, sizeof(buf)), 7);
+  CHECK(strcmp(buf, "hello\r\n") == 0);
+  CHECK_EQ(uart_gets(&uh, buf, sizeof(buf)), 6);
+  CHECK(strcmp(buf, "world\n") == 0);
+  CHECK_EQ(uart_can_read_line(&uh), 0);
+}
+
+
+//================================================================
+/*! bytes beyond rxfifo are dropped and counted.
+*/
+static void test_overflow(void)
+{
+  uint8_t buf[UART_SIZE_RXFIFO * 2];
+
+  setup();
+  feed_on = 1;
+  sim_run(SIM_CHAR_TIME * 200);
+  feed_on = 0;
+  sim_run(SIM_CHAR_TIME);
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK(uart_is_rx_overflow(&uh));
+  CHECK_EQ(st.rx_bytes, 200);
+  CHECK_EQ(st.rx_overflow, 200 - uart_bytes_available(&uh));
+  CHECK_EQ(uart_read(&uh, buf, sizeof(buf)), RX_CAPACITY);
+  CHECK_EQ(buf[0], 0);
+  CHECK_EQ(buf[RX_CAPACITY - 1], RX_CAPACITY - 1);
+}
+
+
+//================================================================
+/*! copy loop of uart_read before the 2 segments memcpy. (reference)
+*/
+static int read_per_byte(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  uint8_t *buf = buffer;
+  size_t   cnt = size;
+  uint16_t rx_rd;
+
+  do {
+    rx_rd = uh->rx_rd;
+    *buf++ = uh->rxfifo[uart_ring_pos(rx_rd, sizeof(uh->rxfifo))];
+    rx_rd = uart_ring_add(rx_rd, 1, sizeof(uh->rxfifo));
+    uh->rx_rd = rx_rd;
+  } while( --cnt != 0 && rx_rd != uh->rx_wr );
+
+  return size - cnt;
+}
+
+
+//================================================================
+/*! cycles/byte of reading a full rxfifo. (before / after)
+*/
+static void bench_read(void)
+{
+  enum { N_LOOP = 200000 };
+  const int N_BYTES = RX_CAPACITY;
+  uint8_t buf[UART_SIZE_RXFIFO];
+  uint64_t t_before = 0, t_after = 0;
+
+  setup();
+  for( int loop = 0; loop < N_LOOP; loop++ ) {
+    uint16_t start = loop % UART_SIZE_RXFIFO;   // every wrap position.
+    uint64_t t0;
+
+    uh.rx_rd = start;
+    uh.rx_wr = uart_ring_add(start, N_BYTES, UART_SIZE_RXFIFO);
+    t0 = bench_cycles();
+    read_per_byte(&uh, buf, sizeof(buf));
+    t_before += bench_cycles() - t0;
+    BENCH_KEEP(buf);
+
+    uh.rx_rd = start;
+    uh.rx_wr = uart_ring_add(start, N_BYTES, UART_SIZE_RXFIFO);
+    t0 = bench_cycles();
+    uart_read_nonblock(&uh, buf, sizeof(buf));
+    t_after += bench_cycles() - t0;
+    BENCH_KEEP(buf);
+  }
+
+  printf("uart_read %d bytes: per byte loop %.2f, 2 segments memcpy %.2f cycles/byte\n",
+         N_BYTES, (double)t_before / N_LOOP / N_BYTES,
+         (double)t_after / N_LOOP / N_BYTES);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_read_wrap();
+  test_read_block();
+  test_gets();
+  test_overflow();
+
+  if( argc > 1 && strcmp(argv[1], "bench") == 0 ) bench_read();
+
+  return TEST_MAIN_RESULT();
+}
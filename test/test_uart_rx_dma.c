@@ -0,0 +1,214 @@
+/*! @file
+  @brief
+  Host test of uart.c DMA receive. (UART_RX_DMA)
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  The DMA stand-in writes rxfifo as a circular buffer by a TD chained
+  to itself, and rx_wr is derived from the transfer count of the
+  working TD. isr_UART_1_RxIdle runs every IDLE_PERIOD bit times.
+*/
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <string.h>
+
+/***** Local headers ********************************************************/
+#include "uart.h"
+#include "test.h"
+
+
+/***** Constant values ******************************************************/
+#define IDLE_PERIOD (SIM_CHAR_TIME * 10)
+
+
+/***** Global variables *****************************************************/
+TEST_DEFINE_GLOBALS();
+
+
+/***** Local variables ******************************************************/
+static UART_HANDLE uh;
+static uint8_t feed_seq;
+static int feed_left;           // num of bytes the peer sends.
+
+
+/***** Local functions ******************************************************/
+
+//! peer sends the sequence 0,1,2... at full rate.
+static void feed_hook(void)
+{
+  if( feed_left > 0 && sim_time % SIM_CHAR_TIME == 0 ) {
+    sim_uart_rx(0, feed_seq++, 0);
+    feed_left--;
+  }
+}
+
+static void feed(int n)
+{
+  feed_left = n;
+  while( feed_left > 0 ) sim_step();
+  sim_run(SIM_CHAR_TIME);
+}
+
+static void setup(void)
+{
+  sim_reset();
+  sim_add_hook(feed_hook);
+  sim_uart[0].idle_period = IDLE_PERIOD;
+  feed_seq = 0;
+  feed_left = 0;
+  uart_init(&uh);
+}
+
+
+//================================================================
+/*! stream through rxfifo many times, with odd read sizes.
+*/
+static void test_stream(void)
+{
+  uint8_t buf[100];
+  uint8_t expect = 0;
+  int total = 0, err = 0;
+
+  setup();
+  feed_left = 3000;
+  for( int i = 0; total < 3000; i++ ) {
+    int n = uart_read(&uh, buf, 1 + (i * 37) % sizeof(buf));
+    for( int j = 0; j < n; j++ ) {
+      if( buf[j] != expect++ ) err++;
+    }
+    total += n;
+  }
+  CHECK_EQ(total, 3000);
+  CHECK_EQ(err, 0);
+  CHECK(!uart_is_rx_overflow(&uh));
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(st.rx_bytes, 3000);
+  CHECK(st.rx_high_water < UART_SIZE_RXFIFO);
+}
+
+
+//================================================================
+/*! rx_wr is updated by reading, without waiting for the idle ISR.
+*/
+static void test_sync_on_read(void)
+{
+  uint8_t buf[16];
+
+  setup();
+  sim_uart[0].idle_period = 0;
+  feed(5);
+  CHECK_EQ(uh.rx_wr, 0);                        // not synchronized yet.
+  CHECK_EQ(uart_read_nonblock(&uh, buf, sizeof(buf)), 5);
+  CHECK_EQ(buf[4], 4);
+
+  // the transfer count wraps exactly at the end of rxfifo.
+  feed(UART_SIZE_RXFIFO - 5);
+  CHECK_EQ(uart_read_nonblock(&uh, buf, sizeof(buf)), sizeof(buf));
+  CHECK_EQ(buf[0], 5);
+  int n, last = -1;
+  while( (n = uart_read_nonblock(&uh, buf, sizeof(buf))) > 0 ) last = buf[n - 1];
+  CHECK_EQ(last, UART_SIZE_RXFIFO - 1);
+  feed(3);
+  CHECK_EQ(uart_read_nonblock(&uh, buf, sizeof(buf)), 3);
+  CHECK_EQ(buf[0], (uint8_t)UART_SIZE_RXFIFO);
+}
+
+
+//================================================================
+/*! lines and delimiters counted from the DMA written data.
+*/
+static void test_gets(void)
+{
+  char buf[32];
+  static const char text[] = "first line\nsecond\n\nlast";
+
+  setup();
+  for( int i = 0; i < 4; i++ ) {
+    for( const char *p = text; *p; p++ ) {
+      sim_uart_rx(0, *p, 0);
+      sim_run(SIM_CHAR_TIME);
+    }
+    sim_run(IDLE_PERIOD);
+
+    CHECK_EQ(uart_can_read_line(&uh), 11);
+    CHECK_EQ(uart_gets(&uh, buf, sizeof(buf)), 11);
+    CHECK(strcmp(buf, "first line\n") == 0);
+    CHECK_EQ(uart_gets(&uh, buf, sizeof(buf)), 7);
+    CHECK(strcmp(buf, "second\n") == 0);
+    CHECK_EQ(uart_gets(&uh, buf, sizeof(buf)), 1);
+    CHECK_EQ(uart_can_read_line(&uh), 0);
+    CHECK_EQ(uart_read(&uh, buf, sizeof(buf)), 4);
+    CHECK(memcmp(buf, "last", 4) == 0);
+  }
+}
+
+
+//================================================================
+/*! DMA overwrites unread data. rx_wr re-synchronizes with rx_rd.
+*/
+static void test_overwrite(void)
+{
+  uint8_t buf[UART_SIZE_RXFIFO];
+
+  setup();
+  feed(300);
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK(uart_is_rx_overflow(&uh));
+
+  // the latest bytes after the position of rx_rd are readable.
+  int n = uart_read_nonblock(&uh, buf, sizeof(buf));
+  CHECK_EQ(n, 300 % UART_SIZE_RXFIFO);
+  CHECK_EQ(st.rx_overflow, 300 - n);    // bytes, not resync events.
+  CHECK_EQ(buf[0], (uint8_t)(300 - n));
+  CHECK_EQ(buf[n - 1], (uint8_t)299);
+
+  // and continues normally.
+  uart_clear_rx_buffer(&uh);
+  CHECK(!uart_is_rx_overflow(&uh));
+  feed(10);
+  CHECK_EQ(uart_read_nonblock(&uh, buf, sizeof(buf)), 10);
+  CHECK_EQ(buf[0], (uint8_t)300);
+}
+
+
+//================================================================
+/*! error status is counted by the idle ISR.
+*/
+static void test_errors(void)
+{
+  setup();
+  sim_uart_rx(0, 'a', SIM_RX_STS_STOP_ERROR);
+  sim_run(IDLE_PERIOD);
+  sim_uart_rx(0, 'b', SIM_RX_STS_PAR_ERROR | SIM_RX_STS_BREAK);
+  sim_run(IDLE_PERIOD);
+
+  UART_STATISTICS st;
+  uart_get_statistics(&uh, &st);
+  CHECK_EQ(st.rx_framing_error, 1);
+  CHECK_EQ(st.rx_parity_error, 1);
+  CHECK_EQ(st.rx_break, 1);
+  CHECK_EQ(uart_bytes_available(&uh), 2);
+}
+
+
+/***** Global functions *****************************************************/
+int main(int argc, char *argv[])
+{
+  test_stream();
+  test_sync_on_read();
+  test_gets();
+  test_overwrite();
+  test_errors();
+
+  return TEST_MAIN_RESULT();
+}
@@ -21,7 +21,18 @@
 #include "uart.h"
 
 /***** Constant values ******************************************************/
+#if defined(UART_RX_DMA) && UART_SIZE_RXFIFO > 4095
+# error "UART_SIZE_RXFIFO must be 4095 or less. (DMA TD transfer count)"
+#endif
+
+
 /***** Macros ***************************************************************/
+
+//! Rx status bits counted as error.
+#define UART_RX_STS_ERRORS (UART_1_RX_STS_OVERRUN | UART_1_RX_STS_STOP_ERROR | \
+                            UART_1_RX_STS_PAR_ERROR | UART_1_RX_STS_BREAK)
+
+
 /***** Typedefs *************************************************************/
 /***** Function prototypes **************************************************/
 int uart_check_timeout(void);
@@ -34,6 +45,370 @@ void uart_stop_timeout(void);
 //! set pointer of UART_HANDE for communicate interrupt handler.
 static UART_HANDLE *p_uart_handle;
 
+#if defined(UART_RX_DMA)
+static uint8_t rx_dma_ch;       //!< DMA channel for receive.
+static uint8_t rx_dma_td;       //!< DMA TD for receive.
+#endif
+
+
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! move data from txfifo to the hardware FIFO.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Call this from Tx ISR, or in critical section when hardware FIFO is empty.
+*/
+static void uart_tx_fill(UART_HANDLE *uh)
+{
+  uint16_t tx_rd = uh->tx_rd;
+  uint16_t tx_wr = uh->tx_wr;
+  uint16_t n     = uart_ring_count(tx_rd, tx_wr, sizeof(uh->txfifo));
+  uint8_t  sent  = 0;
+
+  // XON/XOFF is sent ahead of txfifo.
+  if( uh->tx_ctrl ) {
+    UART_1_WriteTxData( uh->tx_ctrl );
+    uh->tx_ctrl = 0;
+    sent = 1;
+  }
+
+  // pause while XOFF received.
+  if( n != 0 && uh->tx_xoff ) {
+    uh->tx_flow_wait = 1;
+    return;
+  }
+
+  if( n > UART_1_TX_BUFFER_SIZE - sent ) n = UART_1_TX_BUFFER_SIZE - sent;
+  for( ; n > 0; n-- ) {
+    UART_1_WriteTxData( uh->txfifo[uart_ring_pos(tx_rd, sizeof(uh->txfifo))] );
+    tx_rd = uart_ring_add(tx_rd, 1, sizeof(uh->txfifo));
+  }
+  uh->tx_rd = tx_rd;
+
+  if( tx_rd == tx_wr ) uh->flag_tx_finished = 1;
+}
+
+
+//================================================================
+/*! start transmit if Tx ISR is idle.
+
+  @param  uh            Pointer of UART_HANDLE.
+*/
+static void uart_tx_kick(UART_HANDLE *uh)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+
+  if( uh->flag_tx_finished && uh->tx_rd != uh->tx_wr ) {
+    uh->flag_tx_finished = 0;
+
+    // if hardware FIFO is not empty, FIFO empty interrupt will occur later.
+    if( UART_1_ReadTxStatus() & UART_1_TX_STS_FIFO_EMPTY ) uart_tx_fill(uh);
+  }
+
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! update high-water mark of rxfifo.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Call this from ISR, or in critical section.
+*/
+static void uart_rx_high_water(UART_HANDLE *uh)
+{
+  uint16_t n = uart_ring_count(uh->rx_rd, uh->rx_wr, sizeof(uh->rxfifo));
+
+  if( n > uh->stat.rx_high_water ) uh->stat.rx_high_water = n;
+}
+
+
+//================================================================
+/*! count receive errors.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  sts           Rx status.
+*/
+static void uart_rx_error_count(UART_HANDLE *uh, uint8_t sts)
+{
+  if( sts & UART_1_RX_STS_OVERRUN )    uh->stat.rx_overrun++;
+  if( sts & UART_1_RX_STS_STOP_ERROR ) uh->stat.rx_framing_error++;
+  if( sts & UART_1_RX_STS_PAR_ERROR )  uh->stat.rx_parity_error++;
+  if( sts & UART_1_RX_STS_BREAK )      uh->stat.rx_break++;
+}
+
+
+//================================================================
+/*! send XON/XOFF ahead of txfifo.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  ch            UART_XON or UART_XOFF.
+*/
+static void uart_tx_ctrl(UART_HANDLE *uh, uint8_t ch)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+
+  // write directly if Tx ISR is idle, otherwise Tx ISR sends it.
+  if( (uh->flag_tx_finished || uh->tx_flow_wait) &&
+      (UART_1_ReadTxStatus() & UART_1_TX_STS_FIFO_EMPTY) ) {
+    UART_1_WriteTxData( ch );
+  } else {
+    uh->tx_ctrl = ch;
+  }
+
+  CyExitCriticalSection( interrupts );
+}
+
+
+#if !defined(UART_RX_DMA)
+//================================================================
+/*! XON/XOFF received.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  ch            UART_XON or UART_XOFF.
+  @note
+    Call this from Rx ISR.
+*/
+static void uart_tx_xonxoff(UART_HANDLE *uh, uint8_t ch)
+{
+  if( ch == UART_XOFF ) {
+    uh->tx_xoff = 1;
+    return;
+  }
+
+  uh->tx_xoff = 0;
+  if( uh->tx_flow_wait ) {
+    uh->tx_flow_wait = 0;
+    if( UART_1_ReadTxStatus() & UART_1_TX_STS_FIFO_EMPTY ) uart_tx_fill(uh);
+  }
+}
+#endif
+
+
+//================================================================
+/*! send XON, if rxfifo has enough space.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Call this after reading data out of rxfifo.
+*/
+static void uart_rx_flow_check(UART_HANDLE *uh)
+{
+  if( !uh->rx_flow_off ) return;
+
+  uint8 interrupts = CyEnterCriticalSection();
+  if( uart_ring_count(uh->rx_rd, uh->rx_wr, sizeof(uh->rxfifo)) <= uh->rx_flow_low ) {
+    uh->rx_flow_off = 0;
+    uart_tx_ctrl(uh, UART_XON);
+  }
+  CyExitCriticalSection( interrupts );
+}
+
+
+#if defined(UART_RX_DMA)
+//================================================================
+/*! update rx_wr from DMA transfer count.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Call this from ISR, or in critical section.
+*/
+static void uart_rx_dma_update(UART_HANDLE *uh)
+{
+  uint16_t count;
+  uint8_t  next_td, config;
+
+  // when preserveTds is set, the working TD is in the TD slot of channel number.
+  CyDmaTdGetConfiguration( rx_dma_ch, &count, &next_td, &config );
+
+  uint16_t dma_pos = sizeof(uh->rxfifo) - count;
+  if( dma_pos >= sizeof(uh->rxfifo) ) dma_pos = 0;
+
+  uint16_t idx = uh->rx_wr;
+  uint16_t pos = uart_ring_pos(idx, sizeof(uh->rxfifo));
+  if( pos == dma_pos ) return;
+
+  uint16_t n_new = (pos < dma_pos) ? dma_pos - pos : sizeof(uh->rxfifo) - pos + dma_pos;
+  uint16_t rx_wr;
+
+  uh->stat.rx_bytes += n_new;
+  if( n_new <= uart_ring_space(uh->rx_rd, idx, sizeof(uh->rxfifo)) ) {
+    rx_wr = uart_ring_add(idx, n_new, sizeof(uh->rxfifo));
+
+  } else {
+    // DMA overwrote unread data. re-synchronize with rx_rd.
+    // the unread and new bytes, less the bytes readable from rx_rd, are lost.
+    uint16_t n_lost = uart_ring_count(uh->rx_rd, idx, sizeof(uh->rxfifo)) + n_new;
+    uh->rx_overflow = 1;
+    idx = uh->rx_rd;
+    pos = uart_ring_pos(idx, sizeof(uh->rxfifo));
+    n_new = (pos <= dma_pos) ? dma_pos - pos : sizeof(uh->rxfifo) - pos + dma_pos;
+    rx_wr = uart_ring_add(idx, n_new, sizeof(uh->rxfifo));
+    uh->stat.rx_overflow += n_lost - n_new;
+    uh->rx_delim_in = uh->rx_delim_out;
+  }
+
+  // count delimiter, and keep the position of first one.
+  for( ; idx != rx_wr; idx = uart_ring_add(idx, 1, sizeof(uh->rxfifo)) ) {
+    if( uh->rxfifo[uart_ring_pos(idx, sizeof(uh->rxfifo))] == uh->delimiter ) {
+      if( uh->rx_delim_in == uh->rx_delim_out ) uh->rx_delim_pos = idx;
+      uh->rx_delim_in++;
+    }
+  }
+  uh->rx_wr = rx_wr;
+  uart_rx_high_water(uh);
+}
+#endif
+
+
+//================================================================
+/*! synchronize rx_wr with receive hardware.
+
+  @param  uh            Pointer of UART_HANDLE.
+*/
+static inline void uart_rx_sync(UART_HANDLE *uh)
+{
+#if defined(UART_RX_DMA)
+  uint8 interrupts = CyEnterCriticalSection();
+  uart_rx_dma_update(uh);
+  CyExitCriticalSection( interrupts );
+#endif
+}
+
+
+//================================================================
+/*! count delimiters in the data to be read out.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  p             Pointer of the data.
+  @param  size          Size of the data.
+  @return int           Num of delimiters.
+  @note
+    Call before rx_rd is updated. After that, Rx ISR may overwrite
+    the data in rxfifo.
+*/
+static int uart_rx_delimiter_count(UART_HANDLE *uh, const uint8_t *p, size_t size)
+{
+  // delimiter never included in the data if no delimiter in rxfifo.
+  if( uh->rx_delim_in == uh->rx_delim_out ) return 0;
+
+  const uint8_t *p_end = p + size;
+  int n = 0;
+
+  while( (p = memchr( p, uh->delimiter, p_end - p )) != 0 ) {
+    n++;
+    if( ++p >= p_end ) break;
+  }
+  return n;
+}
+
+
+//================================================================
+/*! count delimiters in rxfifo again.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Call in a critical section.
+*/
+static void uart_rx_delimiter_recount(UART_HANDLE *uh)
+{
+  uint16_t idx = uh->rx_rd;
+
+  uh->rx_delim_out = uh->rx_delim_in;
+  while( idx != uh->rx_wr ) {
+    if( uh->rxfifo[uart_ring_pos(idx, sizeof(uh->rxfifo))] == uh->delimiter ) {
+      if( uh->rx_delim_out == uh->rx_delim_in ) uh->rx_delim_pos = idx;
+      uh->rx_delim_out--;
+    }
+    idx = uart_ring_add(idx, 1, sizeof(uh->rxfifo));
+  }
+}
+
+
+//================================================================
+/*! update delimiter count after reading data out of rxfifo.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  n             Num of delimiters read out. (uart_rx_delimiter_count)
+*/
+static void uart_rx_delimiter_consumed(UART_HANDLE *uh, int n)
+{
+  if( n == 0 ) return;
+
+  uh->rx_delim_out += n;
+  if( uh->rx_delim_in == uh->rx_delim_out ) return;
+
+  // find the next delimiter, up to rx_wr.
+  uint16_t rx_wr = uh->rx_wr;
+  UART_RING_BARRIER();
+  for( uint16_t idx = uh->rx_rd; idx != rx_wr; idx = uart_ring_add(idx, 1, sizeof(uh->rxfifo)) ) {
+    if( uh->rxfifo[uart_ring_pos(idx, sizeof(uh->rxfifo))] == uh->delimiter ) {
+      uh->rx_delim_pos = idx;
+      return;
+    }
+  }
+
+  // the count does not match rxfifo. count again.
+  uint8 interrupts = CyEnterCriticalSection();
+  uart_rx_delimiter_recount(uh);
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! get length of a line in rxfifo.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @return int           length including the delimiter, or 0 if no line.
+*/
+static int uart_rx_line_length(UART_HANDLE *uh)
+{
+  if( uh->rx_delim_in == uh->rx_delim_out ) return 0;
+
+  return uart_ring_count(uh->rx_rd, uh->rx_delim_pos, sizeof(uh->rxfifo)) + 1;
+}
+
+
+//================================================================
+/*! copy rxfifo to buffer.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Num of copied bytes.
+  @note
+    Copy at most 2 contiguous segments, and update rx_rd only once.
+*/
+static int uart_rx_copy(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  uart_rx_sync(uh);
+
+  uint8_t *buf   = buffer;
+  uint16_t rx_rd = uh->rx_rd;
+  uint16_t pos   = uart_ring_pos(rx_rd, sizeof(uh->rxfifo));
+  size_t   n     = uart_ring_count(rx_rd, uh->rx_wr, sizeof(uh->rxfifo));
+  size_t   n1    = sizeof(uh->rxfifo) - pos;
+
+  if( n > size ) n = size;
+  if( n1 > n ) n1 = n;
+  UART_RING_BARRIER();
+
+  // 1st segment up to the end of rxfifo, and 2nd segment from the top.
+  memcpy( buf, (const char *)&uh->rxfifo[pos], n1 );
+  memcpy( buf + n1, (const char *)uh->rxfifo, n - n1 );
+  int n_delim = uart_rx_delimiter_count(uh, buf, n);
+
+  UART_RING_BARRIER();
+  uh->rx_rd = uart_ring_add(rx_rd, n, sizeof(uh->rxfifo));
+  uart_rx_delimiter_consumed(uh, n_delim);
+  uart_rx_flow_check(uh);
+
+  return n;
+}
+
 
 /***** Interrupt handler ****************************************************/
 
@@ -43,22 +418,14 @@ static UART_HANDLE *p_uart_handle;
 */
 CY_ISR(isr_UART_1_Tx)
 {
-  UART_HANDLE *uh = p_uart_handle;
-
   // clear Tx status register and check simply.
   if( !(UART_1_ReadTxStatus() & UART_1_TX_STS_FIFO_EMPTY) ) return;
 
-  uint16_t n = uh->size_txbuf - uh->tx_rd;
-  if( n > UART_1_TX_BUFFER_SIZE ) n = UART_1_TX_BUFFER_SIZE;
-
-  for( ; n > 0; n-- ) {
-    UART_1_WriteTxData( uh->p_txbuf[uh->tx_rd++] );
-  }
-
-  if( uh->tx_rd >= uh->size_txbuf ) uh->flag_tx_finished = 1;
+  uart_tx_fill( p_uart_handle );
 }
 
 
+#if !defined(UART_RX_DMA)
 //================================================================
 /*! Rx interrupt handler.
 
@@ -70,32 +437,62 @@ CY_ISR(isr_UART_1_Rx)
 
   for(; sts != 0; sts = UART_1_ReadRxStatus()) {
     if( sts & UART_1_RX_STS_FIFO_NOTEMPTY ) {
-      uh->rxfifo[uh->rx_wr++] = UART_1_ReadRxData();
+      uint8_t  ch    = UART_1_ReadRxData();
+      uint16_t rx_wr = uh->rx_wr;
 
-      // check rollover write index.
-      if( uh->rx_wr < sizeof(uh->rxfifo)) {
-        if( uh->rx_wr == uh->rx_rd ) {
-          --uh->rx_wr;   // buffer full
-	  uh->rx_overflow = 1;
-        }
-      }
-      else {
-        if( uh->rx_rd == 0 ) {
-          --uh->rx_wr;   // buffer full
-	  uh->rx_overflow = 1;
+      uh->stat.rx_bytes++;
+      if( (uh->mode & UART_XONXOFF) && (ch == UART_XON || ch == UART_XOFF) ) {
+        uart_tx_xonxoff(uh, ch);        // not stored in rxfifo.
+
+      } else if( uart_ring_space(uh->rx_rd, rx_wr, sizeof(uh->rxfifo)) == 0 ) {
+        uh->rx_overflow = 1;    // buffer full
+        uh->stat.rx_overflow++;
+
+      } else {
+        uh->rxfifo[uart_ring_pos(rx_wr, sizeof(uh->rxfifo))] = ch;
+
+        // count delimiter, and keep the position of first one.
+        if( ch == uh->delimiter ) {
+          if( uh->rx_delim_in == uh->rx_delim_out ) uh->rx_delim_pos = rx_wr;
+          uh->rx_delim_in++;
         }
-        else {
-          uh->rx_wr = 0; // roll over.
+        uh->rx_wr = uart_ring_add(rx_wr, 1, sizeof(uh->rxfifo));
+        uart_rx_high_water(uh);
+
+        // XON/XOFF flow control. (XON is sent in the reader side)
+        if( (uh->mode & UART_XONXOFF) && !uh->rx_flow_off &&
+            uart_ring_count(uh->rx_rd, uh->rx_wr, sizeof(uh->rxfifo)) >= uh->rx_flow_high ) {
+          uh->rx_flow_off = 1;
+          uart_tx_ctrl(uh, UART_XOFF);
         }
       }
     }
 
-    // and any more check other status?
+    // error status. (these bits are cleared by reading the status)
+    if( sts & UART_RX_STS_ERRORS ) uart_rx_error_count(uh, sts);
   }
 }
+#endif
+
+
+#if defined(UART_RX_DMA)
+//================================================================
+/*! Rx idle (periodic) interrupt handler for DMA receive.
+
+*/
+CY_ISR(isr_UART_1_RxIdle)
+{
+  UART_HANDLE *uh = p_uart_handle;
+  uint8_t sts     = UART_1_ReadRxStatus();
+
+  // error bits are sticky, so they are counted once per period at most.
+  if( sts & UART_RX_STS_ERRORS ) uart_rx_error_count(uh, sts);
+
+  uart_rx_dma_update( uh );
+}
+#endif
 
 
-/***** Local functions ******************************************************/
 /***** Global functions *****************************************************/
 
 //================================================================
@@ -107,15 +504,20 @@ CY_ISR(isr_UART_1_Rx)
 void uart_init(UART_HANDLE *uh)
 {
   *uh = (UART_HANDLE){
-    .p_txbuf          = 0,
-    .size_txbuf       = 0,
     .tx_rd            = 0,
+    .tx_wr            = 0,
     .flag_tx_finished = 1,
     .mode             = 0,
     .rx_overflow      = 0,
     .delimiter        = '\n',
     .rx_rd            = 0,
     .rx_wr            = 0,
+    .rx_delim_in      = 0,
+    .rx_delim_out     = 0,
+    .rx_delim_pos     = 0,
+    .stat             = {0},
+    .rx_flow_high     = sizeof(uh->rxfifo) * 3 / 4,
+    .rx_flow_low      = sizeof(uh->rxfifo) / 4,
   };
 
   p_uart_handle = uh;
@@ -124,7 +526,36 @@ void uart_init(UART_HANDLE *uh)
   UART_1_ClearTxBuffer();
   isr_UART_1_Tx_StartEx(isr_UART_1_Tx);
   UART_1_ClearRxBuffer();
+#if !defined(UART_RX_DMA)
   isr_UART_1_Rx_StartEx(isr_UART_1_Rx);
+#else
+  // Circular buffer, by a TD chained to itself.
+  rx_dma_ch = DMA_UART_1_Rx_DmaInitialize(1, 1, HI16(CYDEV_PERIPH_BASE), HI16(CYDEV_SRAM_BASE));
+  rx_dma_td = CyDmaTdAllocate();
+  CyDmaTdSetConfiguration(rx_dma_td, sizeof(uh->rxfifo), rx_dma_td, CY_DMA_TD_INC_DST_ADR);
+  CyDmaTdSetAddress(rx_dma_td, LO16((uint32)UART_1_RXDATA_PTR), LO16((uint32)uh->rxfifo));
+  CyDmaChSetInitialTd(rx_dma_ch, rx_dma_td);
+  CyDmaChEnable(rx_dma_ch, 1);
+  isr_UART_1_RxIdle_StartEx(isr_UART_1_RxIdle);
+#endif
+}
+
+
+//================================================================
+/*! set watermarks of XON/XOFF flow control.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  high          rxfifo bytes to send XOFF.
+  @param  low           rxfifo bytes to send XON.
+  @note
+    Default watermarks are 3/4 and 1/4 of rxfifo.
+    Leave room above high for the bytes the peer sends after XOFF.
+*/
+void uart_set_rx_watermark(UART_HANDLE *uh, uint16_t high, uint16_t low)
+{
+  uh->rx_flow_high = high;
+  uh->rx_flow_low  = low;
 }
 
 
@@ -136,7 +567,12 @@ void uart_init(UART_HANDLE *uh)
 */
 void uart_clear_tx_buffer(UART_HANDLE *uh)
 {
+  uint8 interrupts = CyEnterCriticalSection();
   UART_1_ClearTxBuffer();
+  uh->tx_rd = uh->tx_wr;
+  uh->tx_flow_wait = 0;
+  uh->flag_tx_finished = 1;
+  CyExitCriticalSection( interrupts );
 }
 
 
@@ -151,9 +587,20 @@ void uart_clear_rx_buffer(UART_HANDLE *uh)
   UART_1_ClearRxBuffer();
 
   uint8 interrupts = CyEnterCriticalSection();
+#if !defined(UART_RX_DMA)
   uh->rx_rd = 0;
   uh->rx_wr = 0;
+#else
+  uart_rx_dma_update(uh);
+  uh->rx_rd = uh->rx_wr;
+#endif
   uh->rx_overflow = 0;
+  uh->rx_delim_in = 0;
+  uh->rx_delim_out = 0;
+  if( uh->rx_flow_off ) {
+    uh->rx_flow_off = 0;
+    uart_tx_ctrl(uh, UART_XON);
+  }
   CyExitCriticalSection( interrupts );
 }
 
@@ -165,36 +612,52 @@ void uart_clear_rx_buffer(UART_HANDLE *uh)
   @param  uh            Pointer of UART_HANDLE.
   @param  buffer        Pointer of buffer.
   @param  size          Size of buffer.
-  @return               Size of transmitted.
+  @return               Size of queued bytes, or -1 if timeout.
+  @note
+    Data is copied into txfifo, so the buffer can be reused immediately.
+    If txfifo is full, it blocks execution until all data are queued.
+    (In UART_WRITE_NONBLOCK mode, returns the size that could be queued.)
 */
 int uart_write(UART_HANDLE *uh, const void *buffer, size_t size)
 {
-  if( !uh->flag_tx_finished ) return 0;  // TODO: or -1 ??
-  if( size == 0 ) return 0;
+  const uint8_t *buf = buffer;
+  size_t cnt = size;
+
+  while( 1 ) {
+    // copy buffer to fifo. (at most 2 segments)
+    uint16_t tx_wr = uh->tx_wr;
+    uint16_t pos   = uart_ring_pos(tx_wr, sizeof(uh->txfifo));
+    size_t   n     = uart_ring_space(uh->tx_rd, tx_wr, sizeof(uh->txfifo));
+    size_t   n1    = sizeof(uh->txfifo) - pos;
+
+    if( n > cnt ) n = cnt;
+    if( n1 > n ) n1 = n;
+    memcpy( (char *)&uh->txfifo[pos], buf, n1 );
+    memcpy( (char *)uh->txfifo, buf + n1, n - n1 );
+    buf += n;
+    cnt -= n;
 
-  uh->p_txbuf          = buffer;
-  uh->size_txbuf       = size;
-  uh->tx_rd            = 1;
-  uh->flag_tx_finished = 0;
+    UART_RING_BARRIER();
+    uh->tx_wr = uart_ring_add(tx_wr, n, sizeof(uh->txfifo));
+    uart_tx_kick(uh);
 
-  UART_1_WriteTxData( *(uint8_t *)buffer );	// send first byte.
-  if( uh->mode & UART_WRITE_NONBLOCK ) return 0;
+    if( cnt == 0 ) break;
+    if( uh->mode & UART_WRITE_NONBLOCK ) return size - cnt;
 
-  do {
+    // wait for space of fifo.
     CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
 #ifdef UART_CHECK_TIMEOUT
     if( uart_check_timeout()) {
       uart_stop_timeout();
-      uh->flag_tx_finished = 1;
       return -1;
     }
 #endif
-  } while( !uh->flag_tx_finished );
+  }
 
 #ifdef UART_CHECK_TIMEOUT
-  uart_stop_timeout();
+  if( !(uh->mode & UART_WRITE_NONBLOCK) ) uart_stop_timeout();
 #endif
-  return uh->tx_rd;
+  return size;
 }
 
 
@@ -214,7 +677,7 @@ int uart_read(UART_HANDLE *uh, void *buffer, size_t size)
   if( size == 0 ) return 0;
 
   // wait for data.
-  while( !uart_is_readable(uh) ) {
+  while( uart_bytes_available(uh) == 0 ) {
     CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
 #ifdef UART_CHECK_TIMEOUT
     if( uart_check_timeout()) {
@@ -225,21 +688,12 @@ int uart_read(UART_HANDLE *uh, void *buffer, size_t size)
   }
 
   // copy fifo to buffer
-  uint8_t *buf = buffer;
-  size_t   cnt = size;
-  uint16_t rx_rd;
-
-  do {
-    rx_rd = uh->rx_rd;
-    *buf++ = uh->rxfifo[rx_rd++];
-    if( rx_rd >= sizeof(uh->rxfifo) ) rx_rd = 0;
-    uh->rx_rd = rx_rd;
-  } while( --cnt != 0 && rx_rd != uh->rx_wr );
+  int n = uart_rx_copy(uh, buffer, size);
 
 #ifdef UART_CHECK_TIMEOUT
   uart_stop_timeout();
 #endif
-  return size - cnt;
+  return n;
 }
 
 
@@ -256,37 +710,44 @@ int uart_read(UART_HANDLE *uh, void *buffer, size_t size)
 */
 int uart_gets(UART_HANDLE *uh, char *buf, size_t size)
 {
+  char  *p   = buf;
   size_t cnt = size - 1;
 
-  while( 1 ) {
-    // wait for data.
-    if( !uart_is_readable(uh) ) {
-      CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
-#ifdef UART_CHECK_TIMEOUT
-      if( uart_check_timeout()) {
-        uart_stop_timeout();
-        *buf = '\0';
-        return -1;
-      }
-#endif
-      continue;
+  while( cnt > 0 ) {
+    // copy a line, if the delimiter was received.
+    int n = uart_rx_line_length(uh);
+    if( n > 0 ) {
+      if( n > cnt ) n = cnt;
+      p += uart_rx_copy(uh, p, n);
+      break;
     }
 
-    // copy fifo to buffer
-    uint16_t rx_rd = uh->rx_rd;
-    int ch = (*buf++ = uh->rxfifo[rx_rd++]);
-    if( rx_rd >= sizeof(uh->rxfifo)) rx_rd = 0;
-    uh->rx_rd = rx_rd;
+    // copy received data, which doesn't include the delimiter.
+    n = uart_bytes_available(uh);
+    if( n > 0 && uh->rx_delim_in == uh->rx_delim_out ) {
+      if( n > cnt ) n = cnt;
+      p += uart_rx_copy(uh, p, n);
+      cnt -= n;
+      continue;
+    }
+    if( n > 0 ) continue;
 
-    if( --cnt == 0 ) break;
-    if( ch == uh->delimiter ) break;
+    // wait for data.
+    CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
+#ifdef UART_CHECK_TIMEOUT
+    if( uart_check_timeout()) {
+      uart_stop_timeout();
+      *buf = '\0';
+      return -1;
+    }
+#endif
   }
-  *buf = '\0';
+  *p = '\0';
 
 #ifdef UART_CHECK_TIMEOUT
   uart_stop_timeout();
 #endif
-  return size - cnt - 1;
+  return p - buf;
 }
 
 
@@ -326,14 +787,60 @@ int uart_read_block(UART_HANDLE *uh, void *buffer, size_t size)
 */
 int uart_read_nonblock(UART_HANDLE *uh, void *buffer, size_t size)
 {
-  int n = uart_bytes_available(uh);
-  if( n > size ) n = size;
-  if( n != 0 ) uart_read(uh, buffer, n);
+  return uart_rx_copy(uh, buffer, size);
+}
+
+
+//================================================================
+/*! Peek received data without copy.
 
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  pp            Pointer to store the address of received data in rxfifo.
+  @return int           Num of contiguous readable bytes.
+  @note
+    Data is kept in rxfifo until uart_rx_consume() is called.
+    If data wraps around the end of rxfifo, only the first part is returned.
+    Call again after uart_rx_consume() to get the rest.
+*/
+int uart_rx_peek(UART_HANDLE *uh, const uint8_t **pp)
+{
+  uart_rx_sync(uh);
+
+  uint16_t rx_rd = uh->rx_rd;
+  uint16_t pos   = uart_ring_pos(rx_rd, sizeof(uh->rxfifo));
+  uint16_t n     = uart_ring_count(rx_rd, uh->rx_wr, sizeof(uh->rxfifo));
+
+  UART_RING_BARRIER();
+  *pp = (const uint8_t *)&uh->rxfifo[pos];
+
+  if( n > sizeof(uh->rxfifo) - pos ) n = sizeof(uh->rxfifo) - pos;
   return n;
 }
 
 
+//================================================================
+/*! Discard received data. (after uart_rx_peek)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  size          Num of bytes to discard. (<= return value of uart_rx_peek)
+*/
+void uart_rx_consume(UART_HANDLE *uh, size_t size)
+{
+  uint16_t rx_rd = uh->rx_rd;
+  const uint8_t *p = (const uint8_t *)&uh->rxfifo[uart_ring_pos(rx_rd, sizeof(uh->rxfifo))];
+
+  // count before the bytes are handed back to Rx ISR.
+  int n_delim = uart_rx_delimiter_count(uh, p, size);
+
+  UART_RING_BARRIER();
+  uh->rx_rd = uart_ring_add(rx_rd, size, sizeof(uh->rxfifo));
+  uart_rx_delimiter_consumed(uh, n_delim);
+  uart_rx_flow_check(uh);
+}
+
+
 //================================================================
 /*! check data length can be read.
 
@@ -343,14 +850,9 @@ int uart_read_nonblock(UART_HANDLE *uh, void *buffer, size_t size)
 */
 int uart_bytes_available(UART_HANDLE *uh)
 {
-  uint16_t rx_wr = uh->rx_wr;
+  uart_rx_sync(uh);
 
-  if( uh->rx_rd <= rx_wr ) {
-    return rx_wr - uh->rx_rd;
-  }
-  else {
-    return sizeof(uh->rxfifo) - uh->rx_rd + rx_wr;
-  }
+  return uart_ring_count(uh->rx_rd, uh->rx_wr, sizeof(uh->rxfifo));
 }
 
 
@@ -365,21 +867,41 @@ int uart_bytes_available(UART_HANDLE *uh)
 */
 int uart_can_read_line(UART_HANDLE *uh)
 {
-  uint16_t idx   = uh->rx_rd;
-  uint16_t rx_wr = uh->rx_wr;
+  uart_rx_sync(uh);
 
   if( uh->rx_overflow ) return -1;
 
-  while( idx != rx_wr ) {
-    if( uh->rxfifo[idx++] == uh->delimiter ) {
-      if( uh->rx_rd < idx ) {
-	return idx - uh->rx_rd;
-      } else {
-	return sizeof(uh->rxfifo) - uh->rx_rd + idx;
-      }
-    }
-    if( idx >= sizeof(uh->rxfifo)) idx = 0;
-  }
+  return uart_rx_line_length(uh);
+}
+
 
-  return 0;
+//================================================================
+/*! get receive statistics.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  st            Pointer of UART_STATISTICS to store the snapshot.
+  @note
+    This doesn't stop the ISR. Each counter is read at once,
+    but counters may be updated by the ISR during the copy.
+*/
+void uart_get_statistics(UART_HANDLE *uh, UART_STATISTICS *st)
+{
+  uart_rx_sync(uh);
+
+  *st = uh->stat;
+}
+
+
+//================================================================
+/*! clear receive statistics.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+*/
+void uart_clear_statistics(UART_HANDLE *uh)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->stat = (UART_STATISTICS){0};
+  CyExitCriticalSection( interrupts );
 }
@@ -27,16 +27,54 @@ extern "C" {
 /***** Local headers ********************************************************/
 /***** Constant values ******************************************************/
 #define UART_WRITE_NONBLOCK 0x01
+#define UART_XONXOFF        0x04
+
+//! characters for XON/XOFF flow control.
+#define UART_XON  0x11
+#define UART_XOFF 0x13
 
 //! size of FIFO buffer for receive.
 #ifndef UART_SIZE_RXFIFO
 # define UART_SIZE_RXFIFO 128
 #endif
 
+//! size of FIFO buffer for transmit.
+#ifndef UART_SIZE_TXFIFO
+# define UART_SIZE_TXFIFO 128
+#endif
+
+#if defined(UART_RING_POW2) && ((UART_SIZE_RXFIFO & (UART_SIZE_RXFIFO - 1)) || (UART_SIZE_TXFIFO & (UART_SIZE_TXFIFO - 1)))
+# error "UART_SIZE_RXFIFO and UART_SIZE_TXFIFO must be power of 2. (UART_RING_POW2)"
+#endif
+
 
 /***** Macros ***************************************************************/
+
+//! compiler barrier for ring buffer. (see uart_ring_pos)
+#if defined(__GNUC__)
+# define UART_RING_BARRIER() __asm volatile ("" ::: "memory")
+#else
+# define UART_RING_BARRIER() __DMB()
+#endif
+
+
 /***** Typedefs *************************************************************/
 
+//================================================
+/*!@brief
+  UART receive statistics
+*/
+typedef struct UART_STATISTICS {
+  uint32_t rx_bytes;            //!< num of received bytes.
+  uint16_t rx_overflow;         //!< num of bytes dropped by rxfifo full. (or overwritten by DMA)
+  uint16_t rx_overrun;          //!< num of hardware FIFO overrun.
+  uint16_t rx_framing_error;    //!< num of framing (stop bit) error.
+  uint16_t rx_parity_error;     //!< num of parity error.
+  uint16_t rx_break;            //!< num of break detected.
+  uint16_t rx_high_water;       //!< maximum bytes stored in rxfifo.
+} UART_STATISTICS;
+
+
 //================================================
 /*!@brief
   UART Handle
@@ -44,18 +82,30 @@ extern "C" {
 typedef struct UART_HANDLE {
   //! @privatesection
   // for transmit
-  const uint8_t    *p_txbuf;                  // pointer of tx buffer.
-  uint16_t          size_txbuf;               // size of tx buffer.
-  volatile uint16_t tx_rd;                    // index of sendout bytes.
-  volatile char     flag_tx_finished;
+  volatile uint16_t tx_rd;                    // index of txfifo for read.
+  volatile uint16_t tx_wr;                    // index of txfifo for write.
+  volatile char     flag_tx_finished;         // txfifo is empty and tx ISR is idle.
   uint8_t           mode;                     // work mode.
+  volatile char     txfifo[UART_SIZE_TXFIFO]; // FIFO for transmit data.
 
   // for receive.
   uint8_t           rx_overflow;	      // buffer overflow flag.
-  uint8_t           delimiter;                //!<@public delimiter of read line (gets). default '\\n'.
+  uint8_t           delimiter;                //!<@public delimiter of read line (gets). default '\\n'. Set before receiving data.
 
   volatile uint16_t rx_rd;                    // index of rxfifo for read.
   volatile uint16_t rx_wr;                    // index of rxfifo for write.
+  volatile uint16_t rx_delim_in;              // num of delimiters stored. (ISR)
+  uint16_t          rx_delim_out;             // num of delimiters read out.
+  volatile uint16_t rx_delim_pos;             // index of the first delimiter.
+  UART_STATISTICS   stat;                     // receive statistics. (ISR)
+
+  // for XON/XOFF flow control.
+  uint16_t          rx_flow_high;             // rxfifo bytes to send XOFF.
+  uint16_t          rx_flow_low;              // rxfifo bytes to send XON.
+  volatile uint8_t  rx_flow_off;              // XOFF was sent.
+  volatile uint8_t  tx_flow_wait;             // Tx is paused by XOFF.
+  volatile uint8_t  tx_xoff;                  // XOFF received.
+  volatile uint8_t  tx_ctrl;                  // XON/XOFF to send ahead of txfifo.
   volatile char     rxfifo[UART_SIZE_RXFIFO]; // FIFO for received data.
 } UART_HANDLE;
 
@@ -63,6 +113,7 @@ typedef struct UART_HANDLE {
 /***** Global variables *****************************************************/
 /***** Function prototypes **************************************************/
 void uart_init(UART_HANDLE *uh);
+void uart_set_rx_watermark(UART_HANDLE *uh, uint16_t high, uint16_t low);
 void uart_clear_tx_buffer(UART_HANDLE *uh);
 void uart_clear_rx_buffer(UART_HANDLE *uh);
 int uart_write(UART_HANDLE *uh, const void *buffer, size_t size);
@@ -70,12 +121,83 @@ int uart_read(UART_HANDLE *uh, void *buffer, size_t size);
 int uart_gets(UART_HANDLE *uh, char *buf, size_t size);
 int uart_read_block(UART_HANDLE *uh, void *buffer, size_t size);
 int uart_read_nonblock(UART_HANDLE *uh, void *buffer, size_t size);
+int uart_rx_peek(UART_HANDLE *uh, const uint8_t **pp);
+void uart_rx_consume(UART_HANDLE *uh, size_t size);
 int uart_bytes_available(UART_HANDLE *uh);
 int uart_can_read_line(UART_HANDLE *uh);
+void uart_get_statistics(UART_HANDLE *uh, UART_STATISTICS *st);
+void uart_clear_statistics(UART_HANDLE *uh);
 
 
 /***** Inline functions *****************************************************/
 
+//================================================================
+/*! Ring buffer index operations.
+
+  @internal
+  Indexes of rxfifo and txfifo are handled only by these functions.
+
+  Default: an index is a position in the buffer (0 .. size-1), and one
+  byte is left unused to distinguish full from empty.
+
+  UART_RING_POW2: sizes must be power of 2. An index runs freely and
+  wraps at 65536, the position is (index & (size-1)), and the full size
+  can be used.
+
+  Lock-free single producer / single consumer:
+  The write index is written only by the producer, and the read index
+  only by the consumer. The producer stores data, then publishes the
+  write index. The consumer reads the write index, reads data, then
+  publishes the read index. UART_RING_BARRIER() keeps the compiler from
+  moving non-volatile buffer accesses (memcpy) across the index access.
+  Cortex-M3 is single core, and an ISR observes the memory accesses of
+  main in program order, so no hardware barrier is needed.
+*/
+#if defined(UART_RING_POW2)
+static inline uint16_t uart_ring_pos(uint16_t idx, uint16_t size)
+{
+  return idx & (size - 1);
+}
+
+static inline uint16_t uart_ring_add(uint16_t idx, uint16_t n, uint16_t size)
+{
+  return idx + n;
+}
+
+static inline uint16_t uart_ring_count(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return wr - rd;
+}
+
+static inline uint16_t uart_ring_space(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return size - (uint16_t)(wr - rd);
+}
+
+#else
+static inline uint16_t uart_ring_pos(uint16_t idx, uint16_t size)
+{
+  return idx;
+}
+
+static inline uint16_t uart_ring_add(uint16_t idx, uint16_t n, uint16_t size)
+{
+  idx += n;
+  return (idx >= size) ? idx - size : idx;
+}
+
+static inline uint16_t uart_ring_count(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return (rd <= wr) ? wr - rd : size - rd + wr;
+}
+
+static inline uint16_t uart_ring_space(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return size - 1 - uart_ring_count(rd, wr, size);
+}
+#endif
+
+
 //================================================================
 /*! set work mode
 
@@ -95,7 +217,7 @@ static inline void uart_set_mode(UART_HANDLE *uh, int mode)
   @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
   @param  buf           Pointer of buffer.
-  @return               Size of transmitted.
+  @return               Size of queued bytes.
 */
 static inline int uart_puts(UART_HANDLE *uh, const char *buf)
 {
@@ -109,7 +231,7 @@ static inline int uart_puts(UART_HANDLE *uh, const char *buf)
   @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
   @param  ch            character
-  @return               Size of transmitted.
+  @return               Size of queued bytes.
 */
 static inline int uart_putc(UART_HANDLE *uh, int ch)
 {
@@ -137,7 +259,7 @@ static inline int uart_getc(UART_HANDLE *uh)
 
 
 //================================================================
-/*! check write finished?
+/*! check write finished? (all data were passed to the hardware FIFO)
 
   @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
@@ -21,385 +21,2382 @@
 #include "uart2.h"
 
 /***** Constant values ******************************************************/
+//! SLIP special characters. (RFC 1055)
+#define SLIP_END     0xc0
+#define SLIP_ESC     0xdb
+#define SLIP_ESC_END 0xdc
+#define SLIP_ESC_ESC 0xdd
+
+//! packet decoder state. (pkt_state)
+#define PKT_ZERO     0x01       // COBS: a zero is inserted before the next block.
+#define PKT_ESC      0x02       // SLIP: ESC received.
+#define PKT_ERROR    0x04       // decode error or rxfifo full. drop the packet.
+
+
 /***** Macros ***************************************************************/
 /***** Typedefs *************************************************************/
+
+//================================================
+/*!@brief
+  Output of uart_printf. (chunk buffer)
+*/
+typedef struct UART_PRINTF {
+  UART_HANDLE *uh;
+  int          n;               // num of chars in buf.
+  int          total;           // num of chars output, or -1 if timeout.
+  char         buf[UART_PRINTF_CHUNK];
+} UART_PRINTF;
+
+
 /***** Function prototypes **************************************************/
 int uart_check_timeout(void);
 void uart_stop_timeout(void);
 
 
 /***** Global variables *****************************************************/
+
+//! tick counter in ms. (see uart_tick)
+volatile uint32_t uart_tick_count;
+
+
 /***** Local variables ******************************************************/
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! make deadline from timeout.
+
+  @param  timeout       Timeout in ms, or UART_TIMEOUT_FOREVER.
+  @return uint32_t      Deadline in uart_tick_count.
+*/
+static uint32_t uart_deadline(uint32_t timeout)
+{
+  if( timeout == UART_TIMEOUT_FOREVER ) return UART_TIMEOUT_FOREVER;
+
+  uint32_t deadline = uart_tick_count + timeout;
+  if( deadline == UART_TIMEOUT_FOREVER ) deadline--;
+
+  return deadline;
+}
 
-/***** Interrupt functions **************************************************/
 
 //================================================================
-/*! Tx interrupt handler.
+/*! wait for interrupt, until the deadline.
+
+  @param  deadline      Deadline made by uart_deadline().
+  @return int           0 or -1 if timeout.
+  @note
+    Any interrupt, including the tick, wakes up the CPU.
+    So it never sleeps past the deadline.
+*/
+static int uart_wait(uint32_t deadline)
+{
+  if( deadline != UART_TIMEOUT_FOREVER &&
+      (int32_t)(uart_tick_count - deadline) >= 0 ) return -1;
+
+  CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
+
+#ifdef UART_CHECK_TIMEOUT
+  if( uart_check_timeout() ) return -1;
+#endif
+  return 0;
+}
+
+
+//================================================================
+/*! lock-free primitives for multi-writer transmit.
 
   @internal
+  Cortex-M3 has LDREX/STREX. An exception between them makes STREX fail,
+  so these are safe against any ISR without disabling interrupts.
+*/
+#if defined(__GNUC__)
+static inline uint8_t uart_atomic_add8(volatile uint8_t *p, int n)
+{
+  return __sync_add_and_fetch(p, n);
+}
+
+static inline int uart_atomic_cas16(volatile uint16_t *p, uint16_t old_val, uint16_t new_val)
+{
+  return __sync_bool_compare_and_swap(p, old_val, new_val);
+}
+
+#else
+static inline uint8_t uart_atomic_add8(volatile uint8_t *p, int n)
+{
+  uint8_t v;
+  do {
+    v = __LDREXB(p) + n;
+  } while( __STREXB(v, p) );
+  return v;
+}
+
+static inline int uart_atomic_cas16(volatile uint16_t *p, uint16_t old_val, uint16_t new_val)
+{
+  do {
+    if( __LDREXH(p) != old_val ) {
+      __CLREX();
+      return 0;
+    }
+  } while( __STREXH(new_val, p) );
+  return 1;
+}
+#endif
+
+
+//================================================================
+/*! RS-485: assert DE before transmit.
+
   @param  uh            Pointer of UART_HANDLE.
   @note
-    Don't use this directry. Use UART_ISR macro.
+    Call this in critical section.
 */
-void uart_isr_tx(UART_HANDLE *uh)
+static void uart_rs485_assert(UART_HANDLE *uh)
 {
-  // clear Tx status register and check simply.
-  if( !(uh->ReadTxStatus() & uh->TX_STS_FIFO_EMPTY) ) return;
+  UART_RS485 *rs = uh->rs485;
+  if( !rs || rs->de ) return;
 
-  uint16_t n = uh->size_txbuf - uh->tx_rd;
-  if( n > 4 ) n = 4;	// 4 = Hardware FIFO size for PSoC5LP UART module
+  rs->de = 1;
+  rs->echo = rs->sent;                  // resync echo counting.
+  rs->DeWrite(1);
+}
 
-  for( ; n > 0; n-- ) {
-    uh->WriteTxData( uh->p_txbuf[uh->tx_rd++] );
+
+//================================================================
+/*! start transmit if Tx ISR is idle.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    In critical section, as it races with Tx ISR over flag_tx_finished
+    and the hardware. Tx ISR claims the transmitter the same way.
+*/
+static void uart_tx_kick(UART_HANDLE *uh)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+
+  if( uh->flag_tx_finished && uart_tx_pending(uh) ) {
+    uh->flag_tx_finished = 0;
+    uart_rs485_assert(uh);
+
+    // if hardware FIFO is not empty, FIFO empty interrupt will occur later.
+    if( uh->hw->ReadTxStatus() & uh->hw->TX_STS_FIFO_EMPTY ) uart_tx_fill_t(uh, uh->hw->WriteTxData);
   }
 
-  if( uh->tx_rd >= uh->size_txbuf ) uh->flag_tx_finished = 1;
+  CyExitCriticalSection( interrupts );
 }
 
 
 //================================================================
-/*! Rx interrupt handler.
+/*! reserve space of txfifo.
 
-  @internal
   @param  uh            Pointer of UART_HANDLE.
+  @param  min_size      Minimum size to reserve.
+  @param  max_size      Maximum size to reserve.
+  @param  p_idx         Pointer to store the index of the reserved space.
+  @return uint16_t      Reserved size, or 0 if less than min_size.
   @note
-    Don't use this directry. Use UART_ISR macro.
+    Lock-free, so main and ISRs can write at the same time.
+    Always call uart_tx_commit() after this, even if 0 is returned.
 */
-void uart_isr_rx(UART_HANDLE *uh)
+static uint16_t uart_tx_reserve(UART_HANDLE *uh, uint16_t min_size, uint16_t max_size, uint16_t *p_idx)
 {
-  int sts = uh->ReadRxStatus();
+  uint16_t resv, n;
 
-  for(; sts != 0; sts = uh->ReadRxStatus()) {
-    if( sts & uh->RX_STS_FIFO_NOTEMPTY ) {
-      uh->rxfifo[uh->rx_wr++] = uh->ReadRxData();
+  // count the writer first, so that the others never publish the
+  // space before it is written.
+  uart_atomic_add8(&uh->tx_busy, 1);
 
-      // check rollover write index.
-      if( uh->rx_wr < sizeof(uh->rxfifo)) {
-        if( uh->rx_wr == uh->rx_rd ) {
-          --uh->rx_wr;   // buffer full
-	  uh->rx_overflow = 1;
-        }
-      }
-      else {
-        if( uh->rx_rd == 0 ) {
-          --uh->rx_wr;   // buffer full
-	  uh->rx_overflow = 1;
-        }
-        else {
-          uh->rx_wr = 0; // roll over.
-        }
-      }
+  do {
+    resv = uh->tx_resv;
+    n = uart_ring_space(uh->tx_rd, resv, uh->tx_size);
+    if( n < min_size ) {
+      n = 0;
+      break;
     }
+    if( n > max_size ) n = max_size;
+  } while( !uart_atomic_cas16(&uh->tx_resv, resv, uart_ring_add(resv, n, uh->tx_size)) );
 
-    // and any more check other status?
-  }
+  *p_idx = resv;
+  return n;
 }
 
 
-/***** Local functions ******************************************************/
-/***** Global functions *****************************************************/
-
 //================================================================
-/*! initialize
+/*! commit the reserved space, and start transmit.
 
-  @internal
   @param  uh            Pointer of UART_HANDLE.
   @note
-    Don't use this directry. Use uart_init macro.
+    The last writer publishes all reserved space at once. Writers
+    preempted by ISRs are outer, so they commit last.
+    Publishing is lock-free, then uart_tx_kick() enters critical section.
 */
-void uart_init_m(UART_HANDLE *uh,
-                 uint8_t      tx_sts_fifo_empty,
-                 uint8_t      rx_sts_fifo_notempty,
-                 void        *Start,
-                 void        *Stop,
-                 void        *ClearTxBuffer,
-                 void        *ClearRxBuffer,
-                 void        *ReadTxStatus,
-                 void        *ReadRxStatus,
-                 void        *WriteTxData,
-                 void        *ReadRxData)
+static void uart_tx_commit(UART_HANDLE *uh)
 {
-  *uh = (UART_HANDLE){
-    .p_txbuf          = 0,
-    .size_txbuf       = 0,
-    .tx_rd            = 0,
-    .flag_tx_finished = 1,
-    .mode             = 0,
-    .rx_overflow      = 0,
-    .delimiter        = '\n',
-    .rx_rd            = 0,
-    .rx_wr            = 0,
+  UART_RING_BARRIER();
+  if( uart_atomic_add8(&uh->tx_busy, -1) != 0 ) return;
 
-    .TX_STS_FIFO_EMPTY    = tx_sts_fifo_empty,
-    .RX_STS_FIFO_NOTEMPTY = rx_sts_fifo_notempty,
-    .Start                = Start,
-    .Stop                 = Stop,
-    .ClearTxBuffer        = ClearTxBuffer,
-    .ClearRxBuffer        = ClearRxBuffer,
-    .ReadRxStatus         = ReadRxStatus,
-    .ReadTxStatus         = ReadTxStatus,
-    .WriteTxData          = WriteTxData,
-    .ReadRxData           = ReadRxData,
-  };
+  // tx_wr is read before tx_resv. If an ISR publishes between them,
+  // CAS fails and tx_wr never goes back.
+  uint16_t tx_wr;
+  do {
+    tx_wr = uh->tx_wr;
+  } while( !uart_atomic_cas16(&uh->tx_wr, tx_wr, uh->tx_resv) );
 
-  uh->Start();
-  if( uh->ClearTxBuffer ) uh->ClearTxBuffer();
-  if( uh->ClearRxBuffer ) uh->ClearRxBuffer();
+  uart_tx_kick(uh);
 }
 
 
 //================================================================
-/*! Clear transmit buffer.
+/*! copy data to the reserved space of txfifo.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
+  @param  idx           Index of txfifo from uart_tx_reserve().
+  @param  buffer        Pointer of data.
+  @param  size          Size of data.
 */
-void uart_clear_tx_buffer(UART_HANDLE *uh)
+static void uart_tx_copy(UART_HANDLE *uh, uint16_t idx, const void *buffer, uint16_t size)
 {
-  uh->ClearTxBuffer();
+  uint16_t pos = uart_ring_pos(idx, uh->tx_size);
+  uint16_t n1  = uh->tx_size - pos;
+
+  if( n1 > size ) n1 = size;
+  memcpy( (char *)&uh->txfifo[pos], buffer, n1 );
+  memcpy( (char *)uh->txfifo, (const uint8_t *)buffer + n1, size - n1 );
 }
 
 
 //================================================================
-/*! Clear receive buffer.
+/*! count delimiters in the data to be read out.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
+  @param  p             Pointer of the data.
+  @param  size          Size of the data.
+  @return int           Num of delimiters.
+  @note
+    Call before rx_rd is updated. After that, Rx ISR may overwrite
+    the data in rxfifo.
 */
-void uart_clear_rx_buffer(UART_HANDLE *uh)
+static int uart_rx_delimiter_count(UART_HANDLE *uh, const uint8_t *p, size_t size)
 {
-  uh->ClearRxBuffer();
+  // delimiter never included in the data if no delimiter in rxfifo.
+  if( uh->rx_delim_in == uh->rx_delim_out ) return 0;
 
-  uint8 interrupts = CyEnterCriticalSection();
-  uh->rx_rd = 0;
-  uh->rx_wr = 0;
-  uh->rx_overflow = 0;
-  CyExitCriticalSection( interrupts );
+  const uint8_t *p_end = p + size;
+  int n = 0;
+
+  while( (p = memchr( p, uh->delimiter, p_end - p )) != 0 ) {
+    n++;
+    if( ++p >= p_end ) break;
+  }
+  return n;
 }
 
 
 //================================================================
-/*! Send out binary data.
+/*! count delimiters in rxfifo again.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
-  @param  buffer        Pointer of buffer.
-  @param  size          Size of buffer.
-  @return               Size of transmitted.
+  @note
+    Call in a critical section.
 */
-int uart_write(UART_HANDLE *uh, const void *buffer, size_t size)
+static void uart_rx_delimiter_recount(UART_HANDLE *uh)
 {
-  if( !uh->flag_tx_finished ) return 0;  // TODO: or -1 ??
-  if( size == 0 ) return 0;
-
-  uh->p_txbuf          = buffer;
-  uh->size_txbuf       = size;
-  uh->tx_rd            = 1;
-  uh->flag_tx_finished = 0;
-
-  uh->WriteTxData( *(uint8_t *)buffer );	// send first byte.
-  if( uh->mode & UART_WRITE_NONBLOCK ) return 0;
+  uint16_t idx = uh->rx_rd;
 
-  do {
-    CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
-#ifdef UART_CHECK_TIMEOUT
-    if( uart_check_timeout()) {
-      uart_stop_timeout();
-      uh->flag_tx_finished = 1;
-      return -1;
+  uh->rx_delim_out = uh->rx_delim_in;
+  while( idx != uh->rx_wr ) {
+    if( uh->rxfifo[uart_ring_pos(idx, uh->rx_size)] == uh->delimiter ) {
+      if( uh->rx_delim_out == uh->rx_delim_in ) uh->rx_delim_pos = idx;
+      uh->rx_delim_out--;
     }
-#endif
-  } while( !uh->flag_tx_finished );
-
-#ifdef UART_CHECK_TIMEOUT
-  uart_stop_timeout();
-#endif
-  return uh->tx_rd;
+    idx = uart_ring_add(idx, 1, uh->rx_size);
+  }
 }
 
 
 //================================================================
-/*! Receive binary data.
+/*! update delimiter count after reading data out of rxfifo.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
-  @param  buffer        Pointer of buffer.
-  @param  size          Size of buffer.
-  @return int           Num of received bytes.
-
-  @note                 If no data received, it blocks execution.
+  @param  n             Num of delimiters read out. (uart_rx_delimiter_count)
 */
-int uart_read(UART_HANDLE *uh, void *buffer, size_t size)
+static void uart_rx_delimiter_consumed(UART_HANDLE *uh, int n)
 {
-  if( size == 0 ) return 0;
+  if( n == 0 ) return;
 
-  // wait for data.
-  while( !uart_is_readable(uh) ) {
-    CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
-#ifdef UART_CHECK_TIMEOUT
-    if( uart_check_timeout()) {
-      uart_stop_timeout();
-      return -1;
+  uh->rx_delim_out += n;
+  if( uh->rx_delim_in == uh->rx_delim_out ) return;
+
+  // find the next delimiter, up to rx_wr.
+  uint16_t rx_wr = uh->rx_wr;
+  UART_RING_BARRIER();
+  for( uint16_t idx = uh->rx_rd; idx != rx_wr; idx = uart_ring_add(idx, 1, uh->rx_size) ) {
+    if( uh->rxfifo[uart_ring_pos(idx, uh->rx_size)] == uh->delimiter ) {
+      uh->rx_delim_pos = idx;
+      return;
     }
-#endif
   }
 
-  // copy fifo to buffer
-  uint8_t *buf = buffer;
-  size_t   cnt = size;
-  uint16_t rx_rd;
-
-  do {
-    rx_rd = uh->rx_rd;
-    *buf++ = uh->rxfifo[rx_rd++];
-    if( rx_rd >= sizeof(uh->rxfifo) ) rx_rd = 0;
-    uh->rx_rd = rx_rd;
-  } while( --cnt != 0 && rx_rd != uh->rx_wr );
-
-#ifdef UART_CHECK_TIMEOUT
-  uart_stop_timeout();
-#endif
-  return size - cnt;
+  // the count does not match rxfifo. count again.
+  uint8 interrupts = CyEnterCriticalSection();
+  uart_rx_delimiter_recount(uh);
+  CyExitCriticalSection( interrupts );
 }
 
 
 //================================================================
-/*! Receive string.
+/*! get length of a line in rxfifo.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
-  @param  buf           Pointer of buffer.
-  @param  size          Size of buffer.
-  @return int           Num of received bytes.
-
-  @note                 If no data received, it blocks execution.
+  @return int           length including the delimiter, or 0 if no line.
 */
-int uart_gets(UART_HANDLE *uh, char *buf, size_t size)
+static int uart_rx_line_length(UART_HANDLE *uh)
 {
-  size_t cnt = size - 1;
+  if( uh->rx_delim_in == uh->rx_delim_out ) return 0;
 
-  while( 1 ) {
-    // wait for data.
-    if( !uart_is_readable(uh) ) {
-      CyPmAltAct(PM_ALT_ACT_TIME_NONE, PM_ALT_ACT_SRC_PICU);
-#ifdef UART_CHECK_TIMEOUT
-      if( uart_check_timeout()) {
-        uart_stop_timeout();
-        *buf = '\0';
-        return -1;
-      }
-#endif
-      continue;
-    }
+  return uart_ring_count(uh->rx_rd, uh->rx_delim_pos, uh->rx_size) + 1;
+}
+
+
+//================================================================
+/*! send XON/XOFF ahead of txfifo.
 
-    // copy fifo to buffer
-    uint16_t rx_rd = uh->rx_rd;
-    int ch = (*buf++ = uh->rxfifo[rx_rd++]);
-    if( rx_rd >= sizeof(uh->rxfifo)) rx_rd = 0;
-    uh->rx_rd = rx_rd;
+  @param  uh            Pointer of UART_HANDLE.
+  @param  ch            UART_XON or UART_XOFF.
+*/
+static void uart_tx_ctrl(UART_HANDLE *uh, uint8_t ch)
+{
+  uint8 interrupts = CyEnterCriticalSection();
 
-    if( --cnt == 0 ) break;
-    if( ch == uh->delimiter ) break;
+  // write directly if Tx ISR is idle, otherwise Tx ISR sends it.
+  if( (uh->flag_tx_finished || uh->flow->tx_wait) && !(uh->dma && uh->dma->size) &&
+      (uh->hw->ReadTxStatus() & uh->hw->TX_STS_FIFO_EMPTY) ) {
+    uart_rs485_assert(uh);
+    uh->hw->WriteTxData( ch );
+    if( uh->rs485 ) uh->rs485->sent++;
+  } else {
+    uh->flow->tx_ctrl = ch;
   }
-  *buf = '\0';
 
-#ifdef UART_CHECK_TIMEOUT
-  uart_stop_timeout();
-#endif
-  return size - cnt - 1;
+  CyExitCriticalSection( interrupts );
 }
 
 
 //================================================================
-/*! Receive binary block data.
+/*! restart transmit paused by flow control.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
-  @param  buffer        Pointer of buffer.
-  @param  size          Size of buffer.
-  @return int           Num of received bytes.
 */
-int uart_read_block(UART_HANDLE *uh, void *buffer, size_t size)
+static void uart_tx_resume(UART_HANDLE *uh)
 {
-  uint8 *buf = buffer;
-  size_t cnt = size;
+  UART_FLOW *flow = uh->flow;
+  if( !flow ) return;
 
-  while( cnt > 0 ) {
-    int n = uart_read(uh, buf, cnt);
-    if( n < 0 ) return n;
-    cnt -= n;
-    buf += n;
+  uint8 interrupts = CyEnterCriticalSection();
+
+  if( flow->tx_wait && !flow->tx_xoff && !(flow->CtsRead && flow->CtsRead()) ) {
+    flow->tx_wait = 0;
+    if( uh->hw->ReadTxStatus() & uh->hw->TX_STS_FIFO_EMPTY ) uart_tx_fill_t(uh, uh->hw->WriteTxData);
   }
 
-  return size;
+  CyExitCriticalSection( interrupts );
 }
 
 
 //================================================================
-/*! Receive binary data. (non block)
+/*! restart the peer, if rxfifo has enough space.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
-  @param  buffer        Pointer of buffer.
-  @param  size          Size of buffer.
-  @return int           Num of received bytes.
+  @note
+    Call this after reading data out of rxfifo.
 */
-int uart_read_nonblock(UART_HANDLE *uh, void *buffer, size_t size)
+static void uart_rx_flow_check(UART_HANDLE *uh)
 {
-  int n = uart_bytes_available(uh);
-  if( n > size ) n = size;
-  if( n != 0 ) uart_read(uh, buffer, n);
+  UART_FLOW *flow = uh->flow;
+  if( !flow || !flow->rx_off ) return;
 
-  return n;
+  uint8 interrupts = CyEnterCriticalSection();
+  if( uart_ring_count(uh->rx_rd, uh->rx_wr, uh->rx_size) <= flow->rx_low ) {
+    flow->rx_off = 0;
+    if( flow->RtsWrite ) flow->RtsWrite(0);
+    if( uh->mode & UART_XONXOFF ) uart_tx_ctrl(uh, UART_XON);
+  }
+  CyExitCriticalSection( interrupts );
 }
 
 
 //================================================================
-/*! check data length can be read.
+/*! close the receiving frame and put it into the frame queue.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
-  @return int           result (bytes)
+  @param  rx_wr         index of rxfifo next to the last byte.
+  @note
+    Call this from ISR, or in critical section.
 */
-int uart_bytes_available(UART_HANDLE *uh)
+static void uart_frame_close(UART_HANDLE *uh, uint16_t rx_wr)
 {
-  uint16_t rx_wr = uh->rx_wr;
+  UART_FRAMEQ *fr = uh->frame;
+  uint16_t wr = fr->wr;
+
+  fr->open = 0;
+  if( uart_ring_space(fr->rd, wr, fr->size) == 0 ) {
+    // frame queue full. the bytes are skipped by the reader later.
+    uh->rx_overflow = 1;
+    uh->stat.rx_overflow += uart_ring_count(fr->start, rx_wr, uh->rx_size);
+    return;
+  }
+
+  UART_FRAME *frame = &fr->q[uart_ring_pos(wr, fr->size)];
+  frame->start  = fr->start;
+  frame->length = uart_ring_count(fr->start, rx_wr, uh->rx_size);
+  fr->wr = uart_ring_add(wr, 1, fr->size);
 
-  if( uh->rx_rd <= rx_wr ) {
-    return rx_wr - uh->rx_rd;
+  if( uh->callback_events & UART_EVENT_RX_FRAME ) {
+    uh->callback(uh, UART_EVENT_RX_FRAME);
   }
-  else {
-    return sizeof(uh->rxfifo) - uh->rx_rd + rx_wr;
+}
+
+
+//================================================================
+/*! store a decoded byte of the receiving packet.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  ch            decoded byte.
+  @note
+    Called from Rx ISR. The byte is not readable until the packet ends.
+*/
+static void uart_packet_store(UART_HANDLE *uh, uint8_t ch)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  uint16_t pkt_wr = fr->pkt_wr;
+
+  if( uart_ring_space(uh->rx_rd, pkt_wr, uh->rx_size) == 0 ) {
+    uh->rx_overflow = 1;        // buffer full
+    uh->stat.rx_overflow++;
+    fr->pkt_state |= PKT_ERROR;
+    return;
   }
+
+  uh->rxfifo[uart_ring_pos(pkt_wr, uh->rx_size)] = ch;
+  fr->pkt_wr = uart_ring_add(pkt_wr, 1, uh->rx_size);
 }
 
 
 //================================================================
-/*! check data can be read a line.
+/*! end of the receiving packet.
 
-  @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
-  @return int           string length.
+  @param  error         The packet is broken. (bool)
   @note
-   If RX-FIFO buffer is full, return -1.
+    Called from Rx ISR. Publish the decoded bytes and put the packet
+    into the frame queue. Empty packets are ignored.
 */
-int uart_can_read_line(UART_HANDLE *uh)
+static void uart_packet_end(UART_HANDLE *uh, int error)
 {
-  uint16_t idx   = uh->rx_rd;
-  uint16_t rx_wr = uh->rx_wr;
+  UART_FRAMEQ *fr = uh->frame;
+  UART_FLOW *flow = uh->flow;
+  uint16_t rx_wr  = uh->rx_wr;
+  uint16_t pkt_wr = fr->pkt_wr;
+
+  if( error || (fr->pkt_state & PKT_ERROR) ) {
+    uh->stat.rx_packet_error++;
+    fr->pkt_wr = rx_wr;         // drop decoded bytes.
+
+  } else if( pkt_wr != rx_wr ) {
+    fr->start = rx_wr;
+    UART_RING_BARRIER();
+    uh->rx_wr = pkt_wr;
+
+    uint16_t n = uart_ring_count(uh->rx_rd, pkt_wr, uh->rx_size);
+    if( n > uh->stat.rx_high_water ) uh->stat.rx_high_water = n;
+
+    // flow control. (restarted in the reader side)
+    if( flow && flow->RtsWrite && n >= flow->rx_high && !flow->rx_off ) {
+      uart_rx_flow_stop(uh);
+    }
 
-  if( uh->rx_overflow ) return -1;
+    uart_frame_close(uh, pkt_wr);
+  }
 
-  while( idx != rx_wr ) {
-    if( uh->rxfifo[idx++] == uh->delimiter ) {
-      if( uh->rx_rd < idx ) {
-	return idx - uh->rx_rd;
-      } else {
-	return sizeof(uh->rxfifo) - uh->rx_rd + idx;
-      }
+  fr->pkt_code = 0;
+  fr->pkt_state = 0;
+}
+
+
+//================================================================
+/*! flush the chunk buffer of uart_printf.
+
+  @param  pf            Pointer of UART_PRINTF.
+*/
+static void uart_printf_flush(UART_PRINTF *pf)
+{
+  if( pf->n == 0 ) return;
+
+  if( pf->total >= 0 ) {
+    if( uart_write(pf->uh, pf->buf, pf->n) < 0 ) {
+      pf->total = -1;
+    } else {
+      pf->total += pf->n;
     }
-    if( idx >= sizeof(uh->rxfifo)) idx = 0;
   }
+  pf->n = 0;
+}
 
-  return 0;
+
+//================================================================
+/*! output a character of uart_printf.
+
+  @param  pf            Pointer of UART_PRINTF.
+  @param  ch            character.
+*/
+static void uart_printf_putc(UART_PRINTF *pf, int ch)
+{
+  pf->buf[pf->n++] = ch;
+  if( pf->n == sizeof(pf->buf) ) uart_printf_flush(pf);
+}
+
+
+//================================================================
+/*! output padding of uart_printf.
+
+  @param  pf            Pointer of UART_PRINTF.
+  @param  ch            character for padding.
+  @param  n             num of characters.
+*/
+static void uart_printf_pad(UART_PRINTF *pf, int ch, int n)
+{
+  for( ; n > 0; n-- ) uart_printf_putc(pf, ch);
+}
+
+
+//================================================================
+/*! output a number of uart_printf.
+
+  @param  pf            Pointer of UART_PRINTF.
+  @param  v             absolute value.
+  @param  neg           negative. (bool)
+  @param  base          10 or 16.
+  @param  point         num of digits after the decimal point. (fixed point)
+  @param  prec          minimum num of digits. (zeros are added)
+  @param  width         field width.
+  @param  flags         '-' (left justify), '0' (zero padding), or 0.
+  @param  digit         characters for digits. ("0123456789abcdef")
+  @note
+    Only the digits of the value are kept in the buffer. Leading zeros
+    of the precision are made in the output loop, so any precision
+    is output in full.
+*/
+static void uart_printf_number(UART_PRINTF *pf, uint32_t v, int neg, int base,
+                               int point, int prec, int width, int flags,
+                               const char *digit)
+{
+  char buf[11];                 // digits of 32bit value, from the lowest.
+  int  i = 0;
+
+  while( v != 0 ) {
+    buf[i++] = digit[v % base];
+    v /= base;
+  }
+
+  // at least one digit before the point.
+  if( point > 0 && prec < point + 1 ) prec = point + 1;
+  int n = (i > prec) ? i : prec;
+
+  width -= n + (point > 0) + neg;
+  if( flags != '-' && flags != '0' ) uart_printf_pad(pf, ' ', width);
+  if( neg ) uart_printf_putc(pf, '-');
+  if( flags == '0' ) uart_printf_pad(pf, '0', width);
+  for( ; n > 0; n-- ) {
+    if( n == point ) uart_printf_putc(pf, '.');
+    uart_printf_putc(pf, (n > i) ? '0' : buf[n - 1]);
+  }
+  if( flags == '-' ) uart_printf_pad(pf, ' ', width);
+}
+
+
+//================================================================
+/*! copy rxfifo to buffer.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Num of copied bytes.
+  @note
+    Copy at most 2 contiguous segments, and update rx_rd only once.
+*/
+static int uart_rx_copy(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  uint8_t *buf   = buffer;
+  uint16_t rx_rd = uh->rx_rd;
+  uint16_t pos   = uart_ring_pos(rx_rd, uh->rx_size);
+  size_t   n     = uart_ring_count(rx_rd, uh->rx_wr, uh->rx_size);
+  size_t   n1    = uh->rx_size - pos;
+
+  if( n > size ) n = size;
+  if( n1 > n ) n1 = n;
+  UART_RING_BARRIER();
+
+  // 1st segment up to the end of rxfifo, and 2nd segment from the top.
+  memcpy( buf, (const char *)&uh->rxfifo[pos], n1 );
+  memcpy( buf + n1, (const char *)uh->rxfifo, n - n1 );
+  int n_delim = uart_rx_delimiter_count(uh, buf, n);
+
+  UART_RING_BARRIER();
+  uh->rx_rd = uart_ring_add(rx_rd, n, uh->rx_size);
+  uart_rx_delimiter_consumed(uh, n_delim);
+  uart_rx_flow_check(uh);
+
+  return n;
+}
+
+
+/***** Interrupt functions **************************************************/
+
+//================================================================
+/*! Tx interrupt handler.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Don't use this directry. Use UART_ISR macro.
+*/
+void uart_isr_tx(UART_HANDLE *uh)
+{
+  const UART_HW *hw = uh->hw;
+
+  uart_isr_tx_t(uh, hw->TX_STS_FIFO_EMPTY, hw->ReadTxStatus, hw->WriteTxData);
+}
+
+
+//================================================================
+/*! Tx DMA complete interrupt handler.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Don't use this directry. Use UART_ISR_TX_DMA macro.
+*/
+void uart_isr_tx_dma(UART_HANDLE *uh)
+{
+  UART_TX_DMA *dma = uh->dma;
+
+  // in critical section with uart_tx_kick(), as in Tx ISR. Otherwise
+  // a writer kicking between the check and the flag set sees the
+  // transmitter busy, and its data waits for another Tx interrupt.
+  uint8 interrupts = CyEnterCriticalSection();
+  uint16_t tx_rd = uart_ring_add(uh->tx_rd, dma->size, uh->tx_size);
+
+  uh->tx_rd = tx_rd;
+  dma->size = 0;
+  if( tx_rd == uh->tx_wr ) uh->flag_tx_finished = 1;
+  CyExitCriticalSection( interrupts );
+
+  // continue by Tx ISR, when the hardware FIFO becomes empty.
+  dma->TxIsrEnable();
+}
+
+
+//================================================================
+/*! Rx interrupt handler.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Don't use this directry. Use UART_ISR macro.
+*/
+void uart_isr_rx(UART_HANDLE *uh)
+{
+  const UART_HW *hw = uh->hw;
+
+  uart_isr_rx_t(uh, hw->RX_STS_FIFO_NOTEMPTY,
+                hw->RX_STS_OVERRUN | hw->RX_STS_STOP_ERROR |
+                hw->RX_STS_PAR_ERROR | hw->RX_STS_BREAK,
+                hw->ReadRxStatus, hw->ReadRxData);
+}
+
+
+//================================================================
+/*! stop the peer by flow control.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Called from Rx ISR, when rxfifo reached the high watermark.
+*/
+void uart_rx_flow_stop(UART_HANDLE *uh)
+{
+  uh->flow->rx_off = 1;
+  if( uh->flow->RtsWrite ) uh->flow->RtsWrite(1);
+  if( uh->mode & UART_XONXOFF ) uart_tx_ctrl(uh, UART_XOFF);
+}
+
+
+//================================================================
+/*! RS-485: wait TX complete of the last byte.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Called from Tx ISR in critical section, at FIFO empty after all
+    data. TX complete is sticky and set after every byte, so the one
+    read at FIFO empty may be of the byte before the last. The read
+    cleared it, and TX complete set after this is of the last byte.
+    FIFO empty stays set, so the interrupt source is switched to
+    TX complete only, to make a new interrupt.
+    FIFO empty interrupt must be served within a character time.
+*/
+void uart_rs485_arm(UART_HANDLE *uh)
+{
+  uh->rs485->armed = 1;
+  uh->rs485->SetTxInterruptMode(uh->rs485->TX_STS_COMPLETE);
+}
+
+
+//================================================================
+/*! RS-485: cancel waiting TX complete, as more data was written.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Called in critical section, from uart_tx_fill_t().
+*/
+void uart_rs485_disarm(UART_HANDLE *uh)
+{
+  uh->rs485->armed = 0;
+  uh->rs485->SetTxInterruptMode(uh->hw->TX_STS_FIFO_EMPTY);
+}
+
+
+//================================================================
+/*! RS-485: release DE.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Called from Tx ISR in critical section, on TX complete after
+    uart_rs485_arm(). Tx ISR calls back UART_EVENT_TX_COMPLETE after that.
+*/
+void uart_rs485_release(UART_HANDLE *uh)
+{
+  uart_rs485_disarm(uh);
+  uh->rs485->DeWrite(0);
+  uh->rs485->de = 0;
+}
+
+
+//================================================================
+/*! bridge: move data from rxfifo of the source to the hardware FIFO.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE. (destination)
+  @note
+    Called from Tx ISR of the destination, instead of reading txfifo.
+    This is the consumer of rxfifo of the source while bridging.
+    Critical section closes the race with Rx ISR of the source, which
+    kicks Tx only if flag_tx_finished is set.
+*/
+void uart_bridge_fill(UART_HANDLE *uh)
+{
+  UART_HANDLE *src = uh->bridge->src;
+  UART_FLOW *flow = uh->flow;
+  uint8 interrupts = CyEnterCriticalSection();
+
+  uint16_t rx_rd = src->rx_rd;
+  uint16_t n     = uart_ring_count(rx_rd, src->rx_wr, src->rx_size);
+  uint8_t  sent  = 0;
+
+  // XON/XOFF of the destination is sent ahead of the bridged data.
+  if( flow && flow->tx_ctrl ) {
+    uh->hw->WriteTxData( flow->tx_ctrl );
+    flow->tx_ctrl = 0;
+    if( uh->rs485 ) uh->rs485->sent++;
+    sent = 1;
+  }
+
+  // pause while CTS is deasserted or XOFF received.
+  if( n != 0 && flow && (flow->tx_xoff || (flow->CtsRead && flow->CtsRead())) ) {
+    flow->tx_wait = 1;
+    CyExitCriticalSection( interrupts );
+    return;
+  }
+
+  // 4 = Hardware FIFO size for PSoC5LP UART module
+  if( n > 4 - sent ) n = 4 - sent;
+  if( uh->rs485 ) uh->rs485->sent += n;
+  uh->bridge->bytes += n;
+  UART_RING_BARRIER();
+  for( ; n > 0; n-- ) {
+    uh->hw->WriteTxData( src->rxfifo[uart_ring_pos(rx_rd, src->rx_size)] );
+    rx_rd = uart_ring_add(rx_rd, 1, src->rx_size);
+  }
+  UART_RING_BARRIER();
+  src->rx_rd = rx_rd;
+
+  if( rx_rd == src->rx_wr ) uh->flag_tx_finished = 1;
+  CyExitCriticalSection( interrupts );
+
+  // restart the peer of the source.
+  uart_rx_flow_check(src);
+}
+
+
+//================================================================
+/*! bridge: start transmit of the destination.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE. (destination)
+  @note
+    Called from Rx ISR of the source, when the destination is idle.
+*/
+void uart_bridge_kick(UART_HANDLE *uh)
+{
+  uart_tx_kick(uh);
+}
+
+
+//================================================================
+/*! XON/XOFF received.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  ch            UART_XON or UART_XOFF.
+  @note
+    Called from Rx ISR.
+*/
+void uart_tx_xonxoff(UART_HANDLE *uh, uint8_t ch)
+{
+  if( !uh->flow ) return;
+
+  if( ch == UART_XOFF ) {
+    uh->flow->tx_xoff = 1;
+  } else {
+    uh->flow->tx_xoff = 0;
+    uart_tx_resume(uh);
+  }
+}
+
+
+//================================================================
+/*! timestamp a received byte for idle gap framing.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  rx_wr         index of rxfifo to store the byte.
+  @note
+    Called from Rx ISR, before storing the byte.
+*/
+void uart_frame_mark(UART_HANDLE *uh, uint16_t rx_wr)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  uint16_t now = fr->GetTime();
+
+  if( fr->open && (uint16_t)(now - fr->time) >= fr->gap ) {
+    uart_frame_close(uh, rx_wr);
+  }
+  if( !fr->open ) {
+    fr->start = rx_wr;
+    fr->open = 1;
+  }
+  fr->time = now;
+}
+
+
+//================================================================
+/*! decode a received byte of COBS or SLIP packet.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  ch            received byte.
+  @note
+    Called from Rx ISR, in UART_PACKET_COBS or UART_PACKET_SLIP mode.
+*/
+void uart_packet_rx(UART_HANDLE *uh, uint8_t ch)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  if( !fr ) return;
+
+  if( uh->mode & UART_PACKET_COBS ) {
+    // 0x00 is the packet delimiter. A block must not be cut off.
+    if( ch == 0 ) {
+      uart_packet_end(uh, fr->pkt_code != 0);
+      return;
+    }
+
+    // code byte: (num of data bytes + 1) in the block, and
+    // a zero follows the block unless the code is 0xff.
+    if( fr->pkt_code == 0 ) {
+      if( fr->pkt_state & PKT_ZERO ) uart_packet_store(uh, 0);
+      fr->pkt_code = ch - 1;
+      if( ch == 0xff ) {
+        fr->pkt_state &= ~PKT_ZERO;
+      } else {
+        fr->pkt_state |= PKT_ZERO;
+      }
+      return;
+    }
+
+    fr->pkt_code--;
+    uart_packet_store(uh, ch);
+    return;
+  }
+
+  // SLIP
+  if( fr->pkt_state & PKT_ESC ) {
+    fr->pkt_state &= ~PKT_ESC;
+    if( ch == SLIP_ESC_END ) {
+      uart_packet_store(uh, SLIP_END);
+    } else if( ch == SLIP_ESC_ESC ) {
+      uart_packet_store(uh, SLIP_ESC);
+    } else {
+      fr->pkt_state |= PKT_ERROR;
+      if( ch == SLIP_END ) uart_packet_end(uh, 1);
+    }
+    return;
+  }
+
+  switch( ch ) {
+  case SLIP_END:
+    uart_packet_end(uh, 0);
+    break;
+  case SLIP_ESC:
+    fr->pkt_state |= PKT_ESC;
+    break;
+  default:
+    uart_packet_store(uh, ch);
+  }
+}
+
+
+//================================================================
+/*! count receive errors.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  sts           Rx status.
+  @note
+    Called from Rx ISR.
+*/
+void uart_rx_error_count(UART_HANDLE *uh, uint8_t sts)
+{
+  const UART_HW *hw = uh->hw;
+
+  if( sts & hw->RX_STS_OVERRUN )    uh->stat.rx_overrun++;
+  if( sts & hw->RX_STS_STOP_ERROR ) uh->stat.rx_framing_error++;
+  if( sts & hw->RX_STS_PAR_ERROR )  uh->stat.rx_parity_error++;
+  if( sts & hw->RX_STS_BREAK )      uh->stat.rx_break++;
+}
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! tick for timeout.
+
+  @note
+    Call this every UART_TICK_MS ms. e.g. from SysTick
+      CySysTickStart();
+      CySysTickSetCallback(0, uart_tick);
+*/
+void uart_tick(void)
+{
+  uart_tick_count += UART_TICK_MS;
+}
+
+
+//================================================================
+/*! initialize
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  hw            Component functions. (constant table)
+  @param  rxbuf         Pointer of buffer for rxfifo.
+  @param  rxsize        Size of rxbuf.
+  @param  txbuf         Pointer of buffer for txfifo.
+  @param  txsize        Size of txbuf.
+  @note
+    Don't use this directry. Use uart_init macro.
+*/
+void uart_init_m(UART_HANDLE *uh,
+                 const UART_HW *hw,
+                 void        *rxbuf,
+                 uint16_t     rxsize,
+                 void        *txbuf,
+                 uint16_t     txsize)
+{
+#if defined(UART_RING_POW2)
+  // sizes must be power of 2. rounded down, not to overrun the buffers
+  // when CYASSERT doesn't halt.
+  CYASSERT( (rxsize & (rxsize - 1)) == 0 && (txsize & (txsize - 1)) == 0 );
+  while( rxsize & (rxsize - 1) ) rxsize &= rxsize - 1;
+  while( txsize & (txsize - 1) ) txsize &= txsize - 1;
+#endif
+
+  *uh = (UART_HANDLE){
+    .tx_rd            = 0,
+    .tx_wr            = 0,
+    .tx_resv          = 0,
+    .tx_busy          = 0,
+    .txfifo           = txbuf,
+    .tx_size          = txsize,
+    .flag_tx_finished = 1,
+    .mode             = 0,
+    .rx_overflow      = 0,
+    .delimiter        = '\n',
+    .rx_rd            = 0,
+    .rx_wr            = 0,
+    .rx_delim_in      = 0,
+    .rx_delim_out     = 0,
+    .rx_delim_pos     = 0,
+    .rxfifo           = rxbuf,
+    .rx_size          = rxsize,
+    .stat             = {0},
+    .callback         = 0,
+    .callback_events  = 0,
+    .rx_threshold     = 0,
+    .hw               = hw,
+  };
+
+  hw->Start();
+  if( hw->ClearTxBuffer ) hw->ClearTxBuffer();
+  if( hw->ClearRxBuffer ) hw->ClearRxBuffer();
+}
+
+
+//================================================================
+/*! start DMA transmit.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  size          Size of contiguous data from tx_rd.
+  @note
+    Call this when the hardware FIFO is empty.
+    The first byte is written by CPU, and the following FIFO empty
+    requests drive the DMA. Tx ISR is disabled until DMA completion.
+*/
+void uart_tx_dma_start(UART_HANDLE *uh, uint16_t size)
+{
+  UART_TX_DMA *dma = uh->dma;
+  uint16_t pos = uart_ring_pos(uh->tx_rd, uh->tx_size);
+
+  dma->TxIsrDisable();
+  dma->size = size;
+  if( uh->rs485 ) uh->rs485->sent += size;
+
+  CyDmaTdSetConfiguration(dma->td, size - 1, CY_DMA_DISABLE_TD,
+                          CY_DMA_TD_INC_SRC_ADR | dma->termout);
+  CyDmaTdSetAddress(dma->td, LO16((uint32)&uh->txfifo[pos + 1]),
+                    LO16((uint32)dma->p_txdata));
+  CyDmaChSetInitialTd(dma->ch, dma->td);
+  CyDmaChEnable(dma->ch, 1);
+
+  uh->hw->WriteTxData( uh->txfifo[pos] );
+}
+
+
+//================================================================
+/*! initialize DMA transmit.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  dma           Pointer of UART_TX_DMA. (supplied by the caller)
+  @note
+    Don't use this directry. Use uart_init_tx_dma macro.
+*/
+void uart_init_tx_dma_m(UART_HANDLE *uh,
+                        UART_TX_DMA *dma,
+                        uint8_t      dma_ch,
+                        uint8_t      td_termout,
+                        void        *p_txdata,
+                        void       (*TxIsrEnable)(void),
+                        void       (*TxIsrDisable)(void))
+{
+  *dma = (UART_TX_DMA){
+    .ch           = dma_ch,
+    .td           = CyDmaTdAllocate(),
+    .termout      = td_termout,
+    .size         = 0,
+    .p_txdata     = p_txdata,
+    .TxIsrEnable  = TxIsrEnable,
+    .TxIsrDisable = TxIsrDisable,
+  };
+
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->dma = dma;
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! initialize flow control.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  flow          Pointer of UART_FLOW. (supplied by the caller)
+  @param  RtsWrite      NAME_Write function of RTS pin, or 0.
+  @param  CtsRead       NAME_Read function of CTS pin, or 0.
+  @note
+    Don't use this directry. Use uart_init_rtscts macro or
+    uart_init_xonxoff().
+    If the handle has UART_FLOW already, it is used and the pins are
+    added to it, so RTS/CTS and XON/XOFF can be used together.
+*/
+void uart_init_flow_m(UART_HANDLE *uh, UART_FLOW *flow,
+                      void (*RtsWrite)(uint8_t), uint8_t (*CtsRead)(void))
+{
+  uint8 interrupts = CyEnterCriticalSection();
+
+  if( uh->flow ) {
+    flow = uh->flow;
+  } else {
+    *flow = (UART_FLOW){
+      .rx_high = uh->rx_size * 3 / 4,
+      .rx_low  = uh->rx_size / 4,
+    };
+    uh->flow = flow;
+  }
+  if( RtsWrite ) flow->RtsWrite = RtsWrite;
+  if( CtsRead ) flow->CtsRead = CtsRead;
+
+  CyExitCriticalSection( interrupts );
+
+  if( RtsWrite ) RtsWrite(flow->rx_off);
+}
+
+
+//================================================================
+/*! enable XON/XOFF flow control.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  flow          Pointer of UART_FLOW. (supplied by the caller)
+  @note
+    Sets UART_XONXOFF mode. XON/XOFF received are not stored in rxfifo.
+    Binary data including 0x11 and 0x13 can not be received.
+*/
+void uart_init_xonxoff(UART_HANDLE *uh, UART_FLOW *flow)
+{
+  uart_init_flow_m(uh, flow, 0, 0);
+  uh->mode |= UART_XONXOFF;
+}
+
+
+//================================================================
+/*! initialize RS-485 half duplex.
+
+  @internal
+  @param  uh              Pointer of UART_HANDLE.
+  @param  rs485           Pointer of UART_RS485. (supplied by the caller)
+  @param  tx_sts_complete NAME_TX_STS_COMPLETE
+  @param  SetTxInterruptMode  NAME_SetTxInterruptMode function.
+  @param  DeWrite         NAME_Write function of DE pin.
+  @note
+    Don't use this directry. Use uart_init_rs485 macro.
+    DE is asserted before the first byte, and released by Tx ISR on
+    TX complete status, i.e. after the stop bit of the last byte.
+    Tx ISR waits it in two stages. At FIFO empty after all data, it
+    switches the interrupt source to TX complete, and releases DE on
+    the next TX complete. (see uart_rs485_arm)
+    Set UART_RS485_ECHO mode by uart_set_mode(), if the receiver is
+    always enabled and hears own transmission. The same num of bytes
+    as transmitted are discarded by Rx ISR.
+*/
+void uart_init_rs485_m(UART_HANDLE *uh, UART_RS485 *rs485,
+                       uint8_t tx_sts_complete,
+                       void (*SetTxInterruptMode)(uint8_t),
+                       void (*DeWrite)(uint8_t))
+{
+  *rs485 = (UART_RS485){
+    .de              = 0,
+    .armed           = 0,
+    .TX_STS_COMPLETE = tx_sts_complete,
+    .sent            = 0,
+    .echo            = 0,
+    .SetTxInterruptMode = SetTxInterruptMode,
+    .DeWrite         = DeWrite,
+  };
+  DeWrite(0);
+
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->rs485 = rs485;
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! enable address filter.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  af            Pointer of UART_ADDR_FILTER. (supplied by the caller)
+  @param  rx_sts_mrkspc NAME_RX_STS_MRKSPC, or 0 for prefix mode.
+  @param  prefix        Byte before address byte. (prefix mode)
+  @param  address       Address of this node.
+  @param  broadcast     Broadcast address. (same as address if not used)
+  @note
+    Don't use this directry. Use uart_set_address_mark macro or
+    uart_set_address_prefix().
+*/
+void uart_set_address_filter_m(UART_HANDLE *uh, UART_ADDR_FILTER *af,
+                               uint8_t rx_sts_mrkspc, uint8_t prefix,
+                               uint8_t address, uint8_t broadcast)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+  *af = (UART_ADDR_FILTER){
+    .RX_STS_MRKSPC = rx_sts_mrkspc,
+    .prefix        = prefix,
+    .address       = address,
+    .broadcast     = broadcast,
+    .next          = 0,
+    .match         = 0,
+  };
+  uh->addr_filter = af;
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! enable address filter by reserved prefix.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  af            Pointer of UART_ADDR_FILTER. (supplied by the caller)
+  @param  prefix        Reserved byte before address byte.
+  @param  address       Address of this node.
+  @param  broadcast     Broadcast address. (same as address if not used)
+  @note
+    Frame format: prefix, address, data... (until the next prefix)
+    Rx ISR discards frames to the other nodes before storing them.
+    The prefix must not appear in data. The prefix is not stored,
+    and the address byte is stored at the top of the frame.
+*/
+void uart_set_address_prefix(UART_HANDLE *uh, UART_ADDR_FILTER *af,
+                             uint8_t prefix, uint8_t address, uint8_t broadcast)
+{
+  uart_set_address_filter_m(uh, af, 0, prefix, address, broadcast);
+}
+
+
+//================================================================
+/*! disable address filter.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    UART_ADDR_FILTER is not used by the handle after this.
+*/
+void uart_clear_address_filter(UART_HANDLE *uh)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->addr_filter = 0;
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! set watermarks of flow control. (RTS/CTS, XON/XOFF)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  high          rxfifo bytes to stop the peer.
+  @param  low           rxfifo bytes to restart the peer.
+  @note
+    Call this after uart_init_rtscts() or uart_init_xonxoff().
+    Default watermarks are 3/4 and 1/4 of rxfifo.
+    Leave room above high for the bytes the peer sends after it
+    was requested to stop. (at least the peer's FIFO size)
+*/
+void uart_set_rx_watermark(UART_HANDLE *uh, uint16_t high, uint16_t low)
+{
+  if( !uh->flow ) return;
+
+  uh->flow->rx_high = high;
+  uh->flow->rx_low  = low;
+}
+
+
+//================================================================
+/*! restart transmit paused by CTS.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Call this from the interrupt of CTS pin (falling edge), which has
+    the same priority as Tx ISR, or periodically in main.
+*/
+void uart_cts_changed(UART_HANDLE *uh)
+{
+  uart_tx_resume(uh);
+}
+
+
+//================================================================
+/*! Clear transmit buffer.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+*/
+void uart_clear_tx_buffer(UART_HANDLE *uh)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+  if( uh->dma && uh->dma->size != 0 ) {
+    CyDmaChDisable(uh->dma->ch);
+    uh->dma->size = 0;
+    uh->dma->TxIsrEnable();
+  }
+  uh->hw->ClearTxBuffer();
+  uh->tx_rd = uh->tx_wr;
+  if( uh->flow ) uh->flow->tx_wait = 0;
+  uh->flag_tx_finished = 1;
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! Clear receive buffer.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+*/
+void uart_clear_rx_buffer(UART_HANDLE *uh)
+{
+  uh->hw->ClearRxBuffer();
+
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->rx_rd = 0;
+  uh->rx_wr = 0;
+  uh->rx_overflow = 0;
+  uh->rx_delim_in = 0;
+  uh->rx_delim_out = 0;
+  if( uh->frame ) {
+    UART_FRAMEQ *fr = uh->frame;
+    fr->open = 0;
+    fr->rd = fr->wr;
+    fr->pkt_wr = 0;
+    fr->pkt_code = 0;
+    fr->pkt_state = 0;
+  }
+  if( uh->addr_filter ) {
+    uh->addr_filter->next = 0;
+    uh->addr_filter->match = 0;
+  }
+  if( uh->flow && uh->flow->rx_off ) {
+    uh->flow->rx_off = 0;
+    if( uh->flow->RtsWrite ) uh->flow->RtsWrite(0);
+    if( uh->mode & UART_XONXOFF ) uart_tx_ctrl(uh, UART_XON);
+  }
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! Send out binary data.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return               Size of queued bytes, or -1 if timeout.
+  @note
+    Data is copied into txfifo, so the buffer can be reused immediately.
+    If txfifo is full, it blocks execution until all data are queued.
+    (In UART_WRITE_NONBLOCK mode, returns the size that could be queued.)
+    ISRs can write to the same handle by uart_write_atomic() meanwhile.
+*/
+int uart_write(UART_HANDLE *uh, const void *buffer, size_t size)
+{
+  return uart_write_timeout(uh, buffer, size, UART_TIMEOUT_FOREVER);
+}
+
+
+//================================================================
+/*! Send out binary data with timeout.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @param  timeout       Timeout in ms, or UART_TIMEOUT_FOREVER.
+  @return               Size of queued bytes, or -1 if timeout.
+  @note
+    Same as uart_write(). When timeout occurs, the data queued
+    until then will be transmitted.
+*/
+int uart_write_timeout(UART_HANDLE *uh, const void *buffer, size_t size, uint32_t timeout)
+{
+  const uint8_t *buf = buffer;
+  size_t cnt = size;
+  uint32_t deadline = uart_deadline(timeout);
+
+  while( 1 ) {
+    // copy buffer to the reserved space of fifo.
+    uint16_t idx;
+    uint16_t n = uart_tx_reserve(uh, 0, (cnt < uh->tx_size) ? cnt : uh->tx_size, &idx);
+    uart_tx_copy(uh, idx, buf, n);
+    uart_tx_commit(uh);
+    buf += n;
+    cnt -= n;
+
+    if( cnt == 0 ) break;
+    if( uh->mode & UART_WRITE_NONBLOCK ) return size - cnt;
+
+    // wait for space of fifo.
+    if( uart_wait(deadline) != 0 ) {
+#ifdef UART_CHECK_TIMEOUT
+      uart_stop_timeout();
+#endif
+      return -1;
+    }
+  }
+
+#ifdef UART_CHECK_TIMEOUT
+  if( !(uh->mode & UART_WRITE_NONBLOCK) ) uart_stop_timeout();
+#endif
+  return size;
+}
+
+
+//================================================================
+/*! Send out binary data, all or nothing. (ISR safe)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return               Size of queued bytes, or 0 if txfifo doesn't have space.
+  @note
+    Never blocks, and can be called from ISR. The data is queued in
+    one piece, so it is never interleaved with the other writers.
+    Reserve and copy are lock-free. Only the kick of Tx at commit
+    disables interrupts for a moment.
+*/
+int uart_write_atomic(UART_HANDLE *uh, const void *buffer, size_t size)
+{
+  if( size > uh->tx_size ) return 0;
+
+  uint16_t idx;
+  uint16_t n = uart_tx_reserve(uh, size, size, &idx);
+  uart_tx_copy(uh, idx, buffer, n);
+  uart_tx_commit(uh);
+
+  return n;
+}
+
+
+//================================================================
+/*! Formatted output.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  fmt           Format string.
+  @return int           Num of output characters, or -1 if timeout.
+  @see uart_vprintf
+*/
+int uart_printf(UART_HANDLE *uh, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  int ret = uart_vprintf(uh, fmt, ap);
+  va_end(ap);
+
+  return ret;
+}
+
+
+//================================================================
+/*! Formatted output. (va_list version)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  fmt           Format string.
+  @param  ap            Arguments.
+  @return int           Num of output characters, or -1 if timeout.
+  @note
+    Output is passed to uart_write() in UART_PRINTF_CHUNK bytes chunks,
+    without formatting whole string into a buffer.
+    Conversions: %d %i %u %x %X %c %s %% and %q. (flags '-' '0', width,
+    precision and '*' are available. 'l' and 'h' are accepted.)
+    Precision of %d %u %x is the minimum num of digits, as C printf.
+    %q is fixed point. Precision is the num of decimal places.
+      e.g. uart_printf(uh, "%.1q", 253) -> "25.3"
+    No floating point.
+*/
+int uart_vprintf(UART_HANDLE *uh, const char *fmt, va_list ap)
+{
+  UART_PRINTF pf = { .uh = uh, .n = 0, .total = 0 };
+
+  while( *fmt ) {
+    if( *fmt != '%' ) {
+      uart_printf_putc(&pf, *fmt++);
+      continue;
+    }
+    fmt++;
+
+    // flags, width, precision and length.
+    int flags = 0;
+    int width = 0;
+    int prec  = -1;
+    int is_long = 0;
+
+    while( *fmt == '-' || *fmt == '0' ) {
+      if( flags != '-' ) flags = *fmt;
+      fmt++;
+    }
+    if( *fmt == '*' ) {
+      width = va_arg(ap, int);
+      if( width < 0 ) {         // negative width is '-' flag.
+        flags = '-';
+        width = -width;
+      }
+      fmt++;
+    } else {
+      while( *fmt >= '0' && *fmt <= '9' ) width = width * 10 + (*fmt++ - '0');
+    }
+    if( *fmt == '.' ) {
+      fmt++;
+      prec = 0;
+      if( *fmt == '*' ) {
+        prec = va_arg(ap, int);
+        if( prec < 0 ) prec = -1;       // negative precision is omitted.
+        fmt++;
+      } else {
+        while( *fmt >= '0' && *fmt <= '9' ) prec = prec * 10 + (*fmt++ - '0');
+      }
+    }
+    while( *fmt == 'l' || *fmt == 'h' ) {
+      if( *fmt++ == 'l' ) is_long = 1;
+    }
+
+    // '0' flag is ignored with the precision, except fixed point.
+    if( flags == '0' && prec >= 0 && *fmt != 'q' ) flags = 0;
+
+    // conversion.
+    int32_t  v;
+    uint32_t u;
+    switch( *fmt ) {
+    case 'd':
+    case 'i':
+    case 'q':
+      v = is_long ? (int32_t)va_arg(ap, long) : va_arg(ap, int);
+      if( *fmt == 'q' ) {
+        uart_printf_number(&pf, (v < 0) ? -(uint32_t)v : (uint32_t)v, v < 0, 10,
+                           (prec > 0) ? prec : 0, 1, width, flags, "0123456789");
+      } else {
+        uart_printf_number(&pf, (v < 0) ? -(uint32_t)v : (uint32_t)v, v < 0, 10,
+                           0, (prec < 0) ? 1 : prec, width, flags, "0123456789");
+      }
+      break;
+
+    case 'u':
+    case 'x':
+    case 'X':
+      u = is_long ? (uint32_t)va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+      uart_printf_number(&pf, u, 0, (*fmt == 'u') ? 10 : 16, 0,
+                         (prec < 0) ? 1 : prec, width, flags,
+                         (*fmt == 'X') ? "0123456789ABCDEF" : "0123456789abcdef");
+      break;
+
+    case 'c':
+      if( flags != '-' ) uart_printf_pad(&pf, ' ', width - 1);
+      uart_printf_putc(&pf, va_arg(ap, int));
+      if( flags == '-' ) uart_printf_pad(&pf, ' ', width - 1);
+      break;
+
+    case 's': {
+      const char *s = va_arg(ap, const char *);
+      int len = 0;
+      int i;
+      if( !s ) s = "(null)";
+      while( s[len] && (prec < 0 || len < prec) ) len++;
+      if( flags != '-' ) uart_printf_pad(&pf, ' ', width - len);
+      for( i = 0; i < len; i++ ) uart_printf_putc(&pf, s[i]);
+      if( flags == '-' ) uart_printf_pad(&pf, ' ', width - len);
+    } break;
+
+    case '\0':
+      continue;
+
+    default:            // '%%' and unknown conversions.
+      uart_printf_putc(&pf, *fmt);
+      break;
+    }
+    fmt++;
+  }
+
+  uart_printf_flush(&pf);
+  return pf.total;
+}
+
+
+//================================================================
+/*! Receive binary data.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Num of received bytes.
+
+  @note                 If no data received, it blocks execution.
+*/
+int uart_read(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  return uart_read_timeout(uh, buffer, size, UART_TIMEOUT_FOREVER);
+}
+
+
+//================================================================
+/*! Receive binary data with timeout.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @param  timeout       Timeout in ms, or UART_TIMEOUT_FOREVER.
+  @return int           Num of received bytes, or -1 if timeout.
+*/
+int uart_read_timeout(UART_HANDLE *uh, void *buffer, size_t size, uint32_t timeout)
+{
+  if( size == 0 ) return 0;
+
+  // wait for data.
+  uint32_t deadline = uart_deadline(timeout);
+  while( !uart_is_readable(uh) ) {
+    if( uart_wait(deadline) != 0 ) {
+#ifdef UART_CHECK_TIMEOUT
+      uart_stop_timeout();
+#endif
+      return -1;
+    }
+  }
+
+  // copy fifo to buffer
+  int n = uart_rx_copy(uh, buffer, size);
+
+#ifdef UART_CHECK_TIMEOUT
+  uart_stop_timeout();
+#endif
+  return n;
+}
+
+
+//================================================================
+/*! Receive string.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buf           Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Num of received bytes.
+
+  @note                 If no data received, it blocks execution.
+*/
+int uart_gets(UART_HANDLE *uh, char *buf, size_t size)
+{
+  return uart_gets_timeout(uh, buf, size, UART_TIMEOUT_FOREVER);
+}
+
+
+//================================================================
+/*! Receive string with timeout.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buf           Pointer of buffer.
+  @param  size          Size of buffer.
+  @param  timeout       Timeout in ms, or UART_TIMEOUT_FOREVER.
+  @return int           Num of received bytes, or -1 if timeout.
+  @note
+    If size is 0, returns 0 immediately. (nothing is stored)
+*/
+int uart_gets_timeout(UART_HANDLE *uh, char *buf, size_t size, uint32_t timeout)
+{
+  if( size == 0 ) return 0;
+
+  char  *p   = buf;
+  size_t cnt = size - 1;
+  uint32_t deadline = uart_deadline(timeout);
+
+  while( cnt > 0 ) {
+    // copy a line, if the delimiter was received.
+    int n = uart_rx_line_length(uh);
+    if( n > 0 ) {
+      if( n > cnt ) n = cnt;
+      p += uart_rx_copy(uh, p, n);
+      break;
+    }
+
+    // copy received data, which doesn't include the delimiter.
+    n = uart_bytes_available(uh);
+    if( n > 0 && uh->rx_delim_in == uh->rx_delim_out ) {
+      if( n > cnt ) n = cnt;
+      p += uart_rx_copy(uh, p, n);
+      cnt -= n;
+      continue;
+    }
+    if( n > 0 ) continue;
+
+    // wait for data.
+    if( uart_wait(deadline) != 0 ) {
+#ifdef UART_CHECK_TIMEOUT
+      uart_stop_timeout();
+#endif
+      *buf = '\0';
+      return -1;
+    }
+  }
+  *p = '\0';
+
+#ifdef UART_CHECK_TIMEOUT
+  uart_stop_timeout();
+#endif
+  return p - buf;
+}
+
+
+//================================================================
+/*! Receive binary block data.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Num of received bytes.
+*/
+int uart_read_block(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  uint8 *buf = buffer;
+  size_t cnt = size;
+
+  while( cnt > 0 ) {
+    int n = uart_read(uh, buf, cnt);
+    if( n < 0 ) return n;
+    cnt -= n;
+    buf += n;
+  }
+
+  return size;
+}
+
+
+//================================================================
+/*! Receive binary data. (non block)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Num of received bytes.
+*/
+int uart_read_nonblock(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  return uart_rx_copy(uh, buffer, size);
+}
+
+
+//================================================================
+/*! Peek received data without copy.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  pp            Pointer to store the address of received data in rxfifo.
+  @return int           Num of contiguous readable bytes.
+  @note
+    Data is kept in rxfifo until uart_rx_consume() is called.
+    If data wraps around the end of rxfifo, only the first part is returned.
+    Call again after uart_rx_consume() to get the rest.
+*/
+int uart_rx_peek(UART_HANDLE *uh, const uint8_t **pp)
+{
+  uint16_t rx_rd = uh->rx_rd;
+  uint16_t pos   = uart_ring_pos(rx_rd, uh->rx_size);
+  uint16_t n     = uart_ring_count(rx_rd, uh->rx_wr, uh->rx_size);
+
+  UART_RING_BARRIER();
+  *pp = (const uint8_t *)&uh->rxfifo[pos];
+
+  if( n > uh->rx_size - pos ) n = uh->rx_size - pos;
+  return n;
+}
+
+
+//================================================================
+/*! Discard received data. (after uart_rx_peek)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  size          Num of bytes to discard. (<= return value of uart_rx_peek)
+*/
+void uart_rx_consume(UART_HANDLE *uh, size_t size)
+{
+  uint16_t rx_rd = uh->rx_rd;
+  const uint8_t *p = (const uint8_t *)&uh->rxfifo[uart_ring_pos(rx_rd, uh->rx_size)];
+
+  // count before the bytes are handed back to Rx ISR.
+  int n_delim = uart_rx_delimiter_count(uh, p, size);
+
+  UART_RING_BARRIER();
+  uh->rx_rd = uart_ring_add(rx_rd, size, uh->rx_size);
+  uart_rx_delimiter_consumed(uh, n_delim);
+  uart_rx_flow_check(uh);
+}
+
+
+//================================================================
+/*! check data length can be read.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @return int           result (bytes)
+*/
+int uart_bytes_available(UART_HANDLE *uh)
+{
+  return uart_ring_count(uh->rx_rd, uh->rx_wr, uh->rx_size);
+}
+
+
+//================================================================
+/*! check data can be read a line.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @return int           string length.
+  @note
+   If RX-FIFO buffer is full, return -1.
+*/
+int uart_can_read_line(UART_HANDLE *uh)
+{
+  if( uh->rx_overflow ) return -1;
+
+  return uart_rx_line_length(uh);
+}
+
+
+//================================================================
+/*! initialize bridge.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  br            Pointer of UART_BRIDGE. (supplied by the caller)
+  @note
+    Call this for both handles before uart_bridge().
+*/
+void uart_init_bridge(UART_HANDLE *uh, UART_BRIDGE *br)
+{
+  *br = (UART_BRIDGE){0};
+
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->bridge = br;
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! start bridge. (forward received data to the other UART)
+
+  @memberof UART_HANDLE
+  @param  src           Pointer of UART_HANDLE to receive.
+  @param  dst           Pointer of UART_HANDLE to transmit.
+  @return int           0 if success, -1 if uart_init_bridge() is not called.
+  @note
+    Tx ISR of dst reads rxfifo of src directly, and Rx ISR of src
+    starts Tx of dst. No main loop involvement and no extra copy.
+    For full duplex, call also uart_bridge(dst, src).
+    It waits until txfifo of dst becomes empty. While bridging,
+    don't read src and don't write dst. Flow control (RTS/CTS,
+    XON/XOFF) of both handles works as usual, so a slow dst stops
+    the peer of src by the rxfifo watermarks.
+    Byte stream only. (no packet mode or idle gap framing on src)
+*/
+int uart_bridge(UART_HANDLE *src, UART_HANDLE *dst)
+{
+  if( !src->bridge || !dst->bridge ) return -1;
+
+  while( dst->tx_rd != dst->tx_wr ) uart_wait(UART_TIMEOUT_FOREVER);
+
+  uint8 interrupts = CyEnterCriticalSection();
+  dst->bridge->mark_bytes = dst->bridge->bytes;
+  dst->bridge->mark_tick  = uart_tick_count;
+  dst->bridge->src = src;
+  src->bridge->dst = dst;
+  CyExitCriticalSection( interrupts );
+
+  // forward the data already received.
+  uart_tx_kick(dst);
+  return 0;
+}
+
+
+//================================================================
+/*! stop bridge.
+
+  @memberof UART_HANDLE
+  @param  src           Pointer of UART_HANDLE given to uart_bridge().
+  @note
+    Data left in rxfifo of src becomes readable by read functions.
+*/
+void uart_bridge_stop(UART_HANDLE *src)
+{
+  if( !src->bridge || !src->bridge->dst ) return;
+  UART_HANDLE *dst = src->bridge->dst;
+
+  uint8 interrupts = CyEnterCriticalSection();
+  src->bridge->dst = 0;
+  dst->bridge->src = 0;
+
+  // Tx of dst goes back to txfifo, which is empty.
+  dst->flag_tx_finished = 1;
+
+  // delimiters were not counted out while bridging. count them again.
+  uart_rx_delimiter_recount(src);
+  CyExitCriticalSection( interrupts );
+
+  uart_rx_flow_check(src);
+}
+
+
+//================================================================
+/*! get byte rate of bridge.
+
+  @memberof UART_HANDLE
+  @param  dst           Pointer of UART_HANDLE to transmit.
+  @return uint32_t      Forwarded bytes per second since the last call.
+  @note
+    Optional. Needs uart_tick(). Total is in UART_BRIDGE bytes of dst.
+*/
+uint32_t uart_bridge_rate(UART_HANDLE *dst)
+{
+  UART_BRIDGE *br = dst->bridge;
+  if( !br ) return 0;
+
+  uint32_t bytes = br->bytes;
+  uint32_t tick  = uart_tick_count;
+  uint32_t dt    = tick - br->mark_tick;
+  uint32_t n     = bytes - br->mark_bytes;
+
+  if( dt == 0 ) return 0;
+  br->mark_bytes = bytes;
+  br->mark_tick  = tick;
+
+  return (uint64_t)n * 1000 / dt;
+}
+
+
+//================================================================
+/*! get receive statistics.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  st            Pointer of UART_STATISTICS to store the snapshot.
+  @note
+    This doesn't stop the ISR. Each counter is read at once,
+    but counters may be updated by the ISR during the copy.
+*/
+void uart_get_statistics(UART_HANDLE *uh, UART_STATISTICS *st)
+{
+  *st = uh->stat;
+}
+
+
+//================================================================
+/*! clear receive statistics.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+*/
+void uart_clear_statistics(UART_HANDLE *uh)
+{
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->stat = (UART_STATISTICS){0};
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! initialize frame queue. (for idle gap framing and packet mode)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  fr            Pointer of UART_FRAMEQ. (supplied by the caller)
+  @param  q             Array of frame descriptors.
+  @param  n             Num of elements of q.
+  @return int           0 if success, -1 if n is not power of 2. (UART_RING_POW2)
+  @note
+    n is the max num of frames waiting for read. (e.g. 4)
+*/
+int uart_init_frame(UART_HANDLE *uh, UART_FRAMEQ *fr, UART_FRAME *q, uint16_t n)
+{
+#if defined(UART_RING_POW2)
+  if( n == 0 || (n & (n - 1)) ) return -1;
+#endif
+
+  *fr = (UART_FRAMEQ){
+    .size   = n,
+    .q      = q,
+    .pkt_wr = uh->rx_wr,
+  };
+
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->frame = fr;
+  CyExitCriticalSection( interrupts );
+
+  return 0;
+}
+
+
+//================================================================
+/*! enable idle gap framing.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  GetTime       Function returns free running (count up) time.
+  @param  gap           Idle time to close a frame, in the unit of GetTime.
+  @return int           0 if success, -1 if uart_init_frame() is not called.
+  @note
+    A frame is closed when the next byte arrives after the gap, or
+    when uart_frame_poll() finds the gap. (e.g. Modbus RTU: 3.5 chars)
+    GetTime is called from Rx ISR. Set this before receiving data.
+    Don't mix frame functions and other read functions.
+*/
+int uart_set_frame_gap(UART_HANDLE *uh, uint16_t (*GetTime)(void), uint16_t gap)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  if( !fr ) return -1;
+
+  fr->gap = gap;
+  fr->open = 0;
+  fr->rd = fr->wr;
+  fr->GetTime = GetTime;
+  return 0;
+}
+
+
+//================================================================
+/*! close the last frame if the line is idle.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @note
+    Frame read functions call this. Call this also from a periodic
+    timer ISR, to get UART_EVENT_RX_FRAME without the next frame.
+*/
+void uart_frame_poll(UART_HANDLE *uh)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  if( !fr || !fr->open ) return;
+
+  uint8 interrupts = CyEnterCriticalSection();
+  if( fr->open && (uint16_t)(fr->GetTime() - fr->time) >= fr->gap ) {
+    uart_frame_close(uh, uh->rx_wr);
+  }
+  CyExitCriticalSection( interrupts );
+}
+
+
+//================================================================
+/*! get the oldest received frame. (zero copy)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @return               Pointer of the frame descriptor, or NULL if no frame.
+  @note
+    The data is kept in rxfifo until uart_frame_discard() is called.
+    Use uart_frame_byte() to read it.
+*/
+const UART_FRAME *uart_frame_peek(UART_HANDLE *uh)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  if( !fr ) return 0;
+
+  uart_frame_poll(uh);
+
+  uint16_t rd = fr->rd;
+  if( rd == fr->wr ) return 0;
+
+  UART_RING_BARRIER();
+  return &fr->q[uart_ring_pos(rd, fr->size)];
+}
+
+
+//================================================================
+/*! discard the oldest received frame.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+*/
+void uart_frame_discard(UART_HANDLE *uh)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  if( !fr ) return;
+
+  uint16_t rd = fr->rd;
+  if( rd == fr->wr ) return;
+
+  // consume up to the end of the frame, including skipped bytes.
+  const UART_FRAME *frame = &fr->q[uart_ring_pos(rd, fr->size)];
+  uint16_t end = uart_ring_add(frame->start, frame->length, uh->rx_size);
+  uint16_t n   = uart_ring_count(uh->rx_rd, end, uh->rx_size);
+
+  while( n > 0 ) {
+    const uint8_t *p;
+    uint16_t n1 = uart_rx_peek(uh, &p);
+    if( n1 > n ) n1 = n;
+    uart_rx_consume(uh, n1);
+    n -= n1;
+  }
+
+  UART_RING_BARRIER();
+  fr->rd = uart_ring_add(rd, 1, fr->size);
+}
+
+
+//================================================================
+/*! Receive a frame. (non block)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Num of received bytes, or 0 if no frame.
+  @note
+    If the frame is longer than the buffer, the rest is discarded.
+    If size is 0, returns 0 and the frame is kept. (frames are never empty)
+*/
+int uart_read_frame(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  if( size == 0 ) return 0;
+
+  const UART_FRAME *frame = uart_frame_peek(uh);
+  if( !frame ) return 0;
+
+  uint8_t *buf = buffer;
+  uint16_t pos = uart_ring_pos(frame->start, uh->rx_size);
+  size_t   n   = frame->length;
+  size_t   n1  = uh->rx_size - pos;
+
+  if( n > size ) n = size;
+  if( n1 > n ) n1 = n;
+  memcpy( buf, (const char *)&uh->rxfifo[pos], n1 );
+  memcpy( buf + n1, (const char *)uh->rxfifo, n - n1 );
+
+  uart_frame_discard(uh);
+  return n;
+}
+
+
+//================================================================
+/*! set packet framing mode.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  mode          UART_PACKET_COBS, UART_PACKET_SLIP or 0 (byte stream).
+  @return int           0 if success, -1 if uart_init_frame() is not called.
+  @note
+    Rx ISR decodes packets into rxfifo, and puts them into the frame
+    queue. Only the complete packets become readable.
+    Don't mix packet functions and other read functions, and don't use
+    with idle gap framing or XON/XOFF.
+*/
+int uart_set_packet_mode(UART_HANDLE *uh, int mode)
+{
+  UART_FRAMEQ *fr = uh->frame;
+  if( !fr && mode ) return -1;
+
+  uint8 interrupts = CyEnterCriticalSection();
+  uh->mode = (uh->mode & ~(UART_PACKET_COBS | UART_PACKET_SLIP)) | mode;
+  if( fr ) {
+    fr->pkt_wr = uh->rx_wr;
+    fr->pkt_code = 0;
+    fr->pkt_state = 0;
+    fr->rd = fr->wr;
+  }
+  CyExitCriticalSection( interrupts );
+  return 0;
+}
+
+
+//================================================================
+/*! get the size of the encoded packet.
+
+  @param  uh            Pointer of UART_HANDLE.
+  @param  p             Pointer of packet data.
+  @param  size          Size of packet data.
+  @return size_t        Size of the encoded packet, including delimiters.
+*/
+static size_t uart_packet_encoded_size(UART_HANDLE *uh, const uint8_t *p, size_t size)
+{
+  const uint8_t *p_end = p + size;
+  size_t n_enc = size;
+
+  if( uh->mode & UART_PACKET_COBS ) {
+    // a code byte per block, and a zero ends a block without output.
+    while( 1 ) {
+      const uint8_t *p_zero = memchr( p, 0, p_end - p );
+      size_t n = (p_zero ? p_zero : p_end) - p;
+      if( n > 254 ) n = 254;
+
+      n_enc++;
+      p += n;
+      if( p == p_end ) break;
+      if( n != 254 ) {
+        p++;
+        n_enc--;
+      }
+    }
+    return n_enc + 1;
+  }
+
+  // SLIP: END and ESC are escaped by 2 bytes.
+  while( (p = memchr( p, SLIP_END, p_end - p )) != 0 ) {
+    n_enc++;
+    p++;
+  }
+  p = p_end - size;
+  while( (p = memchr( p, SLIP_ESC, p_end - p )) != 0 ) {
+    n_enc++;
+    p++;
+  }
+  return n_enc + 2;
+}
+
+
+//================================================================
+/*! Send a packet.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of packet data.
+  @param  size          Size of packet data.
+  @return int           Size of the packet data, or -1 if error.
+  @note
+    The space for the whole encoded packet is reserved at once, and
+    the packet is encoded directly into it, without staging buffer.
+    So ISRs can write the same handle by uart_write_atomic() meanwhile,
+    and their data never lands inside the packet.
+    The encoded packet must fit in txfifo. (-1 if not)
+    In UART_WRITE_NONBLOCK mode, returns 0 if txfifo doesn't have
+    space for the encoded packet, so that a packet is never cut off.
+*/
+int uart_send_packet(UART_HANDLE *uh, const void *buffer, size_t size)
+{
+  static const uint8_t slip_esc[][2] = {{ SLIP_ESC, SLIP_ESC_END },
+                                        { SLIP_ESC, SLIP_ESC_ESC }};
+  const uint8_t *p = buffer;
+  const uint8_t *p_end = p + size;
+
+  if( !(uh->mode & (UART_PACKET_COBS | UART_PACKET_SLIP)) ) return -1;
+
+  // the whole encoded packet must fit in empty txfifo.
+  size_t n_enc = uart_packet_encoded_size(uh, p, size);
+  if( n_enc > uart_ring_space(0, 0, uh->tx_size) ) return -1;
+
+  // reserve the whole encoded packet.
+  uint16_t idx;
+  while( uart_tx_reserve(uh, n_enc, n_enc, &idx) == 0 ) {
+    uart_tx_commit(uh);
+    if( uh->mode & UART_WRITE_NONBLOCK ) return 0;
+
+    // wait for space of fifo.
+    if( uart_wait(UART_TIMEOUT_FOREVER) != 0 ) {
+#ifdef UART_CHECK_TIMEOUT
+      uart_stop_timeout();
+#endif
+      return -1;
+    }
+  }
+#ifdef UART_CHECK_TIMEOUT
+  if( !(uh->mode & UART_WRITE_NONBLOCK) ) uart_stop_timeout();
+#endif
+
+  if( uh->mode & UART_PACKET_COBS ) {
+    // code byte and the following data up to the next zero. (max 254)
+    while( 1 ) {
+      const uint8_t *p_zero = memchr( p, 0, p_end - p );
+      size_t n = (p_zero ? p_zero : p_end) - p;
+      if( n > 254 ) n = 254;
+
+      uint8_t code = n + 1;
+      uart_tx_copy(uh, idx, &code, 1);
+      uart_tx_copy(uh, uart_ring_add(idx, 1, uh->tx_size), p, n);
+      idx = uart_ring_add(idx, n + 1, uh->tx_size);
+      p += n;
+
+      if( p == p_end ) break;
+      if( n != 254 ) p++;       // skip the zero.
+    }
+    uart_tx_copy(uh, idx, "", 1);
+
+  } else {
+    // SLIP: END also at the top, to flush the noise on the line.
+    static const uint8_t slip_end[] = { SLIP_END };
+    uart_tx_copy(uh, idx, slip_end, 1);
+    idx = uart_ring_add(idx, 1, uh->tx_size);
+    while( p < p_end ) {
+      const uint8_t *p1 = p;
+      while( p1 < p_end && *p1 != SLIP_END && *p1 != SLIP_ESC ) p1++;
+      uart_tx_copy(uh, idx, p, p1 - p);
+      idx = uart_ring_add(idx, p1 - p, uh->tx_size);
+      if( p1 == p_end ) break;
+      uart_tx_copy(uh, idx, slip_esc[*p1 == SLIP_ESC], 2);
+      idx = uart_ring_add(idx, 2, uh->tx_size);
+      p = p1 + 1;
+    }
+    uart_tx_copy(uh, idx, slip_end, 1);
+  }
+
+  uart_tx_commit(uh);
+  return size;
+}
+
+
+//================================================================
+/*! Receive a packet.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @return int           Size of the packet.
+  @note
+    If no packet received, it blocks execution.
+    If the packet is longer than the buffer, the rest is discarded.
+    If size is 0, returns 0 immediately and the packet is kept.
+*/
+int uart_recv_packet(UART_HANDLE *uh, void *buffer, size_t size)
+{
+  return uart_recv_packet_timeout(uh, buffer, size, UART_TIMEOUT_FOREVER);
+}
+
+
+//================================================================
+/*! Receive a packet with timeout.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  buffer        Pointer of buffer.
+  @param  size          Size of buffer.
+  @param  timeout       Timeout in ms, or UART_TIMEOUT_FOREVER.
+  @return int           Size of the packet, or -1 if timeout.
+  @note
+    If size is 0, returns 0 immediately and the packet is kept.
+*/
+int uart_recv_packet_timeout(UART_HANDLE *uh, void *buffer, size_t size, uint32_t timeout)
+{
+  if( size == 0 ) return 0;
+
+  uint32_t deadline = uart_deadline(timeout);
+  int n;
+
+  while( (n = uart_read_frame(uh, buffer, size)) == 0 ) {
+    if( uart_wait(deadline) != 0 ) {
+#ifdef UART_CHECK_TIMEOUT
+      uart_stop_timeout();
+#endif
+      return -1;
+    }
+  }
+
+#ifdef UART_CHECK_TIMEOUT
+  uart_stop_timeout();
+#endif
+  return n;
 }
@@ -22,30 +22,94 @@ extern "C" {
 /***** System headers *******************************************************/
 #include <stdint.h>
 #include <string.h>
+#include <stdarg.h>
 
 
 /***** Local headers ********************************************************/
 /***** Constant values ******************************************************/
 #define UART_WRITE_NONBLOCK 0x01
+#define UART_XONXOFF        0x04
+#define UART_PACKET_COBS    0x08
+#define UART_PACKET_SLIP    0x10
+#define UART_RS485_ECHO     0x20
 
-//! size of FIFO buffer for receive.
+//! characters for XON/XOFF flow control.
+#define UART_XON  0x11
+#define UART_XOFF 0x13
+
+//! events for callback function.
+#define UART_EVENT_TX_DRAINED    0x01
+#define UART_EVENT_RX_THRESHOLD  0x02
+#define UART_EVENT_RX_DELIMITER  0x04
+#define UART_EVENT_RX_FRAME      0x08
+#define UART_EVENT_TX_COMPLETE   0x10
+
+//! timeout value for waiting forever.
+#define UART_TIMEOUT_FOREVER 0xffffffffUL
+
+//! interval of uart_tick() call in ms.
+#ifndef UART_TICK_MS
+# define UART_TICK_MS 1
+#endif
+
+//! minimum size of contiguous data to transmit by DMA.
+#ifndef UART_TX_DMA_MIN_SIZE
+# define UART_TX_DMA_MIN_SIZE 16
+#endif
+
+//! default size of FIFO buffer for receive.
 #ifndef UART_SIZE_RXFIFO
 # define UART_SIZE_RXFIFO 128
 #endif
 
+//! default size of FIFO buffer for transmit.
+#ifndef UART_SIZE_TXFIFO
+# define UART_SIZE_TXFIFO 128
+#endif
+
+//! size of chunk buffer of uart_printf. (on the stack)
+#ifndef UART_PRINTF_CHUNK
+# define UART_PRINTF_CHUNK 16
+#endif
+
+#if defined(UART_RING_POW2) && ((UART_SIZE_RXFIFO & (UART_SIZE_RXFIFO - 1)) || (UART_SIZE_TXFIFO & (UART_SIZE_TXFIFO - 1)))
+# error "UART_SIZE_RXFIFO and UART_SIZE_TXFIFO must be power of 2. (UART_RING_POW2)"
+#endif
+
 
 /***** Macros ***************************************************************/
 
+//! compiler barrier for ring buffer. (see uart_ring_pos)
+#if defined(__GNUC__)
+# define UART_RING_BARRIER() __asm volatile ("" ::: "memory")
+#else
+# define UART_RING_BARRIER() __DMB()
+#endif
+
 //! Convenience macro to define the interrupt handler for TX only.
-#define UART_ISR_TX(uh, NAME)   \
-  CY_ISR(isr_ ## NAME ## _Tx) { \
-    uart_isr_tx(uh);            \
+#define UART_ISR_TX(uh, NAME)                       \
+  CY_ISR(isr_ ## NAME ## _Tx) {                     \
+    uart_isr_tx_t(uh, NAME ## _TX_STS_FIFO_EMPTY,   \
+                  NAME ## _ReadTxStatus,            \
+                  NAME ## _WriteTxData);            \
   }
 
 //! Convenience macro to define the interrupt handler for RX only.
-#define UART_ISR_RX(uh, NAME)   \
-  CY_ISR(isr_ ## NAME ## _Rx) { \
-    uart_isr_rx(uh);            \
+#define UART_ISR_RX(uh, NAME)                       \
+  CY_ISR(isr_ ## NAME ## _Rx) {                     \
+    uart_isr_rx_t(uh, NAME ## _RX_STS_FIFO_NOTEMPTY,\
+                  NAME ## _RX_STS_OVERRUN |         \
+                  NAME ## _RX_STS_STOP_ERROR |      \
+                  NAME ## _RX_STS_PAR_ERROR |       \
+                  NAME ## _RX_STS_BREAK,            \
+                  NAME ## _ReadRxStatus,            \
+                  NAME ## _ReadRxData);             \
+  }
+
+//! Convenience macro to define the interrupt handler for DMA transmit complete.
+#define UART_ISR_TX_DMA(uh, NAME)  \
+  CY_ISR(isr_ ## NAME ## _TxDma) { \
+    uart_isr_tx_dma(uh);           \
   }
 
 //! Convenience macro to define the interrupt handler for Full UART (TX + RX)
@@ -55,61 +119,278 @@ extern "C" {
 
 
 //! Initializer macro for Full UART (TX + RX)
-#define uart_init(uh, NAME)                           \
+#define uart_init(uh, NAME)                                           \
+  do {                                                                \
+    static char rxfifo_[UART_SIZE_RXFIFO];                   \
+    static char txfifo_[UART_SIZE_TXFIFO];                   \
+    uart_init_buffer(uh, NAME, rxfifo_, sizeof(rxfifo_), txfifo_, sizeof(txfifo_)); \
+  } while( 0 )
+
+
+//! Initializer macro for Full UART (TX + RX) with user buffers.
+#define uart_init_buffer(uh, NAME, rxbuf, rxsize, txbuf, txsize) \
   do {                                                \
-    uart_init_m(uh,                                   \
-                NAME ## _TX_STS_FIFO_EMPTY,	      \
-                NAME ## _RX_STS_FIFO_NOTEMPTY,        \
-                NAME ## _Start,                       \
-                NAME ## _Stop,                        \
-                NAME ## _ClearTxBuffer,               \
-                NAME ## _ClearRxBuffer,               \
-                NAME ## _ReadTxStatus,                \
-                NAME ## _ReadRxStatus,                \
-                NAME ## _WriteTxData,                 \
-                NAME ## _ReadRxData);                 \
+    static const UART_HW hw_ = {                      \
+      .Start                = NAME ## _Start,         \
+      .ClearTxBuffer        = NAME ## _ClearTxBuffer, \
+      .ClearRxBuffer        = NAME ## _ClearRxBuffer, \
+      .ReadTxStatus         = NAME ## _ReadTxStatus,  \
+      .ReadRxStatus         = NAME ## _ReadRxStatus,  \
+      .WriteTxData          = NAME ## _WriteTxData,   \
+      .ReadRxData           = NAME ## _ReadRxData,    \
+      .TX_STS_FIFO_EMPTY    = NAME ## _TX_STS_FIFO_EMPTY,    \
+      .RX_STS_FIFO_NOTEMPTY = NAME ## _RX_STS_FIFO_NOTEMPTY, \
+      .RX_STS_OVERRUN       = NAME ## _RX_STS_OVERRUN,       \
+      .RX_STS_STOP_ERROR    = NAME ## _RX_STS_STOP_ERROR,    \
+      .RX_STS_PAR_ERROR     = NAME ## _RX_STS_PAR_ERROR,     \
+      .RX_STS_BREAK         = NAME ## _RX_STS_BREAK,         \
+    };                                                \
+    uart_init_m(uh, &hw_, rxbuf, rxsize, txbuf, txsize); \
     isr_ ## NAME ## _Tx_StartEx(isr_ ## NAME ## _Tx); \
     isr_ ## NAME ## _Rx_StartEx(isr_ ## NAME ## _Rx); \
   } while( 0 )
 
 
 //! Initializer macro for TX only.
-#define uart_init_tx(uh, NAME)                        \
+#define uart_init_tx(uh, NAME)                                        \
+  do {                                                                \
+    static char txfifo_[UART_SIZE_TXFIFO];                   \
+    uart_init_tx_buffer(uh, NAME, txfifo_, sizeof(txfifo_));          \
+  } while( 0 )
+
+
+//! Initializer macro for TX only with user buffer.
+#define uart_init_tx_buffer(uh, NAME, txbuf, txsize)  \
   do {                                                \
-    uart_init_m(uh,                                   \
-                NAME ## _TX_STS_FIFO_EMPTY,           \
-                0,                                    \
-                NAME ## _Start,                       \
-                NAME ## _Stop,                        \
-                NAME ## _ClearTxBuffer,               \
-                0,                                    \
-                NAME ## _ReadTxStatus,                \
-                0,                                    \
-                NAME ## _WriteTxData,                 \
-                0);                                   \
+    static const UART_HW hw_ = {                      \
+      .Start                = NAME ## _Start,         \
+      .ClearTxBuffer        = NAME ## _ClearTxBuffer, \
+      .ReadTxStatus         = NAME ## _ReadTxStatus,  \
+      .WriteTxData          = NAME ## _WriteTxData,   \
+      .TX_STS_FIFO_EMPTY    = NAME ## _TX_STS_FIFO_EMPTY, \
+    };                                                \
+    uart_init_m(uh, &hw_, 0, 0, txbuf, txsize);       \
     isr_ ## NAME ## _Tx_StartEx(isr_ ## NAME ## _Tx); \
   } while( 0 )
 
 
 //! Initializer macro for RX only.
-#define uart_init_rx(uh, NAME)                        \
+#define uart_init_rx(uh, NAME)                                        \
+  do {                                                                \
+    static char rxfifo_[UART_SIZE_RXFIFO];                   \
+    uart_init_rx_buffer(uh, NAME, rxfifo_, sizeof(rxfifo_));          \
+  } while( 0 )
+
+
+//! Initializer macro for RX only with user buffer.
+#define uart_init_rx_buffer(uh, NAME, rxbuf, rxsize)  \
   do {                                                \
-    uart_init_m(uh,                                   \
-                0,                                    \
-                NAME ## _RX_STS_FIFO_NOTEMPTY,        \
-                NAME ## _Start,                       \
-                NAME ## _Stop,                        \
-                0,                                    \
-                NAME ## _ClearRxBuffer,               \
-                0,                                    \
-                NAME ## _ReadRxStatus,                \
-                0,                                    \
-                NAME ## _ReadRxData);                 \
+    static const UART_HW hw_ = {                      \
+      .Start                = NAME ## _Start,         \
+      .ClearRxBuffer        = NAME ## _ClearRxBuffer, \
+      .ReadRxStatus         = NAME ## _ReadRxStatus,  \
+      .ReadRxData           = NAME ## _ReadRxData,    \
+      .RX_STS_FIFO_NOTEMPTY = NAME ## _RX_STS_FIFO_NOTEMPTY, \
+      .RX_STS_OVERRUN       = NAME ## _RX_STS_OVERRUN,       \
+      .RX_STS_STOP_ERROR    = NAME ## _RX_STS_STOP_ERROR,    \
+      .RX_STS_PAR_ERROR     = NAME ## _RX_STS_PAR_ERROR,     \
+      .RX_STS_BREAK         = NAME ## _RX_STS_BREAK,         \
+    };                                                \
+    uart_init_m(uh, &hw_, rxbuf, rxsize, 0, 0);       \
     isr_ ## NAME ## _Rx_StartEx(isr_ ## NAME ## _Rx); \
   } while( 0 )
 
+//! Enable DMA transmit. (call after uart_init or uart_init_tx)
+/*! dma is UART_TX_DMA supplied by the caller. */
+#define uart_init_tx_dma(uh, dma, NAME)                                \
+  do {                                                                 \
+    uart_init_tx_dma_m(uh, dma,                                        \
+                       DMA_ ## NAME ## _Tx_DmaInitialize(1, 1,         \
+                         HI16(CYDEV_SRAM_BASE), HI16(CYDEV_PERIPH_BASE)), \
+                       DMA_ ## NAME ## _Tx__TD_TERMOUT_EN,             \
+                       (void *)NAME ## _TXDATA_PTR,                    \
+                       isr_ ## NAME ## _Tx_Enable,                     \
+                       isr_ ## NAME ## _Tx_Disable);                   \
+    isr_ ## NAME ## _TxDma_StartEx(isr_ ## NAME ## _TxDma);            \
+  } while( 0 )
+
+//! Enable RTS/CTS flow control. (call after uart_init)
+/*! flow is UART_FLOW supplied by the caller.
+    RTS and CTS are Digital Output/Input Pin components. (active low) */
+#define uart_init_rtscts(uh, flow, RTS, CTS)                           \
+  uart_init_flow_m(uh, flow, RTS ## _Write, CTS ## _Read)
+
+//! Enable RS-485 half duplex. (call after uart_init)
+/*! rs485 is UART_RS485 supplied by the caller.
+    DE is a Digital Output Pin component. (active high)
+    Tx ISR switches the interrupt source to "TX complete" at the end. */
+#define uart_init_rs485(uh, rs485, NAME, DE)                           \
+  uart_init_rs485_m(uh, rs485, NAME ## _TX_STS_COMPLETE,               \
+                    NAME ## _SetTxInterruptMode, DE ## _Write)
+
+//! Enable address filter by mark parity. (9 bit multi-drop)
+/*! af is UART_ADDR_FILTER supplied by the caller.
+    Set Parity Type of the UART to "Mark/Space", and Address mode
+    to "Software Byte by Byte". */
+#define uart_set_address_mark(uh, af, NAME, address, broadcast)        \
+  uart_set_address_filter_m(uh, af, NAME ## _RX_STS_MRKSPC, 0, address, broadcast)
+
 /***** Typedefs *************************************************************/
 
+struct UART_HANDLE;
+
+//================================================
+/*!@brief
+  Component functions and status bits. (one constant table per UART)
+*/
+typedef struct UART_HW {
+  void    (*Start)(void);
+  void    (*ClearTxBuffer)(void);
+  void    (*ClearRxBuffer)(void);
+  uint8_t (*ReadTxStatus)(void);
+  uint8_t (*ReadRxStatus)(void);
+  void    (*WriteTxData)(uint8_t);
+  uint8_t (*ReadRxData)(void);
+  uint8_t TX_STS_FIFO_EMPTY;
+  uint8_t RX_STS_FIFO_NOTEMPTY;
+  uint8_t RX_STS_OVERRUN;
+  uint8_t RX_STS_STOP_ERROR;
+  uint8_t RX_STS_PAR_ERROR;
+  uint8_t RX_STS_BREAK;
+} UART_HW;
+
+
+//================================================
+/*!@brief
+  Frame descriptor for idle gap framing.
+*/
+typedef struct UART_FRAME {
+  uint16_t start;               //!< index of rxfifo of the first byte.
+  uint16_t length;              //!< length of the frame.
+} UART_FRAME;
+
+//! callback function. called in ISR context.
+typedef void (*UART_CALLBACK)(struct UART_HANDLE *uh, int event);
+
+
+//================================================
+/*!@brief
+  UART receive statistics
+*/
+typedef struct UART_STATISTICS {
+  uint32_t rx_bytes;            //!< num of received bytes.
+  uint16_t rx_overflow;         //!< num of bytes dropped by rxfifo or frame queue full.
+  uint16_t rx_overrun;          //!< num of hardware FIFO overrun.
+  uint16_t rx_framing_error;    //!< num of framing (stop bit) error.
+  uint16_t rx_parity_error;     //!< num of parity error.
+  uint16_t rx_break;            //!< num of break detected.
+  uint16_t rx_high_water;       //!< maximum bytes stored in rxfifo.
+  uint16_t rx_packet_error;     //!< num of packets dropped by decode error.
+  uint32_t rx_filtered;         //!< num of bytes discarded by address filter.
+} UART_STATISTICS;
+
+
+//================================================
+/*!@brief
+  State of flow control. (RTS/CTS, XON/XOFF)
+*/
+typedef struct UART_FLOW {
+  //! @privatesection
+  uint16_t          rx_high;                  // rxfifo bytes to stop the peer.
+  uint16_t          rx_low;                   // rxfifo bytes to restart the peer.
+  volatile uint8_t  rx_off;                   // the peer is stopped.
+  volatile uint8_t  tx_wait;                  // Tx is paused by CTS or XOFF.
+  volatile uint8_t  tx_xoff;                  // XOFF received.
+  volatile uint8_t  tx_ctrl;                  // XON/XOFF to send ahead of txfifo.
+  void    (*RtsWrite)(uint8_t);
+  uint8_t (*CtsRead)(void);
+} UART_FLOW;
+
+
+//================================================
+/*!@brief
+  State of idle gap framing and packet decoder.
+*/
+typedef struct UART_FRAMEQ {
+  //! @privatesection
+  uint16_t          gap;                      // idle time to close a frame.
+  volatile uint16_t time;                     // time of the last byte. (ISR)
+  volatile uint16_t start;                    // index of the frame receiving.
+  volatile uint8_t  open;                     // a frame is receiving.
+  volatile uint16_t rd;                       // index of q for read.
+  volatile uint16_t wr;                       // index of q for write.
+  uint16_t          size;                     // num of descriptors in q.
+  UART_FRAME       *q;                        // queue of received frames.
+  uint16_t (*GetTime)(void);
+
+  // packet decoder. (COBS, SLIP)
+  uint16_t          pkt_wr;                   // index of rxfifo to store decoded byte. (ISR)
+  uint8_t           pkt_code;                 // COBS: bytes left in the block.
+  uint8_t           pkt_state;                // decoder state.
+} UART_FRAMEQ;
+
+
+//================================================
+/*!@brief
+  State of DMA transmit.
+*/
+typedef struct UART_TX_DMA {
+  //! @privatesection
+  uint8_t           ch;                       // DMA channel.
+  uint8_t           td;                       // DMA TD.
+  uint8_t           termout;                  // TD config of completion interrupt.
+  volatile uint16_t size;                     // transfer size in progress. (0: idle)
+  volatile void    *p_txdata;                 // address of Tx data register.
+  void (*TxIsrEnable)(void);
+  void (*TxIsrDisable)(void);
+} UART_TX_DMA;
+
+
+//================================================
+/*!@brief
+  State of RS-485 half duplex.
+*/
+typedef struct UART_RS485 {
+  //! @privatesection
+  volatile uint8_t  de;                       // DE is asserted.
+  volatile uint8_t  armed;                    // waiting TX complete of the last byte.
+  uint8_t           TX_STS_COMPLETE;
+  volatile uint16_t sent;                     // num of bytes written to the hardware.
+  volatile uint16_t echo;                     // num of echoes discarded. (Rx ISR)
+  void (*SetTxInterruptMode)(uint8_t);
+  void (*DeWrite)(uint8_t);
+} UART_RS485;
+
+
+//================================================
+/*!@brief
+  State of UART-to-UART bridge.
+*/
+typedef struct UART_BRIDGE {
+  //! @privatesection
+  struct UART_HANDLE *volatile src;           // Tx: forward rxfifo of this handle.
+  struct UART_HANDLE *volatile dst;           // Rx: forwarded to this handle.
+  volatile uint32_t bytes;                    // Tx: num of forwarded bytes.
+  uint32_t          mark_bytes;               // bytes at the last rate sample.
+  uint32_t          mark_tick;                // uart_tick_count at the last rate sample.
+} UART_BRIDGE;
+
+
+//================================================
+/*!@brief
+  State of address filter. (multi-drop)
+*/
+typedef struct UART_ADDR_FILTER {
+  //! @privatesection
+  uint8_t           RX_STS_MRKSPC;            // mark parity mode, or 0. (prefix mode)
+  uint8_t           prefix;                   // byte before address. (prefix mode)
+  uint8_t           address;                  // address of this node.
+  uint8_t           broadcast;                // broadcast address.
+  volatile uint8_t  next;                     // prefix received, next is address.
+  volatile uint8_t  match;                    // the frame is addressed to this node.
+} UART_ADDR_FILTER;
+
+
 //================================================
 /*!@brief
   UART Handle
@@ -117,54 +398,180 @@ extern "C" {
 typedef struct UART_HANDLE {
   //! @privatesection
   // for transmit
-  const uint8_t    *p_txbuf;                  // pointer of tx buffer.
-  uint16_t          size_txbuf;               // size of tx buffer.
-  volatile uint16_t tx_rd;                    // index of sendout bytes.
-  volatile char     flag_tx_finished;
+  volatile uint16_t tx_rd;                    // index of txfifo for read.
+  volatile uint16_t tx_wr;                    // index of txfifo for write. (committed)
+  volatile uint16_t tx_resv;                  // index of txfifo reserved by writers.
+  volatile uint8_t  tx_busy;                  // num of writers between reserve and commit.
+  volatile char     flag_tx_finished;         // txfifo is empty and tx ISR is idle.
   uint8_t           mode;                     // work mode.
+  volatile char    *txfifo;                   // FIFO for transmit data.
+  uint16_t          tx_size;                  // size of txfifo.
 
   // for receive.
   uint8_t           rx_overflow;	      // buffer overflow flag.
-  uint8_t           delimiter;                //!<@public delimiter of read line (gets). default '\\n'.
+  uint8_t           delimiter;                //!<@public delimiter of read line (gets). default '\\n'. Set before receiving data.
 
   volatile uint16_t rx_rd;                    // index of rxfifo for read.
   volatile uint16_t rx_wr;                    // index of rxfifo for write.
-  volatile char     rxfifo[UART_SIZE_RXFIFO]; // FIFO for received data.
+  volatile uint16_t rx_delim_in;              // num of delimiters stored. (ISR)
+  uint16_t          rx_delim_out;             // num of delimiters read out.
+  volatile uint16_t rx_delim_pos;             // index of the first delimiter.
+  UART_STATISTICS   stat;                     // receive statistics. (ISR)
+  volatile char    *rxfifo;                   // FIFO for received data.
+  uint16_t          rx_size;                  // size of rxfifo.
 
-  // constant table
-  uint8_t TX_STS_FIFO_EMPTY;
-  uint8_t RX_STS_FIFO_NOTEMPTY;
+  // for callback.
+  UART_CALLBACK     callback;                 // callback function.
+  volatile uint8_t  callback_events;          // enabled events.
+  uint16_t          rx_threshold;             // bytes in rxfifo for RX_THRESHOLD event.
 
-  // function table
-  void (*Start)(void);
-  void (*Stop)(void);
-  void (*ClearTxBuffer)(void);
-  void (*ClearRxBuffer)(void);
-  uint8_t (*ReadRxStatus)(void);
-  uint8_t (*ReadTxStatus)(void);
-  void (*WriteTxData)(uint8_t);
-  uint8_t (*ReadRxData)(void);
+  // component functions.
+  const UART_HW    *hw;
+
+  // optional features. (supplied by the caller, NULL if not used)
+  UART_FLOW        *flow;
+  UART_FRAMEQ      *frame;
+  UART_TX_DMA      *dma;
+  UART_RS485       *rs485;
+  UART_BRIDGE      *bridge;
+  UART_ADDR_FILTER *addr_filter;
 } UART_HANDLE;
 
 
 /***** Global variables *****************************************************/
+extern volatile uint32_t uart_tick_count;
+
+
 /***** Function prototypes **************************************************/
 void uart_isr_tx(UART_HANDLE *uh);
 void uart_isr_rx(UART_HANDLE *uh);
-void uart_init_m(UART_HANDLE *uh, uint8_t tx_sts_fifo_empty, uint8_t rx_sts_fifo_notempty, void *Start, void *Stop, void *ClearTxBuffer, void *ClearRxBuffer, void *ReadTxStatus, void *ReadRxStatus, void *WriteTxData, void *ReadRxData);
+void uart_isr_tx_dma(UART_HANDLE *uh);
+void uart_rx_error_count(UART_HANDLE *uh, uint8_t sts);
+void uart_rx_flow_stop(UART_HANDLE *uh);
+void uart_rs485_arm(UART_HANDLE *uh);
+void uart_rs485_disarm(UART_HANDLE *uh);
+void uart_rs485_release(UART_HANDLE *uh);
+void uart_bridge_fill(UART_HANDLE *uh);
+void uart_bridge_kick(UART_HANDLE *uh);
+void uart_frame_mark(UART_HANDLE *uh, uint16_t rx_wr);
+void uart_tx_xonxoff(UART_HANDLE *uh, uint8_t ch);
+void uart_packet_rx(UART_HANDLE *uh, uint8_t ch);
+void uart_tx_dma_start(UART_HANDLE *uh, uint16_t size);
+void uart_init_m(UART_HANDLE *uh, const UART_HW *hw, void *rxbuf, uint16_t rxsize, void *txbuf, uint16_t txsize);
+void uart_init_tx_dma_m(UART_HANDLE *uh, UART_TX_DMA *dma, uint8_t dma_ch, uint8_t td_termout, void *p_txdata, void (*TxIsrEnable)(void), void (*TxIsrDisable)(void));
+void uart_tick(void);
+void uart_init_flow_m(UART_HANDLE *uh, UART_FLOW *flow, void (*RtsWrite)(uint8_t), uint8_t (*CtsRead)(void));
+void uart_init_xonxoff(UART_HANDLE *uh, UART_FLOW *flow);
+void uart_init_rs485_m(UART_HANDLE *uh, UART_RS485 *rs485, uint8_t tx_sts_complete, void (*SetTxInterruptMode)(uint8_t), void (*DeWrite)(uint8_t));
+void uart_set_address_filter_m(UART_HANDLE *uh, UART_ADDR_FILTER *af, uint8_t rx_sts_mrkspc, uint8_t prefix, uint8_t address, uint8_t broadcast);
+void uart_set_address_prefix(UART_HANDLE *uh, UART_ADDR_FILTER *af, uint8_t prefix, uint8_t address, uint8_t broadcast);
+void uart_clear_address_filter(UART_HANDLE *uh);
+void uart_set_rx_watermark(UART_HANDLE *uh, uint16_t high, uint16_t low);
+void uart_cts_changed(UART_HANDLE *uh);
 void uart_clear_tx_buffer(UART_HANDLE *uh);
 void uart_clear_rx_buffer(UART_HANDLE *uh);
 int uart_write(UART_HANDLE *uh, const void *buffer, size_t size);
 int uart_read(UART_HANDLE *uh, void *buffer, size_t size);
 int uart_gets(UART_HANDLE *uh, char *buf, size_t size);
+int uart_write_timeout(UART_HANDLE *uh, const void *buffer, size_t size, uint32_t timeout);
+int uart_write_atomic(UART_HANDLE *uh, const void *buffer, size_t size);
+int uart_printf(UART_HANDLE *uh, const char *fmt, ...);
+int uart_vprintf(UART_HANDLE *uh, const char *fmt, va_list ap);
+int uart_read_timeout(UART_HANDLE *uh, void *buffer, size_t size, uint32_t timeout);
+int uart_gets_timeout(UART_HANDLE *uh, char *buf, size_t size, uint32_t timeout);
 int uart_read_block(UART_HANDLE *uh, void *buffer, size_t size);
 int uart_read_nonblock(UART_HANDLE *uh, void *buffer, size_t size);
+int uart_rx_peek(UART_HANDLE *uh, const uint8_t **pp);
+void uart_rx_consume(UART_HANDLE *uh, size_t size);
 int uart_bytes_available(UART_HANDLE *uh);
 int uart_can_read_line(UART_HANDLE *uh);
+int uart_init_frame(UART_HANDLE *uh, UART_FRAMEQ *fr, UART_FRAME *q, uint16_t n);
+int uart_set_frame_gap(UART_HANDLE *uh, uint16_t (*GetTime)(void), uint16_t gap);
+void uart_frame_poll(UART_HANDLE *uh);
+const UART_FRAME *uart_frame_peek(UART_HANDLE *uh);
+void uart_frame_discard(UART_HANDLE *uh);
+int uart_read_frame(UART_HANDLE *uh, void *buffer, size_t size);
+int uart_set_packet_mode(UART_HANDLE *uh, int mode);
+int uart_send_packet(UART_HANDLE *uh, const void *buffer, size_t size);
+int uart_recv_packet(UART_HANDLE *uh, void *buffer, size_t size);
+int uart_recv_packet_timeout(UART_HANDLE *uh, void *buffer, size_t size, uint32_t timeout);
+void uart_init_bridge(UART_HANDLE *uh, UART_BRIDGE *br);
+int uart_bridge(UART_HANDLE *src, UART_HANDLE *dst);
+void uart_bridge_stop(UART_HANDLE *src);
+uint32_t uart_bridge_rate(UART_HANDLE *dst);
+void uart_get_statistics(UART_HANDLE *uh, UART_STATISTICS *st);
+void uart_clear_statistics(UART_HANDLE *uh);
 
 
 /***** Inline functions *****************************************************/
 
+//================================================================
+/*! Ring buffer index operations.
+
+  @internal
+  Indexes of rxfifo and txfifo are handled only by these functions.
+
+  Default: an index is a position in the buffer (0 .. size-1), and one
+  byte is left unused to distinguish full from empty.
+
+  UART_RING_POW2: sizes must be power of 2. An index runs freely and
+  wraps at 65536, the position is (index & (size-1)), and the full size
+  can be used.
+
+  Lock-free single producer / single consumer:
+  The write index is written only by the producer, and the read index
+  only by the consumer. The producer stores data, then publishes the
+  write index. The consumer reads the write index, reads data, then
+  publishes the read index. UART_RING_BARRIER() keeps the compiler from
+  moving non-volatile buffer accesses (memcpy) across the index access.
+  Cortex-M3 is single core, and an ISR observes the memory accesses of
+  main in program order, so no hardware barrier is needed.
+*/
+#if defined(UART_RING_POW2)
+static inline uint16_t uart_ring_pos(uint16_t idx, uint16_t size)
+{
+  return idx & (size - 1);
+}
+
+static inline uint16_t uart_ring_add(uint16_t idx, uint16_t n, uint16_t size)
+{
+  return idx + n;
+}
+
+static inline uint16_t uart_ring_count(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return wr - rd;
+}
+
+static inline uint16_t uart_ring_space(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return size - (uint16_t)(wr - rd);
+}
+
+#else
+static inline uint16_t uart_ring_pos(uint16_t idx, uint16_t size)
+{
+  return idx;
+}
+
+static inline uint16_t uart_ring_add(uint16_t idx, uint16_t n, uint16_t size)
+{
+  idx += n;
+  return (idx >= size) ? idx - size : idx;
+}
+
+static inline uint16_t uart_ring_count(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return (rd <= wr) ? wr - rd : size - rd + wr;
+}
+
+static inline uint16_t uart_ring_space(uint16_t rd, uint16_t wr, uint16_t size)
+{
+  return size - 1 - uart_ring_count(rd, wr, size);
+}
+#endif
+
+
 //================================================================
 /*! set work mode
 
@@ -184,7 +591,7 @@ static inline void uart_set_mode(UART_HANDLE *uh, int mode)
   @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
   @param  buf           Pointer of buffer.
-  @return               Size of transmitted.
+  @return               Size of queued bytes.
 */
 static inline int uart_puts(UART_HANDLE *uh, const char *buf)
 {
@@ -198,7 +605,7 @@ static inline int uart_puts(UART_HANDLE *uh, const char *buf)
   @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
   @param  ch            character
-  @return               Size of transmitted.
+  @return               Size of queued bytes.
 */
 static inline int uart_putc(UART_HANDLE *uh, int ch)
 {
@@ -226,7 +633,7 @@ static inline int uart_getc(UART_HANDLE *uh)
 
 
 //================================================================
-/*! check write finished?
+/*! check write finished? (all data were passed to the hardware FIFO)
 
   @memberof UART_HANDLE
   @param  uh            Pointer of UART_HANDLE.
@@ -238,6 +645,19 @@ static inline int uart_is_write_finished(const UART_HANDLE *uh)
 }
 
 
+//================================================================
+/*! check transmit complete? (RS-485 mode. the stop bit of the last byte was sent)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @return int           result (bool)
+*/
+static inline int uart_is_tx_complete(const UART_HANDLE *uh)
+{
+  return uh->flag_tx_finished && !(uh->rs485 && uh->rs485->de);
+}
+
+
 //================================================================
 /*! check data can be read.
 
@@ -264,6 +684,386 @@ static inline int uart_is_rx_overflow(const UART_HANDLE *uh)
 
 
 
+//================================================================
+/*! set callback function.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  events        Enabled events. (UART_EVENT_*, OR-ed)
+  @param  callback      Callback function.
+  @note
+    The callback is called in ISR context. Keep it short (e.g. wake up
+    a task), and read or write data in the main context.
+    UART_EVENT_TX_DRAINED: all data were moved out of the hardware FIFO.
+    UART_EVENT_RX_THRESHOLD: rxfifo reached uart_set_rx_threshold() bytes.
+    UART_EVENT_RX_DELIMITER: the delimiter was received.
+    UART_EVENT_RX_FRAME: a frame or packet was received.
+    UART_EVENT_TX_COMPLETE: RS-485 DE was released.
+*/
+static inline void uart_set_callback(UART_HANDLE *uh, int events, UART_CALLBACK callback)
+{
+  uh->callback_events = 0;
+  uh->callback = callback;
+  uh->callback_events = events;
+}
+
+
+//================================================================
+/*! set threshold for UART_EVENT_RX_THRESHOLD.
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  size          Num of bytes in rxfifo.
+*/
+static inline void uart_set_rx_threshold(UART_HANDLE *uh, uint16_t size)
+{
+  uh->rx_threshold = size;
+}
+
+
+//================================================================
+/*! get a byte of the frame. (zero copy)
+
+  @memberof UART_HANDLE
+  @param  uh            Pointer of UART_HANDLE.
+  @param  frame         Frame descriptor from uart_frame_peek().
+  @param  i             Offset in the frame. (< frame->length)
+  @return int           data.
+*/
+static inline int uart_frame_byte(const UART_HANDLE *uh, const UART_FRAME *frame, uint16_t i)
+{
+  return (uint8_t)uh->rxfifo[uart_ring_pos(uart_ring_add(frame->start, i, uh->rx_size), uh->rx_size)];
+}
+
+
+//================================================================
+/*! check data to transmit.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @return int           result (bool)
+*/
+static inline int uart_tx_pending(const UART_HANDLE *uh)
+{
+  if( uh->bridge && uh->bridge->src ) {
+    const UART_HANDLE *src = uh->bridge->src;
+    return src->rx_rd != src->rx_wr;
+  }
+  return uh->tx_rd != uh->tx_wr;
+}
+
+
+//================================================================
+/*! move data from txfifo to the hardware FIFO. (template)
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  WriteTxData   NAME_WriteTxData function.
+  @note
+    When called with a constant function, the compiler inlines it
+    as a direct call.
+    The caller owns the transmitter. (flag_tx_finished is cleared)
+    Tx ISR calls this out of critical section, so the parts shared
+    with the other contexts take a critical section of their own.
+*/
+static inline void uart_tx_fill_t(UART_HANDLE *uh, void (*WriteTxData)(uint8_t))
+{
+  // RS-485: more data before the end, wait for FIFO empty again.
+  if( uh->rs485 && uh->rs485->armed ) uart_rs485_disarm(uh);
+
+  // bridge: data comes from rxfifo of the other handle.
+  if( uh->bridge && uh->bridge->src ) {
+    uart_bridge_fill(uh);
+    return;
+  }
+
+  UART_FLOW *flow = uh->flow;
+  uint16_t tx_rd = uh->tx_rd;
+  uint16_t tx_wr = uh->tx_wr;
+  uint16_t n     = uart_ring_count(tx_rd, tx_wr, uh->tx_size);
+  uint8_t  sent  = 0;
+
+  if( flow ) {
+    // with uart_tx_ctrl() and uart_tx_resume(), which run in ISRs.
+    uint8 interrupts = CyEnterCriticalSection();
+
+    // XON/XOFF is sent ahead of txfifo.
+    if( flow->tx_ctrl ) {
+      WriteTxData( flow->tx_ctrl );
+      flow->tx_ctrl = 0;
+      if( uh->rs485 ) uh->rs485->sent++;
+      sent = 1;
+    }
+
+    // pause while CTS is deasserted or XOFF received.
+    uint8_t pause = n != 0 && (flow->tx_xoff || (flow->CtsRead && flow->CtsRead()));
+    flow->tx_wait = pause;
+    CyExitCriticalSection( interrupts );
+    if( pause ) return;
+  }
+
+  // large contiguous data is transmitted by DMA.
+  if( uh->dma && !sent ) {
+    uint16_t n_cont = uh->tx_size - uart_ring_pos(tx_rd, uh->tx_size);
+    if( n_cont > n ) n_cont = n;
+    if( n_cont >= UART_TX_DMA_MIN_SIZE ) {
+      uart_tx_dma_start(uh, n_cont);
+      return;
+    }
+  }
+
+  // 4 = Hardware FIFO size for PSoC5LP UART module
+  if( n > 4 - sent ) n = 4 - sent;
+  if( uh->rs485 ) uh->rs485->sent += n;
+  for( ; n > 0; n-- ) {
+    WriteTxData( uh->txfifo[uart_ring_pos(tx_rd, uh->tx_size)] );
+    tx_rd = uart_ring_add(tx_rd, 1, uh->tx_size);
+  }
+  uh->tx_rd = tx_rd;
+
+  // release the transmitter. A writer may have committed meanwhile,
+  // then Tx ISR continues at the next FIFO empty.
+  if( tx_rd == tx_wr ) {
+    uint8 interrupts = CyEnterCriticalSection();
+    if( tx_rd == uh->tx_wr ) uh->flag_tx_finished = 1;
+    CyExitCriticalSection( interrupts );
+  }
+}
+
+
+//================================================================
+/*! Tx interrupt handler. (template)
+
+  @internal
+  @param  uh                Pointer of UART_HANDLE.
+  @param  tx_sts_fifo_empty NAME_TX_STS_FIFO_EMPTY
+  @param  ReadTxStatus      NAME_ReadTxStatus function.
+  @param  WriteTxData       NAME_WriteTxData function.
+  @note
+    Don't use this directry. Use UART_ISR macro.
+*/
+static inline void uart_isr_tx_t(UART_HANDLE *uh, uint8_t tx_sts_fifo_empty,
+                                 uint8_t (*ReadTxStatus)(void),
+                                 void (*WriteTxData)(uint8_t))
+{
+  if( uh->dma && uh->dma->size != 0 ) return;
+
+  // writers in higher priority ISRs kick Tx in critical section.
+  // The status read and the claim of the transmitter are in critical
+  // section too, so a kick never fills at the same time. The data are
+  // moved after it.
+  uint8 interrupts = CyEnterCriticalSection();
+  uint8_t event = 0;
+  uint8_t fill  = 0;
+
+  // clear Tx status register and check simply.
+  uint8_t sts = ReadTxStatus();
+
+  // RS-485: release the bus after the stop bit of the last byte.
+  if( uh->rs485 && uh->rs485->armed ) {
+    if( sts & uh->rs485->TX_STS_COMPLETE ) {
+      uart_rs485_release(uh);
+      event = UART_EVENT_TX_COMPLETE;
+    }
+
+  } else if( sts & tx_sts_fifo_empty ) {
+    if( uart_tx_pending(uh) || (uh->flow && uh->flow->tx_ctrl) ) {
+      uh->flag_tx_finished = 0;         // claim, uart_tx_kick() doesn't fill.
+      fill = 1;
+
+    } else {
+      // RS-485: the last byte is still in the shift register. TX complete
+      // read above is of the byte before, and was cleared by the read.
+      if( uh->rs485 && uh->rs485->de ) uart_rs485_arm(uh);
+      event = UART_EVENT_TX_DRAINED;    // the hardware FIFO became empty after all data.
+    }
+  }
+  CyExitCriticalSection( interrupts );
+
+  if( fill ) uart_tx_fill_t(uh, WriteTxData);
+
+  // callback out of critical section.
+  if( uh->callback_events & event ) uh->callback(uh, event);
+}
+
+
+//================================================================
+/*! address filter of multi-drop bus.
+
+  @internal
+  @param  af            Pointer of UART_ADDR_FILTER.
+  @param  ch            received byte.
+  @param  sts           Rx status read with the byte.
+  @return int           1 if the byte is stored, 0 if discarded.
+  @note
+    An address byte opens a frame, which continues until the next
+    address byte. The address byte of matched frame is stored, so
+    the reader can find the top of the frame.
+*/
+static inline int uart_rx_addr_filter(UART_ADDR_FILTER *af, uint8_t ch, uint8_t sts)
+{
+  int is_addr;
+
+  if( af->RX_STS_MRKSPC ) {
+    is_addr = (sts & af->RX_STS_MRKSPC) != 0;   // 9th bit is set.
+  } else if( af->next ) {
+    af->next = 0;
+    is_addr = 1;                                // the byte after the prefix.
+  } else if( ch == af->prefix ) {
+    af->next = 1;
+    af->match = 0;
+    return 0;
+  } else {
+    is_addr = 0;
+  }
+
+  if( is_addr ) af->match = (ch == af->address || ch == af->broadcast);
+  return af->match;
+}
+
+
+//================================================================
+/*! Rx interrupt handler, without optional features. (template)
+
+  @internal
+  @see uart_isr_rx_t
+  @note
+    Stores the bytes only. The features are checked once per interrupt
+    in uart_isr_rx_t, not per byte.
+*/
+static inline void uart_isr_rx_plain_t(UART_HANDLE *uh, int sts,
+                                       uint8_t rx_sts_fifo_notempty,
+                                       uint8_t rx_sts_errors,
+                                       uint8_t (*ReadRxStatus)(void),
+                                       uint8_t (*ReadRxData)(void))
+{
+  uint16_t rx_wr = uh->rx_wr;
+
+  for(; sts != 0; sts = ReadRxStatus()) {
+    if( sts & rx_sts_fifo_notempty ) {
+      uint8_t ch = ReadRxData();
+
+      uh->stat.rx_bytes++;
+      if( uart_ring_space(uh->rx_rd, rx_wr, uh->rx_size) == 0 ) {
+        uh->rx_overflow = 1;    // buffer full
+        uh->stat.rx_overflow++;
+
+      } else {
+        uh->rxfifo[uart_ring_pos(rx_wr, uh->rx_size)] = ch;
+
+        // count delimiter, and keep the position of first one.
+        if( ch == uh->delimiter ) {
+          if( uh->rx_delim_in == uh->rx_delim_out ) uh->rx_delim_pos = rx_wr;
+          uh->rx_delim_in++;
+        }
+        rx_wr = uart_ring_add(rx_wr, 1, uh->rx_size);
+        uh->rx_wr = rx_wr;
+
+        uint16_t n = uart_ring_count(uh->rx_rd, rx_wr, uh->rx_size);
+        if( n > uh->stat.rx_high_water ) uh->stat.rx_high_water = n;
+      }
+    }
+
+    // error status. (these bits are cleared by reading the status)
+    if( sts & rx_sts_errors ) uart_rx_error_count(uh, sts);
+  }
+}
+
+
+//================================================================
+/*! Rx interrupt handler. (template)
+
+  @internal
+  @param  uh                   Pointer of UART_HANDLE.
+  @param  rx_sts_fifo_notempty NAME_RX_STS_FIFO_NOTEMPTY
+  @param  rx_sts_errors        NAME_RX_STS_(OVERRUN|STOP_ERROR|PAR_ERROR|BREAK)
+  @param  ReadRxStatus         NAME_ReadRxStatus function.
+  @param  ReadRxData           NAME_ReadRxData function.
+  @note
+    Don't use this directry. Use UART_ISR macro.
+*/
+static inline void uart_isr_rx_t(UART_HANDLE *uh, uint8_t rx_sts_fifo_notempty,
+                                 uint8_t rx_sts_errors,
+                                 uint8_t (*ReadRxStatus)(void),
+                                 uint8_t (*ReadRxData)(void))
+{
+  int sts = ReadRxStatus();
+
+  // no feature attached, the common case.
+  if( !(uh->mode & (UART_XONXOFF | UART_PACKET_COBS | UART_PACKET_SLIP | UART_RS485_ECHO)) &&
+      !uh->addr_filter && !uh->frame && !uh->flow && !uh->bridge && !uh->callback_events ) {
+    uart_isr_rx_plain_t(uh, sts, rx_sts_fifo_notempty, rx_sts_errors,
+                        ReadRxStatus, ReadRxData);
+    return;
+  }
+
+  for(; sts != 0; sts = ReadRxStatus()) {
+    if( sts & rx_sts_fifo_notempty ) {
+      uint8_t  ch    = ReadRxData();
+      uint16_t rx_wr = uh->rx_wr;
+
+      uh->stat.rx_bytes++;
+      if( uh->rs485 && (uh->mode & UART_RS485_ECHO) && uh->rs485->echo != uh->rs485->sent ) {
+        uh->rs485->echo++;              // echo of own transmission.
+
+      } else if( uh->addr_filter && !uart_rx_addr_filter(uh->addr_filter, ch, sts) ) {
+        uh->stat.rx_filtered++;         // not addressed to this node.
+
+      } else if( (uh->mode & UART_XONXOFF) && (ch == UART_XON || ch == UART_XOFF) ) {
+        uart_tx_xonxoff(uh, ch);        // not stored in rxfifo.
+
+      } else if( uh->mode & (UART_PACKET_COBS | UART_PACKET_SLIP) ) {
+        uart_packet_rx(uh, ch);         // decoded into rxfifo.
+
+      } else if( uart_ring_space(uh->rx_rd, rx_wr, uh->rx_size) == 0 ) {
+        uh->rx_overflow = 1;    // buffer full
+        uh->stat.rx_overflow++;
+
+      } else {
+        // idle gap framing. (a gap closes the previous frame)
+        if( uh->frame && uh->frame->GetTime ) uart_frame_mark(uh, rx_wr);
+
+        uh->rxfifo[uart_ring_pos(rx_wr, uh->rx_size)] = ch;
+
+        // count delimiter, and keep the position of first one.
+        if( ch == uh->delimiter ) {
+          if( uh->rx_delim_in == uh->rx_delim_out ) uh->rx_delim_pos = rx_wr;
+          uh->rx_delim_in++;
+        }
+        rx_wr = uart_ring_add(rx_wr, 1, uh->rx_size);
+        uh->rx_wr = rx_wr;
+
+        uint16_t n = uart_ring_count(uh->rx_rd, rx_wr, uh->rx_size);
+        if( n > uh->stat.rx_high_water ) uh->stat.rx_high_water = n;
+
+        // flow control. (restarted in the reader side)
+        if( uh->flow && n >= uh->flow->rx_high && !uh->flow->rx_off ) {
+          uart_rx_flow_stop(uh);
+        }
+
+        // bridge: start Tx of the other handle, if it is idle.
+        if( uh->bridge && uh->bridge->dst && uh->bridge->dst->flag_tx_finished ) {
+          uart_bridge_kick(uh->bridge->dst);
+        }
+
+        // callback after the data became readable.
+        if( uh->callback_events ) {
+          if( (uh->callback_events & UART_EVENT_RX_DELIMITER) && ch == uh->delimiter ) {
+            uh->callback(uh, UART_EVENT_RX_DELIMITER);
+          }
+          if( (uh->callback_events & UART_EVENT_RX_THRESHOLD) && n == uh->rx_threshold ) {
+            uh->callback(uh, UART_EVENT_RX_THRESHOLD);
+          }
+        }
+      }
+    }
+
+    // error status. (these bits are cleared by reading the status)
+    if( sts & rx_sts_errors ) uart_rx_error_count(uh, sts);
+  }
+}
+
+
 #ifdef __cplusplus
 }
 #endif
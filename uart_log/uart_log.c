@@ -0,0 +1,116 @@
+/*! @file
+  @brief
+  Deferred binary logging over UART for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/02/22 14:05:12
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+
+  Record format:
+    COBS( id arg0 arg1 ... ) 0x00
+    Each field is a varint, 7 bits per byte from LSB, MSB set if more
+    bytes follow. id is the offset of the format string in section
+    "uart_log" of the ELF file. Arguments are zigzag encoded
+    ((v << 1) ^ (v >> 31)), so small values of either sign take 1 or
+    2 bytes, and any 32 bit value at most 5 bytes.
+*/
+
+
+/***** System headers *******************************************************/
+#include <project.h>
+#include <stdarg.h>
+
+/***** Local headers ********************************************************/
+#include "uart_log.h"
+
+/***** Constant values ******************************************************/
+//! maximum size of varint of 32 bit value.
+#define UART_LOG_VARINT_MAX 5
+
+
+/***** Macros ***************************************************************/
+/***** Typedefs *************************************************************/
+/***** Function prototypes **************************************************/
+/***** Global variables *****************************************************/
+volatile uint16_t uart_log_dropped;
+
+
+/***** Local variables ******************************************************/
+/***** Local functions ******************************************************/
+
+//================================================================
+/*! encode a varint.
+
+  @param  p             Pointer of the output.
+  @param  v             value.
+  @return uint8_t *     Pointer next to the output.
+*/
+static uint8_t *uart_log_varint(uint8_t *p, uint32_t v)
+{
+  while( v >= 0x80 ) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+
+/***** Global functions *****************************************************/
+
+//================================================================
+/*! put a log record into txfifo.
+
+  @internal
+  @param  uh            Pointer of UART_HANDLE.
+  @param  id            ID of the format string.
+  @param  n             Num of arguments.
+  @return int           Size of queued bytes, or 0 if dropped.
+  @note
+    Don't use this directry. Use UART_LOG macro.
+*/
+int uart_log_m(UART_HANDLE *uh, uint16_t id, int n, ...)
+{
+  uint8_t rec[(1 + UART_LOG_MAX_ARGS) * UART_LOG_VARINT_MAX];
+  uint8_t buf[sizeof(rec) + 2];   // COBS: +1 code byte, +1 delimiter.
+  uint8_t *p = rec;
+  va_list ap;
+
+  p = uart_log_varint(p, id);
+  va_start(ap, n);
+  for( ; n > 0; n-- ) {
+    uint32_t v = va_arg(ap, uint32_t);
+    p = uart_log_varint(p, (v << 1) ^ (uint32_t)((int32_t)v >> 31));
+  }
+  va_end(ap);
+
+  // COBS encode. (a record is shorter than 254 bytes, so no 0xff block)
+  uint8_t *p_code = buf;
+  uint8_t *d = buf + 1;
+  uint8_t code = 1;
+  const uint8_t *s;
+  for( s = rec; s < p; s++ ) {
+    if( *s == 0 ) {
+      *p_code = code;
+      p_code = d++;
+      code = 1;
+    } else {
+      *d++ = *s;
+      code++;
+    }
+  }
+  *p_code = code;
+  *d++ = 0;
+
+  int ret = uart_write_atomic(uh, buf, d - buf);
+  // main and ISRs log at the same time, so count atomically.
+  if( ret == 0 ) __sync_add_and_fetch(&uart_log_dropped, 1);
+
+  return ret;
+}
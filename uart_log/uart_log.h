@@ -0,0 +1,77 @@
+/*! @file
+  @brief
+  Deferred binary logging over UART for PSoC5LP. (uses uart2)
+
+  @version 1.0
+  @date 2021/02/22 14:05:12
+
+  <pre>
+  Copyright (C) 2021 Shimane IT Open-Innovation Center.
+  All Rights Reserved.
+
+  This file is distributed under BSD 3-Clause License.
+  </pre>
+*/
+
+#ifndef PSOC5_UART_LOG_H_
+#define PSOC5_UART_LOG_H_
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***** System headers *******************************************************/
+#include <stdint.h>
+
+
+/***** Local headers ********************************************************/
+#include "uart2.h"
+
+
+/***** Constant values ******************************************************/
+//! maximum num of arguments of UART_LOG.
+#define UART_LOG_MAX_ARGS 8
+
+
+/***** Macros ***************************************************************/
+
+//! Log a message. (format string is expanded on the host)
+/*! Arguments must be 32 bit integers. (int, unsigned, pointer)
+    Can be called from ISR. Define UART_LOG_DISABLE to remove all logs. */
+#if defined(UART_LOG_DISABLE)
+# define UART_LOG(uh, fmt, ...) ((void)0)
+#else
+# define UART_LOG(uh, fmt, ...)                                           \
+  do {                                                                  \
+    static const char fmt_[] __attribute__((section("uart_log"), used)) = fmt; \
+    _Static_assert(UART_LOG_NARG(__VA_ARGS__) <= UART_LOG_MAX_ARGS,     \
+                   "UART_LOG: too many arguments");                     \
+    uart_log_m(uh, fmt_ - __start_uart_log,                             \
+               UART_LOG_NARG(__VA_ARGS__), ##__VA_ARGS__);               \
+  } while( 0 )
+#endif
+
+//! count arguments. (0 .. UART_LOG_MAX_ARGS, 9 if more than that)
+/*! More than 16 arguments are not counted. Then N is an argument,
+    and it is not a constant in most cases, so the assert fails too. */
+#define UART_LOG_NARG(...) UART_LOG_NARG_(0, ##__VA_ARGS__,              \
+                           9,9,9,9,9,9,9,9, 8,7,6,5,4,3,2,1,0)
+#define UART_LOG_NARG_(_0,_1,_2,_3,_4,_5,_6,_7,_8,_9,_10,_11,_12,_13,_14,_15,_16, N, ...) N
+
+
+/***** Typedefs *************************************************************/
+/***** Global variables *****************************************************/
+//! start of format strings. (defined by the linker)
+extern const char __start_uart_log[];
+
+//! num of records dropped by txfifo full.
+extern volatile uint16_t uart_log_dropped;
+
+
+/***** Function prototypes **************************************************/
+int uart_log_m(UART_HANDLE *uh, uint16_t id, int n, ...);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
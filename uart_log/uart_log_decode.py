@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""
+  Decoder for uart_log records.
+
+  usage: uart_log_decode.py firmware.elf [capture_file]
+
+  Reads records from capture_file (or stdin), and prints the messages
+  expanded with the format strings in section "uart_log" of the ELF.
+  A serial port can be read directly, e.g.
+    stty -F /dev/ttyUSB0 115200 raw
+    uart_log_decode.py firmware.elf /dev/ttyUSB0
+"""
+
+import re
+import struct
+import sys
+
+SECTION = b"uart_log"
+CONVERSION = re.compile(r"%[-+ #0]*\d*(?:\.\d+)?(?:hh|h|ll|l|z|t)?([diuxXoc%])")
+
+
+def load_section(path):
+    """ return the contents of section "uart_log". """
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF":
+        raise ValueError("not an ELF file")
+
+    if elf[4] == 1:     # ELF32
+        shoff, = struct.unpack_from("<I", elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2e)
+        sh = lambda i: struct.unpack_from("<IIIIII", elf, shoff + i * shentsize)
+    else:               # ELF64 (host test)
+        shoff, = struct.unpack_from("<Q", elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3a)
+        sh = lambda i: struct.unpack_from("<IIQQQQ", elf, shoff + i * shentsize)
+
+    strtab = sh(shstrndx)
+    for i in range(shnum):
+        name, _, _, _, offset, size = sh(i)
+        start = strtab[4] + name
+        if elf[start:elf.index(b"\0", start)] == SECTION:
+            return elf[offset:offset + size]
+    raise ValueError("section uart_log not found")
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def varints(rec):
+    """ return the varints of the record, or None if broken. """
+    values = []
+    v = shift = 0
+    for b in rec:
+        v |= (b & 0x7f) << shift
+        shift += 7
+        if b & 0x80:
+            if shift >= 35:
+                return None
+            continue
+        if v > 0xffffffff:
+            return None
+        values.append(v)
+        v = shift = 0
+    return values if shift == 0 else None
+
+
+def expand(strings, rec):
+    values = varints(rec) if rec is not None else None
+    if not values:
+        return "<broken record>"
+    fid = values[0]
+    if fid >= len(strings):
+        return "<unknown id %d>" % fid
+    fmt = strings[fid:strings.index(b"\0", fid)].decode("utf-8", "replace")
+    # zigzag to 32 bit value.
+    args = [(z >> 1) ^ (0xffffffff if z & 1 else 0) for z in values[1:]]
+
+    def conv(m):
+        if m.group(1) == "%":
+            return "%"
+        if not args:
+            return m.group(0)
+        v = args.pop(0)
+        spec = re.sub(r"(hh|h|ll|l|z|t)", "", m.group(0))
+        if m.group(1) in "di":
+            v = v - (1 << 32) if v & 0x80000000 else v
+        elif m.group(1) == "u":
+            spec = spec[:-1] + "d"
+        return spec % v
+
+    return CONVERSION.sub(conv, fmt)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    strings = load_section(sys.argv[1])
+    src = open(sys.argv[2], "rb", buffering=0) if len(sys.argv) > 2 else sys.stdin.buffer.raw
+
+    buf = bytearray()
+    while True:
+        data = src.read(256)
+        if not data:
+            break
+        buf += data
+        while b"\0" in buf:
+            i = buf.index(b"\0")
+            if i > 0:
+                print(expand(strings, cobs_decode(bytes(buf[:i]))), flush=True)
+            del buf[:i + 1]
+
+
+if __name__ == "__main__":
+    main()